@@ -0,0 +1,58 @@
+#ifndef __probreg_batch_h__
+#define __probreg_batch_h__
+
+#include <algorithm>
+#include <exception>
+#include <numeric>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "types.h"
+
+namespace probreg {
+
+// Runs fn(i) for the n independent items of a batch on the OpenMP threads, the most expensive first
+// according to cost(i). The threads take the next item as soon as they are free, so items of different
+// sizes balance. When there are at least as many items as threads, each item runs on a single thread:
+// the parallel regions of the kernels it calls get one thread, so the batch never runs more threads than
+// the pool. Otherwise the items run one after the other with all the threads given to the kernels.
+// The first exception thrown by an item is rethrown once all the items are done.
+template <typename Cost, typename Fn>
+void runBatch(Integer n, const Cost& cost, const Fn& fn) {
+    std::vector<double> costs(n);
+    for (Integer i = 0; i < n; ++i) costs[i] = cost(i);
+    std::vector<Integer> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&costs](Integer a, Integer b) { return costs[a] > costs[b]; });
+
+    std::exception_ptr error;
+    auto run = [&fn, &error](Integer i) {
+        try {
+            fn(i);
+        } catch (...) {
+            #pragma omp critical(probreg_batch_error)
+            if (!error) error = std::current_exception();
+        }
+    };
+#ifdef _OPENMP
+    if (n >= omp_get_max_threads() && n > 1) {
+        #pragma omp parallel
+        {
+            omp_set_num_threads(1);
+            #pragma omp for schedule(dynamic, 1)
+            for (Integer k = 0; k < n; ++k) run(order[k]);
+        }
+    } else {
+        for (Integer k = 0; k < n; ++k) run(order[k]);
+    }
+#else
+    for (Integer k = 0; k < n; ++k) run(order[k]);
+#endif
+    if (error) std::rethrow_exception(error);
+}
+
+}  // namespace probreg
+
+#endif
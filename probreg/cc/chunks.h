@@ -0,0 +1,25 @@
+#ifndef __probreg_chunks_h__
+#define __probreg_chunks_h__
+
+#include <algorithm>
+#include <cstdint>
+#include "types.h"
+
+namespace probreg {
+
+static const Integer MIN_CHUNK_SIZE = 4096;
+static const Integer MAX_NUM_CHUNKS = 64;
+
+// Points are split into a number of chunks that only depends on the number of points,
+// so that the reduction order, and therefore the result, does not depend on the number of threads.
+inline Integer numChunks(Integer n_points) {
+    return std::max(Integer(1), std::min(MAX_NUM_CHUNKS, n_points / MIN_CHUNK_SIZE));
+}
+
+inline Integer chunkBegin(Integer c, Integer n_chunks, Integer n_points) {
+    return Integer((int64_t(c) * n_points) / n_chunks);
+}
+
+}  // namespace probreg
+
+#endif
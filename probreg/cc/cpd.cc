@@ -0,0 +1,198 @@
+#include "cpd.h"
+#include <Eigen/Dense>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "batch.h"
+#include "direct_gauss_transform.h"
+#include "ifgt.h"
+#include "math_utils.h"
+
+using namespace probreg;
+
+namespace {
+
+static const double gauss_transform_eps = 1.0e-4;
+
+// Gauss transform of the columns of weights (M x k) evaluated at the target, written into gmat (N x k),
+// with the method of gauss_transform.GaussTransform: direct and exact if h < sw_h, IFGT otherwise.
+template <typename Scalar>
+void gaussTransform(const MatrixCRefT<Scalar>& source,
+                    Scalar h,
+                    Scalar sw_h,
+                    const MatrixCRefT<Scalar>& target,
+                    const MatrixT<Scalar>& weights,
+                    MatrixRefT<Scalar> gmat) {
+    if (h < sw_h) {
+        DirectGaussTransformT<Scalar>(source, h).compute(target, weights, gmat);
+    } else {
+        IfgtT<Scalar>(source, h, Scalar(gauss_transform_eps)).compute(target, weights, gmat);
+    }
+}
+
+}  // namespace
+
+template <typename Scalar>
+CoherentPointDriftT<Scalar>::CoherentPointDriftT(const MatrixCRefT<Scalar>& source,
+                                                 CpdTransformationType type,
+                                                 bool update_scale,
+                                                 Scalar sw_h)
+    : source_(source),
+      type_(type),
+      update_scale_(update_scale),
+      sw_h_(sw_h),
+      ones_(MatrixT<Scalar>::Ones(source.rows(), 1)),
+      n_p_(0.0) {
+    if (source_.rows() == 0) {
+        throw std::invalid_argument("The source is empty.");
+    }
+}
+
+template <typename Scalar>
+void CoherentPointDriftT<Scalar>::transformSource(const CpdResultT<Scalar>& res) {
+    t_source_.noalias() = source_ * (res.scale_ * res.rot_.transpose());
+    t_source_.rowwise() += res.t_.transpose();
+}
+
+template <typename Scalar>
+void CoherentPointDriftT<Scalar>::expectationStep(const MatrixCRefT<Scalar>& target,
+                                                  Scalar sigma2,
+                                                  Scalar w) {
+    const Integer ndim = source_.cols();
+    const Scalar h = std::sqrt(2.0 * sigma2);
+    Scalar c = std::pow(2.0 * M_PI * sigma2, ndim * 0.5);
+    c *= w / (1.0 - w) * source_.rows() / target.rows();
+
+    // a = 1 / (kt1 + c), the weights of the second transform are a and a * target
+    gaussTransform<Scalar>(t_source_, h, sw_h_, target, ones_, pt1_);
+    pt1_ = (pt1_.array() == 0.0).select(std::numeric_limits<Scalar>::epsilon(), pt1_);
+    weights_.col(0) = (pt1_.array() + c).inverse();
+    weights_.rightCols(ndim) = target.array().colwise() * weights_.col(0).array();
+    pt1_ = 1.0 - c * weights_.col(0).array();
+
+    gaussTransform<Scalar>(target, h, sw_h_, t_source_, weights_, p1_px_);
+    n_p_ = p1_px_.col(0).sum();
+}
+
+template <typename Scalar>
+void CoherentPointDriftT<Scalar>::maximizationStep(const MatrixCRefT<Scalar>& target,
+                                                   CpdResultT<Scalar>& res) const {
+    typedef Eigen::MatrixXd MatrixD;
+    typedef Eigen::VectorXd VectorD;
+    const Integer ndim = source_.cols();
+    const double n_p = n_p_;
+    const VectorD p1 = p1_px_.col(0).template cast<double>();
+    const VectorD pt1 = pt1_.template cast<double>();
+    const MatrixD px = p1_px_.rightCols(ndim).template cast<double>();
+    const VectorD mu_x = px.colwise().sum().transpose() / n_p;
+    const VectorD mu_y = source_.template cast<double>().transpose() * p1 / n_p;
+    const MatrixD source_hat = source_.template cast<double>().rowwise() - mu_y.transpose();
+    const MatrixD a = px.transpose() * source_hat - mu_x * (source_hat.transpose() * p1).transpose();
+    const MatrixD yp1y = source_hat.transpose() * p1.asDiagonal() * source_hat;
+    const double tr_xp1x =
+        pt1.dot((target.template cast<double>().rowwise() - mu_x.transpose()).rowwise().squaredNorm());
+    const double min_sigma2 = std::numeric_limits<Scalar>::epsilon();
+
+    double sigma2, q;
+    if (type_ == CPD_RIGID) {
+        Eigen::JacobiSVD<MatrixD> svd(a, Eigen::ComputeFullU | Eigen::ComputeFullV);
+        VectorD c = VectorD::Ones(ndim);
+        c[ndim - 1] = (svd.matrixU() * svd.matrixV().transpose()).determinant();
+        const MatrixD rot = svd.matrixU() * c.asDiagonal() * svd.matrixV().transpose();
+        const double tr_atr = (a.transpose() * rot).trace();
+        const double tr_yp1y = yp1y.trace();
+        const double scale = update_scale_ ? tr_atr / tr_yp1y : 1.0;
+        if (update_scale_) {
+            sigma2 = (tr_xp1x - scale * tr_atr) / (n_p * ndim);
+        } else {
+            sigma2 = (tr_xp1x + tr_yp1y - scale * tr_atr) / (n_p * ndim);
+        }
+        sigma2 = std::max(sigma2, min_sigma2);
+        q = (tr_xp1x - 2.0 * scale * tr_atr + scale * scale * tr_yp1y) / (2.0 * sigma2);
+        res.rot_ = rot.template cast<Scalar>();
+        res.t_ = (mu_x - scale * rot * mu_y).template cast<Scalar>();
+        res.scale_ = scale;
+    } else {
+        const MatrixD b = yp1y.transpose().partialPivLu().solve(a.transpose()).transpose();
+        const double tr_ab = (a * b.transpose()).trace();
+        sigma2 = std::max((tr_xp1x - tr_ab) / (n_p * ndim), min_sigma2);
+        q = (tr_xp1x - tr_ab) / (2.0 * sigma2);
+        res.rot_ = b.template cast<Scalar>();
+        res.t_ = (mu_x - b * mu_y).template cast<Scalar>();
+        res.scale_ = 1.0;
+    }
+    q += ndim * n_p * 0.5 * std::log(sigma2);
+    res.sigma2_ = sigma2;
+    res.q_ = q;
+}
+
+template <typename Scalar>
+CpdResultT<Scalar> CoherentPointDriftT<Scalar>::registration(const MatrixCRefT<Scalar>& target,
+                                                             Scalar w,
+                                                             Integer maxiter,
+                                                             Scalar tol,
+                                                             const Callback& callback) {
+    if (target.cols() != source_.cols()) {
+        throw std::invalid_argument("The dimensions of the target and the source do not match.");
+    }
+    if (target.rows() == 0) {
+        throw std::invalid_argument("The target is empty.");
+    }
+    if (w < 0.0 || w >= 1.0) {
+        throw std::invalid_argument("w must be in [0, 1).");
+    }
+    const Integer ndim = source_.cols();
+    CpdResultT<Scalar> res;
+    res.rot_ = MatrixT<Scalar>::Identity(ndim, ndim);
+    res.t_ = VectorT<Scalar>::Zero(ndim);
+    res.scale_ = 1.0;
+    res.sigma2_ = squaredKernelSum<Scalar>(source_, target) / (source_.rows() * ndim * target.rows());
+    res.q_ = 1.0 + target.rows() * ndim * 0.5 * std::log(res.sigma2_);
+    Scalar q = res.q_;
+    // The E-step writes into these, their sizes only change with the target.
+    pt1_.resize(target.rows());
+    weights_.resize(target.rows(), ndim + 1);
+    p1_px_.resize(source_.rows(), ndim + 1);
+    for (Integer i = 0; i < maxiter; ++i) {
+        transformSource(res);
+        expectationStep(target, res.sigma2_, w);
+        maximizationStep(target, res);
+        res.q_history_.push_back(res.q_);
+        res.sigma2_history_.push_back(res.sigma2_);
+        if (callback) callback(res);
+        if (std::abs(res.q_ - q) < tol) break;
+        q = res.q_;
+    }
+    return res;
+}
+
+template <typename Scalar>
+std::vector<CpdResultT<Scalar>> probreg::registerCpdBatch(const std::vector<MatrixT<Scalar>>& sources,
+                                                          const std::vector<MatrixT<Scalar>>& targets,
+                                                          CpdTransformationType type,
+                                                          bool update_scale,
+                                                          Scalar w,
+                                                          Integer maxiter,
+                                                          Scalar tol,
+                                                          Scalar sw_h) {
+    if (sources.size() != targets.size()) {
+        throw std::invalid_argument("The numbers of sources and targets do not match.");
+    }
+    std::vector<CpdResultT<Scalar>> results(sources.size());
+    runBatch(
+        sources.size(), [&](Integer i) { return double(sources[i].rows()) * targets[i].rows(); },
+        [&](Integer i) {
+            CoherentPointDriftT<Scalar> cpd(sources[i], type, update_scale, sw_h);
+            results[i] = cpd.registration(targets[i], w, maxiter, tol);
+        });
+    return results;
+}
+
+#define INSTANTIATE_CPD(Scalar)                                                                \
+    template class probreg::CoherentPointDriftT<Scalar>;                                           \
+    template std::vector<CpdResultT<Scalar>> probreg::registerCpdBatch<Scalar>(                    \
+        const std::vector<MatrixT<Scalar>>&, const std::vector<MatrixT<Scalar>>&, CpdTransformationType, \
+        bool, Scalar, Integer, Scalar, Scalar);
+
+INSTANTIATE_CPD(float)
+INSTANTIATE_CPD(double)
@@ -0,0 +1,78 @@
+#ifndef __probreg_cpd_h__
+#define __probreg_cpd_h__
+
+#include <functional>
+#include <vector>
+#include "types.h"
+
+namespace probreg {
+
+enum CpdTransformationType { CPD_RIGID, CPD_AFFINE };
+
+template <typename Scalar>
+struct CpdResultT {
+    MatrixT<Scalar> rot_;  // rotation of the rigid transformation, matrix of the affine one.
+    VectorT<Scalar> t_;
+    Scalar scale_;
+    Scalar sigma2_;
+    Scalar q_;
+    // Values after each iteration.
+    std::vector<Scalar> q_history_;
+    std::vector<Scalar> sigma2_history_;
+};
+typedef CpdResultT<Float> CpdResult;
+
+// Rigid and affine Coherent Point Drift. The whole EM loop runs natively, the Gauss transforms of the E-step
+// are direct and exact if h < sw_h and use the IFGT otherwise, like gauss_transform.GaussTransform.
+// The arrays of the E-step and the transformed source are kept between the iterations and the registrations
+// of the same source. Instantiated for float and double.
+template <typename Scalar>
+class CoherentPointDriftT {
+   public:
+    // Called after each iteration with the current transformation.
+    typedef std::function<void(const CpdResultT<Scalar>&)> Callback;
+
+    CoherentPointDriftT(const MatrixCRefT<Scalar>& source,
+                        CpdTransformationType type,
+                        bool update_scale = true,
+                        Scalar sw_h = 0.3);
+    CpdResultT<Scalar> registration(const MatrixCRefT<Scalar>& target,
+                                    Scalar w = 0.0,
+                                    Integer maxiter = 50,
+                                    Scalar tol = 0.001,
+                                    const Callback& callback = Callback());
+
+   private:
+    void transformSource(const CpdResultT<Scalar>& res);
+    void expectationStep(const MatrixCRefT<Scalar>& target, Scalar sigma2, Scalar w);
+    void maximizationStep(const MatrixCRefT<Scalar>& target, CpdResultT<Scalar>& res) const;
+
+    const MatrixT<Scalar> source_;
+    const CpdTransformationType type_;
+    const bool update_scale_;
+    const Scalar sw_h_;
+    const MatrixT<Scalar> ones_;  // weights of the first Gauss transform.
+    // Workspace of the iterations.
+    MatrixT<Scalar> t_source_;
+    VectorT<Scalar> pt1_;
+    MatrixT<Scalar> weights_;  // N x (ndim + 1), a and a * target.
+    MatrixT<Scalar> p1_px_;    // M x (ndim + 1), p1 in the first column and px in the others.
+    Scalar n_p_;
+};
+typedef CoherentPointDriftT<Float> CoherentPointDrift;
+
+// Registers each source to the target of the same index, with the parameters of CoherentPointDriftT.
+// The pairs are run by runBatch, one thread per pair, the largest ones first.
+template <typename Scalar>
+std::vector<CpdResultT<Scalar>> registerCpdBatch(const std::vector<MatrixT<Scalar>>& sources,
+                                                 const std::vector<MatrixT<Scalar>>& targets,
+                                                 CpdTransformationType type,
+                                                 bool update_scale = true,
+                                                 Scalar w = 0.0,
+                                                 Integer maxiter = 50,
+                                                 Scalar tol = 0.001,
+                                                 Scalar sw_h = 0.3);
+
+}  // namespace probreg
+
+#endif
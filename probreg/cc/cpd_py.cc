@@ -0,0 +1,56 @@
+#include <pybind11/eigen.h>
+#include <pybind11/functional.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "cpd.h"
+
+namespace py = pybind11;
+using namespace probreg;
+
+template <typename Scalar>
+void defCpd(py::module& m, const std::string& suffix) {
+    typedef CpdResultT<Scalar> Result;
+    typedef CoherentPointDriftT<Scalar> Cpd;
+    py::class_<Result>(m, ("CpdResult" + suffix).c_str())
+        .def_readonly("rot", &Result::rot_)
+        .def_readonly("t", &Result::t_)
+        .def_readonly("scale", &Result::scale_)
+        .def_readonly("sigma2", &Result::sigma2_)
+        .def_readonly("q", &Result::q_)
+        .def_readonly("q_history", &Result::q_history_)
+        .def_readonly("sigma2_history", &Result::sigma2_history_);
+
+    // The GIL is released during the registration, the callback takes it back when it is called.
+    py::class_<Cpd>(m, ("CoherentPointDrift" + suffix).c_str())
+        .def(py::init<const MatrixCRefT<Scalar>&, CpdTransformationType, bool, Scalar>(),
+             py::arg("source"), py::arg("tf_type"), py::arg("update_scale") = true, py::arg("sw_h") = 0.3)
+        .def("registration", &Cpd::registration, py::arg("target"), py::arg("w") = 0.0,
+             py::arg("maxiter") = 50, py::arg("tol") = 0.001, py::arg("callback") = py::none(),
+             py::call_guard<py::gil_scoped_release>());
+
+    // Registers the pairs (sources[i], targets[i]) on the OpenMP threads,
+    // the GIL is released for the whole batch.
+    m.def(("register_many" + suffix).c_str(), &registerCpdBatch<Scalar>, py::arg("sources"),
+          py::arg("targets"), py::arg("tf_type"), py::arg("update_scale") = true, py::arg("w") = 0.0,
+          py::arg("maxiter") = 50, py::arg("tol") = 0.001, py::arg("sw_h") = 0.3,
+          py::call_guard<py::gil_scoped_release>());
+}
+
+PYBIND11_MODULE(_cpd, m) {
+    Eigen::initParallel();
+
+    py::enum_<CpdTransformationType>(m, "CpdTransformationType")
+        .value("RIGID", CPD_RIGID)
+        .value("AFFINE", CPD_AFFINE)
+        .export_values();
+
+    // float64 arrays are registered in double by the classes suffixed with 64, the others in float.
+    defCpd<float>(m, "");
+    defCpd<double>(m, "64");
+
+#ifdef VERSION_INFO
+    m.attr("__version__") = VERSION_INFO;
+#else
+    m.attr("__version__") = "dev";
+#endif
+}
@@ -0,0 +1,161 @@
+#include "direct_gauss_transform.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+using namespace probreg;
+
+namespace {
+
+static const Integer source_tile_size = 256;
+static const Integer target_tile_size = 64;
+static const Integer morton_bits = 10;
+// exp(-max_exponent) is below the float precision of any sum of weights and above the denormal range.
+static const double max_exponent = 80.0;
+
+// Morton code of the first three coordinates quantized to 2^morton_bits levels.
+template <typename Scalar>
+uint32_t mortonCode(const Scalar* x, Integer num_dims, const VectorT<Scalar>& origin, Scalar scale) {
+    uint32_t code = 0;
+    const Integer nd = std::min(num_dims, Integer(3));
+    const Scalar max_level = (1 << morton_bits) - 1;
+    for (Integer k = 0; k < nd; ++k) {
+        const uint32_t q = std::max(Scalar(0), std::min(max_level, std::floor((x[k] - origin[k]) * scale)));
+        for (Integer b = 0; b < morton_bits; ++b) {
+            code |= ((q >> b) & 1u) << (b * nd + k);
+        }
+    }
+    return code;
+}
+
+template <typename Scalar>
+VectorXi mortonOrder(const MatrixCRefT<Scalar>& points, const VectorT<Scalar>& origin, Scalar scale) {
+    std::vector<uint32_t> codes(points.rows());
+    const RowMatrixT<Scalar> rows = points;
+    for (Integer i = 0; i < points.rows(); ++i) {
+        codes[i] = mortonCode(rows.row(i).data(), points.cols(), origin, scale);
+    }
+    VectorXi order(points.rows());
+    std::iota(order.data(), order.data() + order.size(), 0);
+    std::stable_sort(order.data(), order.data() + order.size(),
+                     [&codes](Integer a, Integer b) { return codes[a] < codes[b]; });
+    return order;
+}
+
+template <typename Scalar>
+Scalar boxDistance2(const VectorT<Scalar>& amin,
+                    const VectorT<Scalar>& amax,
+                    const VectorT<Scalar>& bmin,
+                    const VectorT<Scalar>& bmax) {
+    const VectorT<Scalar> gap = (bmin - amax).cwiseMax(amin - bmax).cwiseMax(Scalar(0.0));
+    return gap.squaredNorm();
+}
+
+}  // namespace
+
+template <typename Scalar>
+DirectGaussTransformT<Scalar>::DirectGaussTransformT(const MatrixCRefT<Scalar>& source,
+                                                     Scalar h,
+                                                     Scalar cutoff_radius)
+    : h_(h), cutoff_radius_(cutoff_radius), origin_(VectorT<Scalar>::Zero(source.cols())), scale_(1.0) {
+    if (h_ <= 0.0) {
+        throw std::invalid_argument("Bandwidth must be positive.");
+    }
+    const Scalar max_radius = h_ * std::sqrt(max_exponent);
+    cutoff_radius_ = (cutoff_radius_ > 0.0) ? std::min(cutoff_radius_, max_radius) : max_radius;
+    if (source.rows() > 0) {
+        origin_ = source.colwise().minCoeff();
+        const Scalar range = (source.colwise().maxCoeff() - source.colwise().minCoeff()).maxCoeff();
+        scale_ = range > 0.0 ? Scalar(1 << morton_bits) / range : 1.0;
+    }
+    order_ = mortonOrder(source, origin_, scale_);
+    source_ = source(order_, Eigen::all);
+
+    const Integer n_tiles = (source_.rows() + source_tile_size - 1) / source_tile_size;
+    tile_min_.resize(source_.cols(), n_tiles);
+    tile_max_.resize(source_.cols(), n_tiles);
+    for (Integer t = 0; t < n_tiles; ++t) {
+        const Integer b = t * source_tile_size;
+        const Integer n = std::min(source_tile_size, Integer(source_.rows()) - b);
+        tile_min_.col(t) = source_.middleRows(b, n).colwise().minCoeff();
+        tile_max_.col(t) = source_.middleRows(b, n).colwise().maxCoeff();
+    }
+}
+
+template <typename Scalar>
+DirectGaussTransformT<Scalar>::~DirectGaussTransformT() {}
+
+template <typename Scalar>
+VectorT<Scalar> DirectGaussTransformT<Scalar>::compute(const MatrixCRefT<Scalar>& target,
+                                                       const VectorT<Scalar>& weights) const {
+    return compute(target, MatrixT<Scalar>(weights)).col(0);
+}
+
+template <typename Scalar>
+MatrixT<Scalar> DirectGaussTransformT<Scalar>::compute(const MatrixCRefT<Scalar>& target,
+                                                       const MatrixT<Scalar>& weights) const {
+    MatrixT<Scalar> gmat(target.rows(), weights.cols());
+    compute(target, weights, gmat);
+    return gmat;
+}
+
+template <typename Scalar>
+void DirectGaussTransformT<Scalar>::compute(const MatrixCRefT<Scalar>& target,
+                                            const MatrixT<Scalar>& weights,
+                                            MatrixRefT<Scalar> gmat) const {
+    if (weights.rows() != source_.rows()) {
+        throw std::invalid_argument("The number of weights does not match the source.");
+    }
+    if (target.cols() != source_.cols()) {
+        throw std::invalid_argument("The dimensions of the target and the source do not match.");
+    }
+    if (gmat.rows() != target.rows() || gmat.cols() != weights.cols()) {
+        throw std::invalid_argument("The size of the output does not match the target and the weights.");
+    }
+    const Integer num_dims = source_.cols();
+    const Scalar h2 = h_ * h_;
+    const Scalar c2 = cutoff_radius_ * cutoff_radius_;
+    const MatrixT<Scalar> sorted_weights = weights(order_, Eigen::all);
+    const VectorXi target_order = mortonOrder(target, origin_, scale_);
+    const MatrixT<Scalar> sorted_target = target(target_order, Eigen::all);
+    const Integer n_source_tiles = tile_min_.cols();
+    const Integer n_target_tiles = (target.rows() + target_tile_size - 1) / target_tile_size;
+
+    // Each target tile writes all its rows.
+    #pragma omp parallel
+    {
+        Eigen::Array<Scalar, Eigen::Dynamic, 1> distances(source_tile_size);
+        VectorT<Scalar> kernel(source_tile_size);
+        MatrixT<Scalar> gtile(target_tile_size, weights.cols());
+        #pragma omp for schedule(dynamic)
+        for (Integer tt = 0; tt < n_target_tiles; ++tt) {
+            const Integer tb = tt * target_tile_size;
+            const Integer nt = std::min(target_tile_size, Integer(target.rows()) - tb);
+            const VectorT<Scalar> tmin = sorted_target.middleRows(tb, nt).colwise().minCoeff();
+            const VectorT<Scalar> tmax = sorted_target.middleRows(tb, nt).colwise().maxCoeff();
+            gtile.setZero();
+            for (Integer st = 0; st < n_source_tiles; ++st) {
+                if (boxDistance2<Scalar>(tmin, tmax, tile_min_.col(st), tile_max_.col(st)) > c2) continue;
+                const Integer sb = st * source_tile_size;
+                const Integer ns = std::min(source_tile_size, Integer(source_.rows()) - sb);
+                for (Integer i = 0; i < nt; ++i) {
+                    auto d = distances.head(ns);
+                    d = (source_.col(0).segment(sb, ns).array() - sorted_target(tb + i, 0)).square();
+                    for (Integer k = 1; k < num_dims; ++k) {
+                        d += (source_.col(k).segment(sb, ns).array() - sorted_target(tb + i, k)).square();
+                    }
+                    auto kern = kernel.head(ns);
+                    kern.array() = (d > c2).select(Scalar(0.0), (-(d / h2).min(Scalar(max_exponent))).exp());
+                    gtile.row(i).noalias() += kern.transpose() * sorted_weights.middleRows(sb, ns);
+                }
+            }
+            for (Integer i = 0; i < nt; ++i) gmat.row(target_order[tb + i]) = gtile.row(i);
+        }
+    }
+}
+
+template class probreg::DirectGaussTransformT<float>;
+template class probreg::DirectGaussTransformT<double>;
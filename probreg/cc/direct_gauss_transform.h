@@ -0,0 +1,40 @@
+#ifndef __probreg_direct_gauss_transform_h__
+#define __probreg_direct_gauss_transform_h__
+
+#include "types.h"
+
+namespace probreg {
+
+// Exact Gauss transform evaluated over tiles of sources and targets, so that the memory
+// does not grow with the product of their sizes.
+// Pairs farther apart than the cutoff radius are ignored and tiles whose bounding boxes are farther apart
+// are skipped; points are sorted along a Morton curve to keep the tiles compact. The radius is always
+// capped where the kernel falls below float precision, so a cutoff of 0 still gives the exact transform.
+template <typename Scalar>
+class DirectGaussTransformT {
+   public:
+    DirectGaussTransformT(const MatrixCRefT<Scalar>& source, Scalar h, Scalar cutoff_radius = 0.0);
+    ~DirectGaussTransformT();
+    VectorT<Scalar> compute(const MatrixCRefT<Scalar>& target, const VectorT<Scalar>& weights) const;
+    // Evaluates the k columns of weights (M x k) together, returns N x k.
+    MatrixT<Scalar> compute(const MatrixCRefT<Scalar>& target, const MatrixT<Scalar>& weights) const;
+    // Same, writes the N x k result into gmat.
+    void compute(const MatrixCRefT<Scalar>& target,
+                 const MatrixT<Scalar>& weights,
+                 MatrixRefT<Scalar> gmat) const;
+
+   private:
+    const Scalar h_;
+    Scalar cutoff_radius_;
+    VectorXi order_;  // source indices in the order of source_.
+    MatrixT<Scalar> source_;
+    VectorT<Scalar> origin_;
+    Scalar scale_;
+    MatrixT<Scalar> tile_min_;
+    MatrixT<Scalar> tile_max_;
+};
+typedef DirectGaussTransformT<Float> DirectGaussTransform;
+
+}  // namespace probreg
+
+#endif
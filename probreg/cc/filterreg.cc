@@ -0,0 +1,313 @@
+#define _USE_MATH_DEFINES
+#include "filterreg.h"
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "batch.h"
+#include "kabsch.h"
+#include "math_utils.h"
+#include "permutohedral.h"
+#include "point_to_plane.h"
+
+using namespace probreg;
+
+namespace {
+
+void checkShapes(Integer ndim, const MatrixCRef& target, const MatrixCRef& target_normals) {
+    if (target.cols() != ndim) {
+        throw std::invalid_argument("The dimensions of the source and the target do not match.");
+    }
+    if (target_normals.size() > 0 &&
+        (target_normals.rows() != target.rows() || target_normals.cols() != ndim)) {
+        throw std::invalid_argument("The shape of the target normals does not match the target.");
+    }
+}
+
+// Channels (1, target, |target|^2, normals) / dem of the target points, placed after the m source points.
+// The source points only receive the filtered values. values keeps its memory if the shape does not change.
+void targetValues(Integer m,
+                  const MatrixCRef& target,
+                  Float sigma2,
+                  bool compute_m2,
+                  const MatrixCRef& target_normals,
+                  Eigen::MatrixXf& values) {
+    const Integer n = target.rows();
+    const Integer ndim = target.cols();
+    const bool with_normals = target_normals.size() > 0;
+    const Float dem = std::pow(2.0 * M_PI * sigma2, ndim * 0.5);
+    const Integer c_m1 = 1;
+    const Integer c_m2 = c_m1 + ndim;
+    const Integer c_nx = c_m2 + (compute_m2 ? 1 : 0);
+    const Integer n_channels = c_nx + (with_normals ? ndim : 0);
+    values.resize(n_channels, m + n);
+    values.leftCols(m).setZero();
+    values.block(0, m, 1, n).setConstant(1.0 / dem);
+    values.block(c_m1, m, ndim, n) = (target.transpose() / dem).cast<float>();
+    if (compute_m2) {
+        values.block(c_m2, m, 1, n) = (target.rowwise().squaredNorm().transpose() / dem).cast<float>();
+    }
+    if (with_normals) {
+        values.block(c_nx, m, ndim, n) = (target_normals.transpose() / dem).cast<float>();
+    }
+}
+
+// Filters the values and slices the moments of the m source points in res, through the buffer out.
+void sliceResult(const Permutohedral& ph,
+                 const Eigen::MatrixXf& values,
+                 Integer m,
+                 Integer ndim,
+                 bool compute_m2,
+                 bool with_normals,
+                 Eigen::MatrixXf& out,
+                 FilterRegEstepResult& res) {
+    ph.compute(out, values, false, m, m);
+    const Integer c_m1 = 1;
+    const Integer c_m2 = c_m1 + ndim;
+    const Integer c_nx = c_m2 + (compute_m2 ? 1 : 0);
+    res.m0_ = out.block(0, 0, 1, m).transpose().cast<Float>();
+    res.m1_ = out.block(c_m1, 0, ndim, m).transpose().cast<Float>();
+    if (compute_m2) res.m2_ = out.block(c_m2, 0, 1, m).transpose().cast<Float>();
+    if (with_normals) res.nx_ = out.block(c_nx, 0, ndim, m).transpose().cast<Float>();
+}
+
+FilterRegEstepResult sliceResult(const Permutohedral& ph,
+                                 const Eigen::MatrixXf& values,
+                                 Integer m,
+                                 Integer ndim,
+                                 bool compute_m2,
+                                 bool with_normals) {
+    Eigen::MatrixXf out;
+    FilterRegEstepResult res;
+    sliceResult(ph, values, m, ndim, compute_m2, with_normals, out, res);
+    return res;
+}
+
+}  // namespace
+
+FilterRegEstepResult probreg::computeFilterRegEstep(const MatrixCRef& source,
+                                                    const MatrixCRef& target,
+                                                    Float sigma2,
+                                                    Float alpha,
+                                                    bool compute_m2,
+                                                    const MatrixCRef& target_normals) {
+    const Integer m = source.rows();
+    const Integer n = target.rows();
+    const Integer ndim = source.cols();
+    checkShapes(ndim, target, target_normals);
+    const Float sigma = std::sqrt(sigma2);
+
+    Eigen::MatrixXf features(ndim, m + n);
+    features.leftCols(m) = (source.transpose() / sigma).cast<float>();
+    features.rightCols(n) = (target.transpose() / sigma).cast<float>();
+    Permutohedral ph;
+    ph.init(features, true);
+    if (ph.getLatticeSize() < n * alpha) ph.init(features, false);
+
+    Eigen::MatrixXf values;
+    targetValues(m, target, sigma2, compute_m2, target_normals, values);
+    return sliceResult(ph, values, m, ndim, compute_m2, target_normals.size() > 0);
+}
+
+FilterRegEstep::FilterRegEstep(const MatrixCRef& target,
+                               Integer num_source,
+                               Float sigma2,
+                               Float alpha,
+                               bool compute_m2,
+                               const MatrixCRef& target_normals)
+    : num_source_(num_source),
+      ndim_(target.cols()),
+      sigma_(std::sqrt(sigma2)),
+      alpha_(alpha),
+      compute_m2_(compute_m2),
+      with_normals_(target_normals.size() > 0),
+      target_features_((target.transpose() / sigma_).cast<float>()) {
+    checkShapes(ndim_, target, target_normals);
+    targetValues(num_source, target, sigma2, compute_m2, target_normals, values_);
+}
+
+FilterRegEstep::~FilterRegEstep() {}
+
+FilterRegEstepResult FilterRegEstep::compute(const MatrixCRef& source) {
+    if (source.rows() != num_source_) {
+        throw std::invalid_argument("The number of source points does not match the E-step.");
+    }
+    if (source.cols() != ndim_) {
+        throw std::invalid_argument("The dimensions of the source and the target do not match.");
+    }
+    const Eigen::MatrixXf source_features = (source.transpose() / sigma_).cast<float>();
+    if (!lattice_) {
+        // The blur is decided once, on the lattice of the first source like computeFilterRegEstep.
+        lattice_.reset(new Permutohedral());
+        lattice_->initFixed(target_features_, num_source_, true);
+        lattice_->updateMoving(source_features);
+        if (lattice_->getLatticeSize() < target_features_.cols() * alpha_) {
+            lattice_->initFixed(target_features_, num_source_, false);
+        } else {
+            return sliceResult(*lattice_, values_, num_source_, ndim_, compute_m2_, with_normals_);
+        }
+    }
+    lattice_->updateMoving(source_features);
+    return sliceResult(*lattice_, values_, num_source_, ndim_, compute_m2_, with_normals_);
+}
+
+FilterRegTracker::FilterRegTracker(const MatrixX3CRef& source,
+                                   Float sigma2,
+                                   Float alpha,
+                                   Float w,
+                                   bool point_to_plane,
+                                   Integer maxiter,
+                                   Float tol)
+    : source_(source),
+      init_sigma2_(sigma2),
+      alpha_(alpha),
+      w_(w),
+      point_to_plane_(point_to_plane),
+      update_sigma2_(sigma2 <= 0.0),
+      maxiter_(maxiter),
+      tol_(tol),
+      lattice_(new Permutohedral()) {
+    if (source_.rows() == 0) {
+        throw std::invalid_argument("The source is empty.");
+    }
+    if (w_ < 0.0 || w_ >= 1.0) {
+        throw std::invalid_argument("w must be in [0, 1).");
+    }
+    reset();
+}
+
+FilterRegTracker::~FilterRegTracker() {}
+
+void FilterRegTracker::reset() {
+    res_.rot_.setIdentity();
+    res_.t_.setZero();
+    res_.sigma2_ = init_sigma2_;
+    res_.q_ = 0.0;
+    res_.n_iter_ = 0;
+}
+
+void FilterRegTracker::expectationStep(const MatrixX3CRef& target,
+                                       const MatrixX3CRef& target_normals,
+                                       bool first_iteration) {
+    const Integer m = source_.rows();
+    const Integer n = target.rows();
+    const Float sigma = std::sqrt(res_.sigma2_);
+    if (update_sigma2_) {
+        // The features and the values change with sigma2, the whole lattice is built again.
+        features_.resize(3, m + n);
+        features_.leftCols(m) = (t_source_.transpose() / sigma).cast<float>();
+        features_.rightCols(n) = (target.transpose() / sigma).cast<float>();
+        lattice_->init(features_, true);
+        if (lattice_->getLatticeSize() < n * alpha_) lattice_->init(features_, false);
+        targetValues(m, target, res_.sigma2_, true, target_normals, values_);
+    } else {
+        source_features_ = (t_source_.transpose() / sigma).cast<float>();
+        if (first_iteration) {
+            // The blur is decided on the lattice of the first iteration like computeFilterRegEstep.
+            features_ = (target.transpose() / sigma).cast<float>();
+            targetValues(m, target, res_.sigma2_, false, target_normals, values_);
+            lattice_->initFixed(features_, m, true);
+            lattice_->updateMoving(source_features_);
+            if (lattice_->getLatticeSize() < n * alpha_) {
+                lattice_->initFixed(features_, m, false);
+                lattice_->updateMoving(source_features_);
+            }
+        } else {
+            lattice_->updateMoving(source_features_);
+        }
+    }
+    sliceResult(*lattice_, values_, m, 3, update_sigma2_, point_to_plane_, out_, estep_);
+}
+
+void FilterRegTracker::maximizationStep(Integer n_target) {
+    const Integer m = source_.rows();
+    const Float c = w_ / (1.0 - w_) * n_target / m;
+    Vector& m0 = estep_.m0_;
+    m0 = (m0.array() == 0.0).select(std::numeric_limits<Float>::epsilon(), m0);
+    m1m0_ = estep_.m1_.array().colwise() / m0.array();
+    drxdx_ = (m0.array() / (m0.array() + c) / res_.sigma2_).sqrt();
+    Matrix3 dr;
+    Vector3 dt;
+    if (point_to_plane_) {
+        nxm0_ = estep_.nx_.array().colwise() / m0.array();
+        const Pt2PlResult tw = computeTwistForPointToPlane<Float>(t_source_, m1m0_, nxm0_, drxdx_);
+        const Vector3 w = tw.first.head<3>();
+        const Float angle = w.norm();
+        dr = angle == 0.0 ? Matrix3::Identity() : Matrix3(Eigen::AngleAxis<Float>(angle, w / angle));
+        dt = tw.first.tail<3>();
+        res_.q_ = tw.second;
+    } else {
+        const KabschResult rt = computeKabsch<Float>(t_source_, m1m0_, drxdx_);
+        dr = rt.first;
+        dt = rt.second;
+        res_.q_ = (drxdx_.array() * (t_source_ - m1m0_).rowwise().sum().array()).square().sum();
+    }
+    res_.rot_ = dr * res_.rot_;
+    res_.t_ = dr * res_.t_ + dt;
+    if (update_sigma2_) {
+        // Weighted mean of sum_j k_ij |t_source_i - target_j|^2 / (m0_i + c)
+        const auto m0c = m0.array() + c;
+        const Float sigma2 = ((m0.array() * t_source_.rowwise().squaredNorm().array() -
+                               2.0 * (t_source_.array() * estep_.m1_.array()).rowwise().sum() + estep_.m2_.array()) /
+                              m0c)
+                                 .sum() /
+                             (3.0 * (m0.array() / m0c).sum());
+        res_.sigma2_ = std::max(sigma2, std::numeric_limits<Float>::epsilon());
+    }
+}
+
+const FilterRegTrackerResult& FilterRegTracker::track(const MatrixX3CRef& target,
+                                                       const MatrixX3CRef& target_normals) {
+    if (target.rows() == 0) {
+        throw std::invalid_argument("The target is empty.");
+    }
+    if (point_to_plane_ && target_normals.rows() != target.rows()) {
+        throw std::invalid_argument("The point-to-plane objective requires the normals of the target points.");
+    }
+    const MatrixX3 no_normals;
+    const MatrixX3CRef normals = point_to_plane_ ? target_normals : MatrixX3CRef(no_normals);
+    t_source_.noalias() = source_ * res_.rot_.transpose();
+    t_source_.rowwise() += res_.t_.transpose();
+    if (update_sigma2_) {
+        res_.sigma2_ = squaredKernelSum<Float>(t_source_, target) / (source_.rows() * 3 * target.rows());
+    }
+    Float q = 0.0;
+    for (Integer i = 0; i < maxiter_; ++i) {
+        expectationStep(target, normals, i == 0);
+        maximizationStep(target.rows());
+        res_.n_iter_ = i + 1;
+        t_source_.noalias() = source_ * res_.rot_.transpose();
+        t_source_.rowwise() += res_.t_.transpose();
+        if (i > 0 && std::abs(res_.q_ - q) < tol_) break;
+        q = res_.q_;
+    }
+    return res_;
+}
+
+std::vector<FilterRegTrackerResult> probreg::registerFilterRegBatch(
+    const std::vector<MatrixX3>& sources,
+    const std::vector<MatrixX3>& targets,
+    const std::vector<MatrixX3>& target_normals,
+    Float sigma2,
+    Float alpha,
+    Float w,
+    bool point_to_plane,
+    Integer maxiter,
+    Float tol) {
+    if (sources.size() != targets.size()) {
+        throw std::invalid_argument("The numbers of sources and targets do not match.");
+    }
+    if (!target_normals.empty() && target_normals.size() != targets.size()) {
+        throw std::invalid_argument("The numbers of targets and target normals do not match.");
+    }
+    const MatrixX3 no_normals;
+    std::vector<FilterRegTrackerResult> results(sources.size());
+    runBatch(
+        sources.size(), [&](Integer i) { return double(sources[i].rows() + targets[i].rows()); },
+        [&](Integer i) {
+            FilterRegTracker tracker(sources[i], sigma2, alpha, w, point_to_plane, maxiter, tol);
+            results[i] = tracker.track(targets[i], target_normals.empty() ? no_normals : target_normals[i]);
+        });
+    return results;
+}
@@ -0,0 +1,132 @@
+#ifndef __probreg_filterreg_h__
+#define __probreg_filterreg_h__
+
+#include <memory>
+#include <vector>
+#include "types.h"
+
+class Permutohedral;
+
+namespace probreg {
+
+// Moments of the target around each source point given by the FilterReg E-step.
+// m2_ is empty unless requested, nx_ is empty without target normals.
+struct FilterRegEstepResult {
+    Vector m0_;
+    Matrix m1_;
+    Vector m2_;
+    Matrix nx_;
+};
+
+// All channels (1, target, |target|^2, normals) are stacked and filtered in a single
+// splat/blur/slice pass over one permutohedral lattice built on the source and target features.
+FilterRegEstepResult computeFilterRegEstep(const MatrixCRef& source,
+                                           const MatrixCRef& target,
+                                           Float sigma2,
+                                           Float alpha,
+                                           bool compute_m2,
+                                           const MatrixCRef& target_normals = Matrix());
+
+// FilterReg E-step against a fixed target and bandwidth. The target part of the lattice is built once,
+// each call only embeds the moved source points, so sigma2 must stay the same across the iterations.
+class FilterRegEstep {
+   public:
+    FilterRegEstep(const MatrixCRef& target,
+                   Integer num_source,
+                   Float sigma2,
+                   Float alpha,
+                   bool compute_m2,
+                   const MatrixCRef& target_normals = Matrix());
+    ~FilterRegEstep();
+    FilterRegEstepResult compute(const MatrixCRef& source);
+    bool computeM2() const { return compute_m2_; }
+    bool withNormals() const { return with_normals_; }
+
+   private:
+    const Integer num_source_;
+    const Integer ndim_;
+    const Float sigma_;
+    const Float alpha_;
+    const bool compute_m2_;
+    const bool with_normals_;
+    Eigen::MatrixXf target_features_;
+    Eigen::MatrixXf values_;
+    std::unique_ptr<Permutohedral> lattice_;
+};
+
+struct FilterRegTrackerResult {
+    Matrix3 rot_;
+    Vector3 t_;
+    Float sigma2_;
+    Float q_;
+    Integer n_iter_;  // number of iterations of the last frame.
+};
+
+// Rigid FilterReg of a fixed source to the frames of a sequence. Each frame starts from the pose of the
+// previous one. The lattice, the moments of the E-step and the other buffers are kept between the
+// iterations and the frames, they are only reallocated when the number of target points grows.
+// With a fixed sigma2 the target part of the lattice is built once per frame. Otherwise sigma2 is estimated
+// at the start of each frame, since the sigma2 converged on the previous frame can be too small to reach the
+// new one, then it is updated in the M-step and the whole lattice is built at each iteration.
+class FilterRegTracker {
+   public:
+    // sigma2 <= 0 estimates sigma2 on each frame and updates it in the M-step.
+    // point_to_plane requires the target normals of each frame.
+    FilterRegTracker(const MatrixX3CRef& source,
+                     Float sigma2 = 0.0,
+                     Float alpha = 0.015,
+                     Float w = 0.0,
+                     bool point_to_plane = false,
+                     Integer maxiter = 50,
+                     Float tol = 0.001);
+    ~FilterRegTracker();
+    const FilterRegTrackerResult& track(const MatrixX3CRef& target,
+                                        const MatrixX3CRef& target_normals = MatrixX3());
+    // Restarts from the identity.
+    void reset();
+    const FilterRegTrackerResult& result() const { return res_; }
+
+   private:
+    void expectationStep(const MatrixX3CRef& target,
+                         const MatrixX3CRef& target_normals,
+                         bool first_iteration);
+    void maximizationStep(Integer n_target);
+
+    const MatrixX3 source_;
+    const Float init_sigma2_;
+    const Float alpha_;
+    const Float w_;
+    const bool point_to_plane_;
+    const bool update_sigma2_;
+    const Integer maxiter_;
+    const Float tol_;
+    FilterRegTrackerResult res_;
+    // Workspace of the iterations.
+    MatrixX3 t_source_;
+    MatrixX3 m1m0_;
+    MatrixX3 nxm0_;
+    Vector drxdx_;
+    Eigen::MatrixXf features_;
+    Eigen::MatrixXf source_features_;
+    Eigen::MatrixXf values_;
+    Eigen::MatrixXf out_;
+    FilterRegEstepResult estep_;
+    std::unique_ptr<Permutohedral> lattice_;
+};
+
+// Registers each source to the target of the same index from the identity, with the parameters of
+// FilterRegTracker. target_normals is empty or holds the normals of each target.
+// The pairs are run by runBatch, one thread per pair, the largest ones first.
+std::vector<FilterRegTrackerResult> registerFilterRegBatch(const std::vector<MatrixX3>& sources,
+                                                           const std::vector<MatrixX3>& targets,
+                                                           const std::vector<MatrixX3>& target_normals,
+                                                           Float sigma2 = 0.0,
+                                                           Float alpha = 0.015,
+                                                           Float w = 0.0,
+                                                           bool point_to_plane = false,
+                                                           Integer maxiter = 50,
+                                                           Float tol = 0.001);
+
+}  // namespace probreg
+
+#endif
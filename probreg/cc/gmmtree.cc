@@ -1,187 +1,514 @@
 #define _USE_MATH_DEFINES
 #include "gmmtree.h"
-#include <Eigen/Eigenvalues>
+#include "batch.h"
+#include "chunks.h"
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <stdexcept>
 
 using namespace probreg;
 
 namespace {
-static const Float eps = 1.0e-15;
-
-Float gaussianPdf(const Vector3& x, const Vector3& mu, const Matrix3& cov) {
-    const Vector3 d = x - mu;
-    const Float det = cov.determinant();
-    if (det < eps) return 0.0;
-    const Float c = 1.0 / (std::pow(det, 0.5) * std::pow(2.0 * M_PI, x.size() * 0.5));
-    const Float ep = -0.5 * d.transpose() * cov.inverse() * d;
-    return c * std::exp(ep);
-}
-
-Float logLikelihood(const NodeParamArray& nodes, const MatrixX3& points, Integer j0, Integer jn) {
-    Float q = 0.0;
-    for (Integer i = 0; i < points.rows(); ++i) {
-        Float tmp = 0.0;
-        for (Integer j = j0; j < jn; ++j) {
-            if (std::get<0>(nodes[j]) < eps) continue;
-            tmp += std::get<0>(nodes[j]) *
-                   gaussianPdf(points.row(i), std::get<1>(nodes[j]), std::get<2>(nodes[j]));
-        }
-        q += std::log(std::max(tmp, eps));
-    }
-    return q;
-}
+static const double eps = 1.0e-15;
+static const Integer max_em_iterations = 100;
 
-Float complexity(const Matrix3& cov) {
-    Eigen::SelfAdjointEigenSolver<Matrix3> es(cov);
+template <typename Scalar>
+using NodeBatch = Eigen::Array<Scalar, N_NODE, 1>;
+
+template <typename Scalar>
+Scalar complexity(const Matrix3T<Scalar>& cov) {
+    Eigen::SelfAdjointEigenSolver<Matrix3T<Scalar>> es(cov);
     auto lmds = es.eigenvalues();
-    std::sort(lmds.data(), lmds.data() + lmds.size(), std::greater<Float>());
+    std::sort(lmds.data(), lmds.data() + lmds.size(), std::greater<Scalar>());
     return lmds[2] / lmds.sum();
 }
 
+template <NodeCacheField F, typename Scalar>
+NodeBatch<Scalar> field(const Eigen::Ref<const NodeCacheT<Scalar>>& cache, Integer j0) {
+    return cache.col(F).template segment<N_NODE>(j0).array();
+}
+
+// Weighted densities of the 8 children starting at j0, evaluated as one batch.
+template <typename Scalar>
+NodeBatch<Scalar> weightedPdfBatch(const Eigen::Ref<const NodeCacheT<Scalar>>& cache,
+                                   Integer j0,
+                                   const Vector3T<Scalar>& x) {
+    const NodeBatch<Scalar> dx = x[0] - field<CACHE_MEAN_X>(cache, j0);
+    const NodeBatch<Scalar> dy = x[1] - field<CACHE_MEAN_Y>(cache, j0);
+    const NodeBatch<Scalar> dz = x[2] - field<CACHE_MEAN_Z>(cache, j0);
+    const NodeBatch<Scalar> y0 = field<CACHE_L00>(cache, j0) * dx;
+    const NodeBatch<Scalar> y1 = field<CACHE_L10>(cache, j0) * dx + field<CACHE_L11>(cache, j0) * dy;
+    const NodeBatch<Scalar> y2 = field<CACHE_L20>(cache, j0) * dx + field<CACHE_L21>(cache, j0) * dy +
+                                 field<CACHE_L22>(cache, j0) * dz;
+    return (field<CACHE_LOG_COEFF>(cache, j0) - Scalar(0.5) * (y0.square() + y1.square() + y2.square()))
+        .exp();
+}
+
+// Responsibilities of the 8 children starting at j0.
+template <typename Scalar>
+NodeBatch<Scalar> responsibilityBatch(const Eigen::Ref<const NodeCacheT<Scalar>>& cache,
+                                      Integer j0,
+                                      const Vector3T<Scalar>& x) {
+    NodeBatch<Scalar> gamma = weightedPdfBatch(cache, j0, x);
+    const Scalar den = gamma.sum();
+    if (den > eps) {
+        gamma /= den;
+    } else {
+        gamma.setZero();
+    }
+    return gamma;
+}
+
+template <typename Scalar>
+double logLikelihood(const Eigen::Ref<const NodeCacheT<Scalar>>& cache,
+                     const MatrixX3CRefT<Scalar>& points,
+                     const Integer* idxs,
+                     Integer n) {
+    const Integer n_chunks = numChunks(n);
+    Eigen::ArrayXd partials = Eigen::ArrayXd::Zero(n_chunks);
+    #pragma omp parallel for schedule(static)
+    for (Integer c = 0; c < n_chunks; ++c) {
+        const Integer ke = chunkBegin(c + 1, n_chunks, n);
+        for (Integer k = chunkBegin(c, n_chunks, n); k < ke; ++k) {
+            const Vector3T<Scalar> x = points.row(idxs[k]);
+            partials[c] += std::log(std::max(weightedPdfBatch(cache, 0, x).sum(), Scalar(eps)));
+        }
+    }
+    return partials.sum();
+}
+
 Integer child(Integer j) { return (j + 1) * N_NODE; }
 
 Integer level(Integer l) { return N_NODE * (std::pow(N_NODE, l) - 1) / (N_NODE - 1); }
 
-void accumulate(NodeParam& moments, Float gamma, const Vector& z) {
+// Moments of the nodes accumulated in the E-step, one column per node:
+// sum of gamma, sum of gamma * x (3) and the upper triangle of sum of gamma * x * x^T (6).
+template <typename Accum>
+using MomentBuffer = Eigen::Matrix<Accum, 10, Eigen::Dynamic>;
+
+// The terms are computed in the scalar type of the points and summed in Accum.
+template <typename Accum, typename Scalar>
+void accumulate(MomentBuffer<Accum>& moments, Integer j, Scalar gamma, const Vector3T<Scalar>& z) {
     if (gamma < eps) return;
-    std::get<0>(moments) += gamma;
-    std::get<1>(moments) += gamma * z;
-    std::get<2>(moments) += gamma * z * z.transpose();
-}
-
-NodeParam mlEstimator(const NodeParam& moments, Integer n_points, Float lambda_d) {
-    NodeParam node;
-    std::get<0>(node) = std::get<0>(moments) / n_points;
-    if (std::get<0>(moments) < lambda_d) {
-        std::get<0>(node) = 0;
-        std::get<1>(node).fill(0.0);
-        std::get<2>(node) = Matrix3::Identity();
+    Eigen::Matrix<Scalar, 10, 1> m;
+    m << 1.0, z[0], z[1], z[2], z[0] * z[0], z[0] * z[1], z[0] * z[2], z[1] * z[1], z[1] * z[2], z[2] * z[2];
+    moments.col(j) += (gamma * m).template cast<Accum>();
+}
+
+template <typename Accum>
+MomentBuffer<Accum> reduceMoments(const std::vector<MomentBuffer<Accum>>& partials) {
+    MomentBuffer<Accum> moments = partials[0];
+    for (size_t c = 1; c < partials.size(); ++c) moments += partials[c];
+    return moments;
+}
+
+template <typename Accum>
+GmmTreeNodesT<Accum> toNodes(const MomentBuffer<Accum>& moments) {
+    GmmTreeNodesT<Accum> res(moments.cols());
+    res.weights_ = moments.row(0).transpose();
+    res.means_ = moments.template middleRows<3>(1).transpose();
+    for (Integer j = 0; j < moments.cols(); ++j) {
+        Matrix3T<Accum> m2;
+        m2 << moments(4, j), moments(5, j), moments(6, j), moments(5, j), moments(7, j), moments(8, j),
+            moments(6, j), moments(8, j), moments(9, j);
+        res.setCov(j, m2);
+    }
+    return res;
+}
+
+// Maximum likelihood estimate of the node j from its moments, computed in Accum.
+template <typename Scalar, typename Accum>
+void mlEstimator(const MomentBuffer<Accum>& moments,
+                 Integer jm,
+                 Integer n_points,
+                 Scalar lambda_d,
+                 GmmTreeNodesT<Scalar>& nodes,
+                 Integer j) {
+    const Accum m0 = moments(0, jm);
+    nodes.weights_[j] = m0 / n_points;
+    if (m0 < lambda_d) {
+        nodes.weights_[j] = 0;
+        nodes.means_.row(j).fill(0.0);
+        nodes.setCov(j, Matrix3T<Scalar>::Identity());
     } else {
-        std::get<1>(node) = std::get<1>(moments) / std::get<0>(moments);
-        std::get<2>(node) =
-            std::get<2>(moments) / std::get<0>(moments) - std::get<1>(node) * std::get<1>(node).transpose();
+        const Vector3T<Accum> mu = moments.template block<3, 1>(1, jm) / m0;
+        Matrix3T<Accum> m2;
+        m2 << moments(4, jm), moments(5, jm), moments(6, jm), moments(5, jm), moments(7, jm), moments(8, jm),
+            moments(6, jm), moments(8, jm), moments(9, jm);
+        nodes.means_.row(j) = mu.template cast<Scalar>();
+        nodes.setCov(j, (m2 / m0 - mu * mu.transpose()).template cast<Scalar>());
+    }
+}
+
+// Initial variance of the nodes, i.e. the mean pairwise squared distance of the points per dimension
+// divided by the number of children. sum_{i,j} |x_i - x_j|^2 = 2 N sum_i |x_i - mean|^2, so this is O(N).
+template <typename Scalar>
+Scalar initialVariance(const MatrixX3CRefT<Scalar>& points) {
+    const Integer n = points.rows();
+    const Eigen::Matrix<double, 1, 3> mean = points.template cast<double>().colwise().mean();
+    const double ss = (points.template cast<double>().rowwise() - mean).squaredNorm();
+    return 2.0 * ss / (double(n) * points.cols() * N_NODE);
+}
+
+// EM fitting of the 8 children starting at j0 to the points idxs[0, n) of their parent.
+// The EM stops when the sum of the log likelihoods of the points changes by less than lambda_s,
+// the criterion of a whole level restricted to the points of the parent.
+template <typename Scalar, typename Accum>
+void fitChildren(const MatrixX3CRefT<Scalar>& points,
+                 const Integer* idxs,
+                 Integer n,
+                 Integer j0,
+                 GmmTreeNodesT<Scalar>& nodes,
+                 Integer n_points,
+                 Scalar lambda_s,
+                 Scalar lambda_d,
+                 VectorXi& current_idx) {
+    const Integer n_chunks = numChunks(n);
+    double prev_q = 0.0;
+    for (Integer itr = 0; itr < max_em_iterations; ++itr) {
+        const NodeCacheT<Scalar> cache = computeNodeCache(nodes, j0, j0 + N_NODE);
+        std::vector<MomentBuffer<Accum>> partials(n_chunks, MomentBuffer<Accum>::Zero(10, N_NODE));
+        #pragma omp parallel for schedule(static)
+        for (Integer c = 0; c < n_chunks; ++c) {
+            const Integer ke = chunkBegin(c + 1, n_chunks, n);
+            for (Integer k = chunkBegin(c, n_chunks, n); k < ke; ++k) {
+                const Vector3T<Scalar> x = points.row(idxs[k]);
+                const NodeBatch<Scalar> gamma = responsibilityBatch<Scalar>(cache, 0, x);
+                for (Integer j = 0; j < N_NODE; ++j) {
+                    accumulate(partials[c], j, gamma[j], x);
+                }
+                Integer max_j;
+                gamma.maxCoeff(&max_j);
+                current_idx[idxs[k]] = j0 + max_j;
+            }
+        }
+        const MomentBuffer<Accum> moments = reduceMoments(partials);
+        for (Integer j = 0; j < N_NODE; ++j) {
+            mlEstimator(moments, j, n_points, lambda_d, nodes, j0 + j);
+        }
+        const double q = logLikelihood<Scalar>(computeNodeCache(nodes, j0, j0 + N_NODE), points, idxs, n);
+        if (std::abs(q - prev_q) < lambda_s) {
+            break;
+        }
+        prev_q = q;
     }
-    return node;
 }
 
 }  // namespace
 
-NodeParamArray probreg::buildGmmTree(const MatrixX3& points,
-                                     Integer max_tree_level,
-                                     Float lambda_s,
-                                     Float lambda_d) {
-    const Integer n_total = N_NODE * (1 - std::pow(N_NODE, max_tree_level)) / (1 - N_NODE);
-    NodeParamArray nodes(n_total);
-    auto idxs = (n_total * Vector::Random(n_total)).array().abs().cast<Integer>();
-    Float sig2 = 0.0;
-    for (Integer i = 0; i < points.rows(); ++i) {
-        sig2 += (points.rowwise() - points.row(i)).rowwise().squaredNorm().sum();
+template <typename Scalar>
+NodeCacheT<Scalar> probreg::computeNodeCache(const GmmTreeNodesT<Scalar>& nodes, Integer jb, Integer je) {
+    const Scalar log_2pi = std::log(2.0 * M_PI);
+    NodeCacheT<Scalar> cache = NodeCacheT<Scalar>::Zero(je - jb, N_CACHE_FIELDS);
+    cache.col(CACHE_LOG_COEFF).fill(-std::numeric_limits<Scalar>::infinity());
+    for (Integer j = 0; j < je - jb; ++j) {
+        const Scalar w = nodes.weights_[jb + j];
+        const Vector3T<Scalar> mu = nodes.means_.row(jb + j);
+        const Matrix3T<Scalar> cov = nodes.cov(jb + j);
+        cache(j, CACHE_MEAN_X) = mu[0];
+        cache(j, CACHE_MEAN_Y) = mu[1];
+        cache(j, CACHE_MEAN_Z) = mu[2];
+        cache(j, CACHE_COMPLEXITY) = complexity(cov);
+        if (w < eps || cov.determinant() < eps) continue;
+        Eigen::LLT<Matrix3T<Scalar>> llt(cov);
+        if (llt.info() != Eigen::Success) continue;
+        const Matrix3T<Scalar> linv = llt.matrixL().solve(Matrix3T<Scalar>::Identity());
+        cache(j, CACHE_L00) = linv(0, 0);
+        cache(j, CACHE_L10) = linv(1, 0);
+        cache(j, CACHE_L11) = linv(1, 1);
+        cache(j, CACHE_L20) = linv(2, 0);
+        cache(j, CACHE_L21) = linv(2, 1);
+        cache(j, CACHE_L22) = linv(2, 2);
+        const Scalar log_det = 2.0 * llt.matrixLLT().diagonal().array().log().sum();
+        cache(j, CACHE_LOG_COEFF) = std::log(w) - 0.5 * (log_det + 3.0 * log_2pi);
     }
-    sig2 /= points.rows() * points.rows() * points.cols() * N_NODE;
+    return cache;
+}
+
+template <typename Scalar, typename Accum>
+GmmTreeNodesT<Scalar> probreg::buildGmmTree(const MatrixX3CRefT<Scalar>& points,
+                                            Integer max_tree_level,
+                                            Scalar lambda_s,
+                                            Scalar lambda_d,
+                                            unsigned int seed) {
+    const Integer n_total = N_NODE * (1 - std::pow(N_NODE, max_tree_level)) / (1 - N_NODE);
+    const Integer n_points = points.rows();
+    GmmTreeNodesT<Scalar> nodes(n_total);
+    std::mt19937 engine(seed);
+    std::uniform_int_distribution<Integer> dist(0, n_points - 1);
+    const Scalar sig2 = initialVariance(points);
     for (Integer j = 0; j < n_total; ++j) {
-        std::get<0>(nodes[j]) = 1.0 / N_NODE;
-        std::get<1>(nodes[j]) = points.row(idxs[j]);
-        std::get<2>(nodes[j]) = Matrix3::Identity() * sig2;
+        nodes.weights_[j] = 1.0 / N_NODE;
+        nodes.means_.row(j) = points.row(dist(engine));
+        nodes.setCov(j, Matrix3T<Scalar>::Identity() * sig2);
     }
-    VectorXi parent_idx = -VectorXi::Ones(points.rows());
-    VectorXi current_idx = VectorXi::Zero(points.rows());
+    VectorXi parent_idx = -VectorXi::Ones(n_points);
+    VectorXi current_idx = VectorXi::Zero(n_points);
+    std::vector<Integer> order(n_points);
 
     for (Integer l = 0; l < max_tree_level; ++l) {
-        Float prev_q = 0.0;
-        while (true) {
-            const NodeParamArray params =
-                gmmTreeEstep(points, nodes, parent_idx, current_idx, max_tree_level);
-            gmmTreeMstep(params, l, nodes, points.rows(), lambda_d);
-            const Float q = logLikelihood(nodes, points, level(l), level(l + 1));
-            if (std::abs(q - prev_q) < lambda_s) {
-                break;
-            }
-            prev_q = q;
+        // Once the parent level has converged the subtrees are independent,
+        // so the points are grouped by parent and the children of each parent are fitted separately.
+        const Integer pb = (l == 0) ? -1 : level(l - 1);
+        const Integer n_parents = (l == 0) ? 1 : level(l) - level(l - 1);
+        std::vector<Integer> offsets(n_parents + 1, 0);
+        for (Integer i = 0; i < n_points; ++i) ++offsets[parent_idx[i] - pb + 1];
+        for (Integer p = 0; p < n_parents; ++p) offsets[p + 1] += offsets[p];
+        std::vector<Integer> heads(offsets.begin(), offsets.end() - 1);
+        for (Integer i = 0; i < n_points; ++i) order[heads[parent_idx[i] - pb]++] = i;
+
+        #pragma omp parallel for schedule(dynamic) if (n_parents > 1)
+        for (Integer p = 0; p < n_parents; ++p) {
+            fitChildren<Scalar, Accum>(points, order.data() + offsets[p], offsets[p + 1] - offsets[p],
+                                       child(pb + p), nodes, n_points, lambda_s, lambda_d, current_idx);
         }
         parent_idx = current_idx;
     }
     return nodes;
 }
 
-NodeParamArray probreg::gmmTreeEstep(const MatrixX3& points,
-                                     const NodeParamArray& nodes,
-                                     const VectorXi& parent_idx,
-                                     VectorXi& current_idx,
-                                     Integer max_tree_level) {
+template <typename Scalar, typename Accum>
+GmmTreeNodesT<Accum> probreg::gmmTreeEstep(const MatrixX3CRefT<Scalar>& points,
+                                           const GmmTreeNodesT<Scalar>& nodes,
+                                           const VectorXi& parent_idx,
+                                           VectorXi& current_idx,
+                                           Integer max_tree_level) {
     const Integer n_total = N_NODE * (1 - std::pow(N_NODE, max_tree_level)) / (1 - N_NODE);
-    NodeParamArray moments(n_total);
-    for (Integer j = 0; j < n_total; ++j) {
-        std::get<0>(moments[j]) = 0.0;
-        std::get<1>(moments[j]).fill(0.0);
-        std::get<2>(moments[j]).fill(0.0);
-    }
+    const NodeCacheT<Scalar> cache = computeNodeCache(nodes, 0, nodes.size());
+    const Integer n_chunks = numChunks(points.rows());
+    std::vector<MomentBuffer<Accum>> partials(n_chunks);
 
-    for (Integer i = 0; i < points.rows(); ++i) {
-        const Integer j0 = child(parent_idx[i]);
-        Vector gamma = Vector::Zero(N_NODE);
-        for (Integer j = j0; j < j0 + N_NODE; ++j) {
-            gamma[j - j0] = std::get<0>(nodes[j]) *
-                            gaussianPdf(points.row(i), std::get<1>(nodes[j]), std::get<2>(nodes[j]));
-        }
-        const Float den = gamma.sum();
-        if (den > eps) {
-            gamma /= den;
-        }
-        else {
-            gamma.fill(0.0);
-        }
-        for (Integer j = j0; j < j0 + N_NODE; ++j) {
-            accumulate(moments[j], gamma[j - j0], points.row(i));
+    #pragma omp parallel for schedule(static)
+    for (Integer c = 0; c < n_chunks; ++c) {
+        MomentBuffer<Accum>& moments = partials[c];
+        moments.setZero(10, n_total);
+        const Integer ie = chunkBegin(c + 1, n_chunks, points.rows());
+        for (Integer i = chunkBegin(c, n_chunks, points.rows()); i < ie; ++i) {
+            const Vector3T<Scalar> x = points.row(i);
+            const Integer j0 = child(parent_idx[i]);
+            const NodeBatch<Scalar> gamma = responsibilityBatch<Scalar>(cache, j0, x);
+            for (Integer j = 0; j < N_NODE; ++j) {
+                accumulate(moments, j0 + j, gamma[j], x);
+            }
+            Integer max_j;
+            gamma.maxCoeff(&max_j);
+            current_idx[i] = j0 + max_j;
         }
-        Integer max_j;
-        gamma.maxCoeff(&max_j);
-        current_idx[i] = j0 + max_j;
     }
-    return moments;
+    return toNodes(reduceMoments(partials));
 }
 
-void probreg::gmmTreeMstep(
-    const NodeParamArray& params, Integer l, NodeParamArray& nodes, Integer n_points, Float lambda_d) {
+template <typename Scalar, typename Accum>
+void probreg::gmmTreeMstep(const GmmTreeNodesT<Accum>& moments,
+                           Integer l,
+                           GmmTreeNodesT<Scalar>& nodes,
+                           Integer n_points,
+                           Scalar lambda_d) {
     const Integer lb = level(l);
     const Integer le = level(l + 1);
 
+    MomentBuffer<Accum> buf(10, le - lb);
     for (Integer j = lb; j < le; ++j) {
-        nodes[j] = mlEstimator(params[j], n_points, lambda_d);
+        const Matrix3T<Accum> m2 = moments.cov(j);
+        buf.col(j - lb) << moments.weights_[j], moments.means_.row(j).transpose(), m2(0, 0), m2(0, 1),
+            m2(0, 2), m2(1, 1), m2(1, 2), m2(2, 2);
+    }
+    for (Integer j = lb; j < le; ++j) {
+        mlEstimator(buf, j - lb, n_points, lambda_d, nodes, j);
     }
 }
 
-NodeParamArray probreg::gmmTreeRegEstep(const MatrixX3& points,
-                                        const NodeParamArray& nodes,
-                                        Integer max_tree_level,
-                                        Float lambda_c) {
+template <typename Scalar, typename Accum>
+GmmTreeNodesT<Accum> probreg::gmmTreeRegEstep(const MatrixX3CRefT<Scalar>& points,
+                                              const GmmTreeNodesT<Scalar>& nodes,
+                                              Integer max_tree_level,
+                                              Scalar lambda_c) {
+    return gmmTreeRegEstep<Scalar, Accum>(points, computeNodeCache(nodes, 0, nodes.size()), max_tree_level,
+                                          lambda_c);
+}
+
+template <typename Scalar, typename Accum>
+GmmTreeNodesT<Accum> probreg::gmmTreeRegEstep(const MatrixX3CRefT<Scalar>& points,
+                                              const Eigen::Ref<const NodeCacheT<Scalar>>& cache,
+                                              Integer max_tree_level,
+                                              Scalar lambda_c) {
     const Integer n_total = N_NODE * (1 - std::pow(N_NODE, max_tree_level)) / (1 - N_NODE);
-    NodeParamArray moments(n_total);
-    for (Integer j = 0; j < n_total; ++j) {
-        std::get<0>(moments[j]) = 0.0;
-        std::get<1>(moments[j]).fill(0.0);
-        std::get<2>(moments[j]).fill(0.0);
-    }
-
-    for (Integer i = 0; i < points.rows(); ++i) {
-        Integer search_id = -1;
-        Vector gamma = Vector::Zero(N_NODE);
-        for (Integer l = 0; l < max_tree_level; ++l) {
-            const Integer j0 = child(search_id);
-            for (Integer j = j0; j < j0 + N_NODE; ++j) {
-                gamma[j - j0] = std::get<0>(nodes[j]) *
-                                gaussianPdf(points.row(i), std::get<1>(nodes[j]), std::get<2>(nodes[j]));
-            }
-            const Float den = gamma.sum();
-            if (den > eps) {
-                gamma /= den;
-            } else {
-                gamma.fill(0.0);
+    if (cache.rows() < n_total) {
+        throw std::invalid_argument("The number of nodes does not match max_tree_level.");
+    }
+    const Integer n_chunks = numChunks(points.rows());
+    std::vector<MomentBuffer<Accum>> partials(n_chunks);
+
+    #pragma omp parallel for schedule(static)
+    for (Integer c = 0; c < n_chunks; ++c) {
+        MomentBuffer<Accum>& moments = partials[c];
+        moments.setZero(10, n_total);
+        const Integer ie = chunkBegin(c + 1, n_chunks, points.rows());
+        for (Integer i = chunkBegin(c, n_chunks, points.rows()); i < ie; ++i) {
+            const Vector3T<Scalar> x = points.row(i);
+            Integer search_id = -1;
+            for (Integer l = 0; l < max_tree_level; ++l) {
+                const Integer j0 = child(search_id);
+                const NodeBatch<Scalar> gamma = responsibilityBatch<Scalar>(cache, j0, x);
+                gamma.maxCoeff(&search_id);
+                search_id += j0;
+                if (cache(search_id, CACHE_COMPLEXITY) <= lambda_c) break;
+                accumulate(moments, search_id, gamma[search_id - j0], x);
             }
-            gamma.maxCoeff(&search_id);
-            search_id += j0;
-            if (complexity(std::get<2>(nodes[search_id])) <= lambda_c) break;
-            accumulate(moments[search_id], gamma[search_id - j0], points.row(i));
         }
     }
-    return moments;
+    return toNodes(reduceMoments(partials));
 }
+
+template <typename Scalar, typename Accum>
+GmmTreeMstepResultT<Scalar> probreg::gmmTreeRegMstep(const GmmTreeNodesT<Accum>& moments,
+                                                     const GmmTreeNodesT<Scalar>& nodes) {
+    return gmmTreeRegMstep<Scalar, Accum>(moments, computeNodeCache(nodes, 0, nodes.size()));
+}
+
+template <typename Scalar, typename Accum>
+GmmTreeMstepResultT<Scalar> probreg::gmmTreeRegMstep(const GmmTreeNodesT<Accum>& moments,
+                                                     const Eigen::Ref<const NodeCacheT<Scalar>>& cache) {
+    // Each node contributes three rows u_k^T (mu - (s + w x s + t)), where u_k are the rows of
+    // sqrt(m0) * L^-1, L the Cholesky factor of the node covariance and s the mean of the assigned points.
+    // Any whitening with the same u^T u gives the same normal equations as the eigen decomposition.
+    typedef Matrix3T<Accum> Matrix3A;
+    typedef Vector3T<Accum> Vector3A;
+    typedef Vector6T<Accum> Vector6A;
+    static const Accum min_weight = std::numeric_limits<float>::epsilon();
+    Matrix6T<Accum> ata = Matrix6T<Accum>::Zero();
+    Vector6A atb = Vector6A::Zero();
+    std::vector<Integer> used;
+    for (Integer j = 0; j < moments.size(); ++j) {
+        const Accum m0 = moments.weights_[j];
+        if (m0 < min_weight || !std::isfinite(cache(j, CACHE_LOG_COEFF))) continue;
+        used.push_back(j);
+    }
+    auto whitening = [&cache, &moments](Integer j) {
+        Matrix3A u;
+        u << cache(j, CACHE_L00), 0.0, 0.0, cache(j, CACHE_L10), cache(j, CACHE_L11), 0.0,
+            cache(j, CACHE_L20), cache(j, CACHE_L21), cache(j, CACHE_L22);
+        return Matrix3A(std::sqrt(moments.weights_[j]) * u);
+    };
+    auto mean = [&cache](Integer j) {
+        return Vector3A(cache(j, CACHE_MEAN_X), cache(j, CACHE_MEAN_Y), cache(j, CACHE_MEAN_Z));
+    };
+    for (const Integer j : used) {
+        const Matrix3A u = whitening(j);
+        const Vector3A s = moments.means_.row(j).transpose() / moments.weights_[j];
+        const Vector3A mu = mean(j);
+        for (Integer k = 0; k < 3; ++k) {
+            const Vector3A uk = u.row(k).transpose();
+            const Vector6A jac = (Vector6A() << s.cross(uk), uk).finished();
+            ata.noalias() += jac * jac.transpose();
+            atb.noalias() += uk.dot(mu - s) * jac;
+        }
+    }
+    const Vector6A x = ata.ldlt().solve(atb);
+    Accum q = 0.0;
+    for (const Integer j : used) {
+        const Matrix3A u = whitening(j);
+        const Vector3A s = moments.means_.row(j).transpose() / moments.weights_[j];
+        const Vector3A mu = mean(j);
+        for (Integer k = 0; k < 3; ++k) {
+            const Vector3A uk = u.row(k).transpose();
+            const Vector6A jac = (Vector6A() << s.cross(uk), uk).finished();
+            const Accum r = jac.dot(x) - uk.dot(mu - s);
+            q += r * r;
+        }
+    }
+    return std::make_pair(Vector6T<Scalar>(x.template cast<Scalar>()), Scalar(q));
+}
+
+template <typename Scalar, typename Accum>
+GmmTreeRegResultT<Scalar> probreg::gmmTreeRegistration(const MatrixX3CRefT<Scalar>& target,
+                                                       const GmmTreeNodesT<Scalar>& nodes,
+                                                       Integer max_tree_level,
+                                                       Scalar lambda_c,
+                                                       Integer maxiter,
+                                                       Scalar tol) {
+    const NodeCacheT<Scalar> cache = computeNodeCache(nodes, 0, nodes.size());
+    Matrix3T<Scalar> rot = Matrix3T<Scalar>::Identity();
+    Vector3T<Scalar> t = Vector3T<Scalar>::Zero();
+    MatrixX3T<Scalar> t_target(target.rows(), 3);
+    GmmTreeRegResultT<Scalar> res;
+    res.q_ = 0.0;
+    res.n_iter_ = 0;
+    for (Integer i = 0; i < maxiter; ++i) {
+        t_target.noalias() = target * rot.transpose();
+        t_target.rowwise() += t.transpose();
+        const GmmTreeMstepResultT<Scalar> tw = gmmTreeRegMstep<Scalar, Accum>(
+            gmmTreeRegEstep<Scalar, Accum>(t_target, cache, max_tree_level, lambda_c), cache);
+        const Vector3T<Scalar> w = tw.first.template head<3>();
+        const Scalar angle = w.norm();
+        Matrix3T<Scalar> dr = Matrix3T<Scalar>::Identity();
+        if (angle > 0.0) dr = Eigen::AngleAxis<Scalar>(angle, w / angle).toRotationMatrix();
+        rot = dr * rot;
+        t = dr * t + tw.first.template tail<3>();
+        const Scalar q = res.q_;
+        res.q_ = tw.second;
+        res.n_iter_ = i + 1;
+        if (i > 0 && std::abs(res.q_ - q) < tol) break;
+    }
+    res.rot_ = rot.transpose();
+    res.t_ = -(rot.transpose() * t);
+    return res;
+}
+
+template <typename Scalar, typename Accum>
+std::vector<GmmTreeRegResultT<Scalar>> probreg::registerGmmTreeBatch(
+    const std::vector<MatrixX3T<Scalar>>& sources,
+    const std::vector<MatrixX3T<Scalar>>& targets,
+    Integer max_tree_level,
+    Scalar lambda_s,
+    Scalar lambda_d,
+    Scalar lambda_c,
+    Integer maxiter,
+    Scalar tol) {
+    if (sources.size() != targets.size()) {
+        throw std::invalid_argument("The numbers of sources and targets do not match.");
+    }
+    std::vector<GmmTreeRegResultT<Scalar>> results(sources.size());
+    runBatch(
+        sources.size(), [&](Integer i) { return double(sources[i].rows() + targets[i].rows()); },
+        [&](Integer i) {
+            const GmmTreeNodesT<Scalar> nodes =
+                buildGmmTree<Scalar, Accum>(sources[i], max_tree_level, lambda_s, lambda_d);
+            results[i] =
+                gmmTreeRegistration<Scalar, Accum>(targets[i], nodes, max_tree_level, lambda_c, maxiter, tol);
+        });
+    return results;
+}
+
+template NodeCacheT<float> probreg::computeNodeCache(const GmmTreeNodesT<float>&, Integer, Integer);
+template NodeCacheT<double> probreg::computeNodeCache(const GmmTreeNodesT<double>&, Integer, Integer);
+
+#define INSTANTIATE_GMMTREE(Scalar, Accum)                                                                   \
+    template GmmTreeNodesT<Scalar> probreg::buildGmmTree<Scalar, Accum>(                                    \
+        const MatrixX3CRefT<Scalar>&, Integer, Scalar, Scalar, unsigned int);                               \
+    template GmmTreeNodesT<Accum> probreg::gmmTreeEstep<Scalar, Accum>(                                     \
+        const MatrixX3CRefT<Scalar>&, const GmmTreeNodesT<Scalar>&, const VectorXi&, VectorXi&, Integer);   \
+    template void probreg::gmmTreeMstep<Scalar, Accum>(                                                     \
+        const GmmTreeNodesT<Accum>&, Integer, GmmTreeNodesT<Scalar>&, Integer, Scalar);                     \
+    template GmmTreeNodesT<Accum> probreg::gmmTreeRegEstep<Scalar, Accum>(                                  \
+        const MatrixX3CRefT<Scalar>&, const GmmTreeNodesT<Scalar>&, Integer, Scalar);                       \
+    template GmmTreeNodesT<Accum> probreg::gmmTreeRegEstep<Scalar, Accum>(                                  \
+        const MatrixX3CRefT<Scalar>&, const Eigen::Ref<const NodeCacheT<Scalar>>&, Integer, Scalar);        \
+    template GmmTreeMstepResultT<Scalar> probreg::gmmTreeRegMstep<Scalar, Accum>(                           \
+        const GmmTreeNodesT<Accum>&, const GmmTreeNodesT<Scalar>&);                                         \
+    template GmmTreeMstepResultT<Scalar> probreg::gmmTreeRegMstep<Scalar, Accum>(                           \
+        const GmmTreeNodesT<Accum>&, const Eigen::Ref<const NodeCacheT<Scalar>>&);                          \
+    template GmmTreeRegResultT<Scalar> probreg::gmmTreeRegistration<Scalar, Accum>(                         \
+        const MatrixX3CRefT<Scalar>&, const GmmTreeNodesT<Scalar>&, Integer, Scalar, Integer, Scalar);      \
+    template std::vector<GmmTreeRegResultT<Scalar>> probreg::registerGmmTreeBatch<Scalar, Accum>(           \
+        const std::vector<MatrixX3T<Scalar>>&, const std::vector<MatrixX3T<Scalar>>&, Integer, Scalar,     \
+        Scalar, Scalar, Integer, Scalar);
+
+INSTANTIATE_GMMTREE(float, float)
+INSTANTIATE_GMMTREE(float, double)
+INSTANTIATE_GMMTREE(double, double)
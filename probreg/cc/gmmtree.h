@@ -1,30 +1,155 @@
 #ifndef __probreg_gmm_tree_h__
 #define __probreg_gmm_tree_h__
 
+#include <utility>
 #include <vector>
 #include "types.h"
 
 namespace probreg {
 
 static const Integer N_NODE = 8;
-typedef std::tuple<Float, Vector3, Matrix3> NodeParam;
-typedef std::vector<NodeParam, Eigen::aligned_allocator<NodeParam> > NodeParamArray;
 
-NodeParamArray buildGmmTree(const MatrixX3& points, Integer max_tree_level, Float lambda_s, Float lambda_d);
+// Parameters of the nodes of a GMM tree, stored as structure of arrays.
+// Nodes are in level order, so the 8 children of a parent are adjacent.
+// The E-step returns the same type holding the zeroth, first and second order moments of each node.
+template <typename Scalar>
+struct GmmTreeNodesT {
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 9> CovArray;
+    typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> CovStride;
 
-NodeParamArray gmmTreeEstep(const MatrixX3& points,
-                            const NodeParamArray& nodes,
-                            const VectorXi& parent_idx,
-                            VectorXi& current_idx,
-                            Integer max_tree_level);
+    GmmTreeNodesT() {}
+    explicit GmmTreeNodesT(Integer n)
+        : weights_(VectorT<Scalar>::Zero(n)),
+          means_(MatrixX3T<Scalar>::Zero(n, 3)),
+          covs_(CovArray::Zero(n, 9)) {}
+    Integer size() const { return weights_.size(); }
+    Matrix3T<Scalar> cov(Integer j) const {
+        return Eigen::Map<const Matrix3T<Scalar>, 0, CovStride>(covs_.data() + j,
+                                                                CovStride(3 * size(), size()));
+    }
+    void setCov(Integer j, const Matrix3T<Scalar>& cov) {
+        Eigen::Map<Matrix3T<Scalar>, 0, CovStride>(covs_.data() + j, CovStride(3 * size(), size())) = cov;
+    }
+    template <typename NewScalar>
+    GmmTreeNodesT<NewScalar> cast() const {
+        GmmTreeNodesT<NewScalar> res;
+        res.weights_ = weights_.template cast<NewScalar>();
+        res.means_ = means_.template cast<NewScalar>();
+        res.covs_ = covs_.template cast<NewScalar>();
+        return res;
+    }
 
-void gmmTreeMstep(
-    const NodeParamArray& params, Integer l, NodeParamArray& nodes, Integer n_points, Float lambda_d);
+    VectorT<Scalar> weights_;
+    MatrixX3T<Scalar> means_;
+    CovArray covs_;  // column c * 3 + r holds element (r, c) of the covariance.
+};
+typedef GmmTreeNodesT<Float> GmmTreeNodes;
 
-NodeParamArray gmmTreeRegEstep(const MatrixX3& points,
-                               const NodeParamArray& nodes,
-                               Integer max_tree_level,
-                               Float lambda_c);
+template <typename Scalar>
+using GmmTreeMstepResultT = std::pair<Vector6T<Scalar>, Scalar>;
+typedef GmmTreeMstepResultT<Float> GmmTreeMstepResult;
+
+// Precomputed per-node constants used in the E-step.
+// Each field is stored as a contiguous column (structure of arrays), nodes are in level order,
+// so the 8 children of a parent are adjacent. L** is the inverse of the Cholesky factor of the covariance,
+// LOG_COEFF is log(weight) - 0.5 * (log(det(cov)) + 3 * log(2 * pi)).
+enum NodeCacheField {
+    CACHE_MEAN_X = 0,
+    CACHE_MEAN_Y,
+    CACHE_MEAN_Z,
+    CACHE_L00,
+    CACHE_L10,
+    CACHE_L11,
+    CACHE_L20,
+    CACHE_L21,
+    CACHE_L22,
+    CACHE_LOG_COEFF,
+    CACHE_COMPLEXITY,
+    N_CACHE_FIELDS
+};
+template <typename Scalar>
+using NodeCacheT = Eigen::Matrix<Scalar, Eigen::Dynamic, N_CACHE_FIELDS>;
+typedef NodeCacheT<Float> NodeCache;
+
+template <typename Scalar>
+NodeCacheT<Scalar> computeNodeCache(const GmmTreeNodesT<Scalar>& nodes, Integer jb, Integer je);
+
+// The moments of the E-steps are summed in Accum and returned as such, double sums of float points
+// with Accum = double. The nodes are fitted to the moments in Accum.
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeNodesT<Scalar> buildGmmTree(const MatrixX3CRefT<Scalar>& points,
+                                   Integer max_tree_level,
+                                   Scalar lambda_s,
+                                   Scalar lambda_d,
+                                   unsigned int seed = 0);
+
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeNodesT<Accum> gmmTreeEstep(const MatrixX3CRefT<Scalar>& points,
+                                  const GmmTreeNodesT<Scalar>& nodes,
+                                  const VectorXi& parent_idx,
+                                  VectorXi& current_idx,
+                                  Integer max_tree_level);
+
+template <typename Scalar, typename Accum = Scalar>
+void gmmTreeMstep(const GmmTreeNodesT<Accum>& moments,
+                  Integer l,
+                  GmmTreeNodesT<Scalar>& nodes,
+                  Integer n_points,
+                  Scalar lambda_d);
+
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeNodesT<Accum> gmmTreeRegEstep(const MatrixX3CRefT<Scalar>& points,
+                                     const GmmTreeNodesT<Scalar>& nodes,
+                                     Integer max_tree_level,
+                                     Scalar lambda_c);
+
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeNodesT<Accum> gmmTreeRegEstep(const MatrixX3CRefT<Scalar>& points,
+                                     const Eigen::Ref<const NodeCacheT<Scalar>>& cache,
+                                     Integer max_tree_level,
+                                     Scalar lambda_c);
+
+// Linearized least squares of the registration M-step, solved in Accum.
+// Returns the twist that moves the moments of the target points onto the nodes and the residual.
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeMstepResultT<Scalar> gmmTreeRegMstep(const GmmTreeNodesT<Accum>& moments,
+                                            const GmmTreeNodesT<Scalar>& nodes);
+
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeMstepResultT<Scalar> gmmTreeRegMstep(const GmmTreeNodesT<Accum>& moments,
+                                            const Eigen::Ref<const NodeCacheT<Scalar>>& cache);
+
+template <typename Scalar>
+struct GmmTreeRegResultT {
+    Matrix3T<Scalar> rot_;
+    Vector3T<Scalar> t_;
+    Scalar q_;
+    Integer n_iter_;
+};
+typedef GmmTreeRegResultT<Float> GmmTreeRegResult;
+
+// Rigid registration of the tree to the target, the EM loop of gmmtree.GMMTree.registration.
+// The target is moved onto the tree, the result is the inverse transformation, from the source of the tree
+// to the target.
+template <typename Scalar, typename Accum = Scalar>
+GmmTreeRegResultT<Scalar> gmmTreeRegistration(const MatrixX3CRefT<Scalar>& target,
+                                              const GmmTreeNodesT<Scalar>& nodes,
+                                              Integer max_tree_level,
+                                              Scalar lambda_c,
+                                              Integer maxiter,
+                                              Scalar tol);
+
+// Builds the tree of each source and registers it to the target of the same index.
+// The pairs are run by runBatch, one thread per pair, the largest ones first.
+template <typename Scalar, typename Accum = Scalar>
+std::vector<GmmTreeRegResultT<Scalar>> registerGmmTreeBatch(const std::vector<MatrixX3T<Scalar>>& sources,
+                                                            const std::vector<MatrixX3T<Scalar>>& targets,
+                                                            Integer max_tree_level,
+                                                            Scalar lambda_s,
+                                                            Scalar lambda_d,
+                                                            Scalar lambda_c,
+                                                            Integer maxiter,
+                                                            Scalar tol);
 
 }  // namespace probreg
 
@@ -0,0 +1,165 @@
+#include "gmmtree_io.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace probreg;
+
+namespace {
+
+static const char magic[8] = {'P', 'R', 'G', 'M', 'M', 'T', 'R', 'E'};
+static const uint32_t byte_order_mark = 0x01020304;
+
+static_assert(sizeof(GmmTreeFileHeader) == 64, "GmmTreeFileHeader must be 64 bytes.");
+
+void checkHeader(const GmmTreeFileHeader& header, size_t file_size) {
+    if (std::memcmp(header.magic_, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error("Not a GMM tree file.");
+    }
+    if (header.version_ != GMMTREE_FORMAT_VERSION) {
+        throw std::runtime_error("Unsupported GMM tree file version.");
+    }
+    if (header.byte_order_ != byte_order_mark) {
+        throw std::runtime_error("GMM tree file has a different byte order.");
+    }
+    if (header.float_size_ != sizeof(Float)) {
+        throw std::runtime_error("GMM tree file has a different floating point precision.");
+    }
+    if (header.num_cache_fields_ != N_CACHE_FIELDS) {
+        throw std::runtime_error("GMM tree file has a different node cache layout.");
+    }
+    const Integer n_total = N_NODE * (1 - std::pow(N_NODE, header.max_tree_level_)) / (1 - N_NODE);
+    if (Integer(header.num_nodes_) != n_total) {
+        throw std::runtime_error("The number of nodes does not match the tree level.");
+    }
+    const size_t data_size = size_t(header.num_nodes_) * N_GMMTREE_FIELDS * sizeof(Float);
+    if (file_size < sizeof(GmmTreeFileHeader) + data_size) {
+        throw std::runtime_error("GMM tree file is truncated.");
+    }
+}
+
+}  // namespace
+
+void probreg::saveGmmTree(const std::string& filename, const GmmTreeNodes& nodes, Integer max_tree_level) {
+    const Integer n = nodes.size();
+    GmmTreeFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic_, magic, sizeof(magic));
+    header.version_ = GMMTREE_FORMAT_VERSION;
+    header.byte_order_ = byte_order_mark;
+    header.float_size_ = sizeof(Float);
+    header.num_nodes_ = n;
+    header.max_tree_level_ = max_tree_level;
+    header.num_cache_fields_ = N_CACHE_FIELDS;
+    checkHeader(header, std::numeric_limits<size_t>::max());
+
+    const NodeCache cache = computeNodeCache(nodes, 0, n);
+
+    std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+    if (!ofs) {
+        throw std::runtime_error("Failed to open " + filename + ".");
+    }
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(nodes.weights_.data()), nodes.weights_.size() * sizeof(Float));
+    ofs.write(reinterpret_cast<const char*>(nodes.means_.data()), nodes.means_.size() * sizeof(Float));
+    ofs.write(reinterpret_cast<const char*>(nodes.covs_.data()), nodes.covs_.size() * sizeof(Float));
+    ofs.write(reinterpret_cast<const char*>(cache.data()), cache.size() * sizeof(Float));
+    if (!ofs) {
+        throw std::runtime_error("Failed to write " + filename + ".");
+    }
+}
+
+MappedGmmTree::MappedGmmTree(const std::string& filename)
+    : mapping_(nullptr), mapping_size_(0), data_(nullptr), num_nodes_(0), max_tree_level_(0) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open " + filename + ".");
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    mapping_size_ = size.QuadPart;
+    HANDLE handle = mapping_size_ > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    CloseHandle(file);
+    if (handle != NULL) {
+        mapping_ = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(handle);
+    }
+    if (mapping_ == nullptr) {
+        throw std::runtime_error("Failed to map " + filename + ".");
+    }
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + filename + ".");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Failed to map " + filename + ".");
+    }
+    mapping_size_ = st.st_size;
+    void* addr = mmap(nullptr, mapping_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Failed to map " + filename + ".");
+    }
+    mapping_ = addr;
+#endif
+    if (mapping_size_ < sizeof(GmmTreeFileHeader)) {
+        unmap();
+        throw std::runtime_error("GMM tree file is truncated.");
+    }
+    const GmmTreeFileHeader& header = *static_cast<const GmmTreeFileHeader*>(mapping_);
+    try {
+        checkHeader(header, mapping_size_);
+    } catch (...) {
+        unmap();
+        throw;
+    }
+    num_nodes_ = header.num_nodes_;
+    max_tree_level_ = header.max_tree_level_;
+    data_ = reinterpret_cast<const Float*>(static_cast<const char*>(mapping_) + sizeof(GmmTreeFileHeader));
+}
+
+MappedGmmTree::~MappedGmmTree() { unmap(); }
+
+void MappedGmmTree::unmap() {
+    if (mapping_ == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapping_);
+#else
+    munmap(mapping_, mapping_size_);
+#endif
+    mapping_ = nullptr;
+}
+
+MappedGmmTree::WeightsMap MappedGmmTree::weights() const { return WeightsMap(data_, num_nodes_); }
+
+MappedGmmTree::MeansMap MappedGmmTree::means() const { return MeansMap(data_ + num_nodes_, num_nodes_, 3); }
+
+MappedGmmTree::CovsMap MappedGmmTree::covs() const { return CovsMap(data_ + 4 * num_nodes_, num_nodes_, 9); }
+
+MappedGmmTree::CacheMap MappedGmmTree::cache() const {
+    return CacheMap(data_ + 13 * num_nodes_, num_nodes_, N_CACHE_FIELDS);
+}
+
+GmmTreeNodes MappedGmmTree::nodes() const {
+    GmmTreeNodes res(num_nodes_);
+    res.weights_ = weights();
+    res.means_ = means();
+    res.covs_ = covs();
+    return res;
+}
@@ -0,0 +1,66 @@
+#ifndef __probreg_gmm_tree_io_h__
+#define __probreg_gmm_tree_io_h__
+
+#include <cstdint>
+#include <string>
+#include "gmmtree.h"
+
+namespace probreg {
+
+static const uint32_t GMMTREE_FORMAT_VERSION = 1;
+
+// Binary layout of a GMM tree file.
+// The 64 byte header is followed by num_nodes_ * N_GMMTREE_FIELDS values of Float,
+// each field stored as a contiguous array (structure of arrays):
+//   weights (n), means (n x 3), covariances (n x 9, column-major 3x3), cache (n x N_CACHE_FIELDS).
+struct GmmTreeFileHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t byte_order_;
+    uint32_t float_size_;
+    uint32_t num_nodes_;
+    uint32_t max_tree_level_;
+    uint32_t num_cache_fields_;
+    char reserved_[32];
+};
+
+static const Integer N_GMMTREE_FIELDS = 1 + 3 + 9 + N_CACHE_FIELDS;
+
+void saveGmmTree(const std::string& filename, const GmmTreeNodes& nodes, Integer max_tree_level);
+
+// Read-only view of a GMM tree file mapped into memory.
+// Processes mapping the same file share its pages through the page cache.
+class MappedGmmTree {
+   public:
+    typedef Eigen::Map<const Vector> WeightsMap;
+    typedef Eigen::Map<const MatrixX3> MeansMap;
+    typedef Eigen::Map<const GmmTreeNodes::CovArray> CovsMap;
+    typedef Eigen::Map<const NodeCache> CacheMap;
+
+    explicit MappedGmmTree(const std::string& filename);
+    ~MappedGmmTree();
+    MappedGmmTree(const MappedGmmTree&) = delete;
+    MappedGmmTree& operator=(const MappedGmmTree&) = delete;
+
+    Integer size() const { return num_nodes_; }
+    Integer maxTreeLevel() const { return max_tree_level_; }
+    const Float* data() const { return data_; }
+    WeightsMap weights() const;
+    MeansMap means() const;
+    CovsMap covs() const;
+    CacheMap cache() const;
+    GmmTreeNodes nodes() const;
+
+   private:
+    void unmap();
+
+    void* mapping_;
+    size_t mapping_size_;
+    const Float* data_;
+    Integer num_nodes_;
+    Integer max_tree_level_;
+};
+
+}  // namespace probreg
+
+#endif
@@ -1,18 +1,218 @@
 #include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "gmmtree.h"
+#include "gmmtree_io.h"
 
 namespace py = pybind11;
 using namespace probreg;
 
+namespace {
+
+// Numpy view of the node arrays, kept alive by the owner object.
+template <typename Scalar>
+py::array nodesView(py::object self,
+                    const Scalar* ptr,
+                    const std::vector<ptrdiff_t>& shape,
+                    const std::vector<ptrdiff_t>& strides,
+                    bool writeable) {
+    py::array arr(py::dtype::of<Scalar>(), shape, strides, ptr, self);
+    if (!writeable) arr.attr("setflags")(py::arg("write") = false);
+    return arr;
+}
+
+template <typename Scalar>
+std::vector<ptrdiff_t> meansStrides(ptrdiff_t n) {
+    const ptrdiff_t size = sizeof(Scalar);
+    return {size, n * size};
+}
+
+template <typename Scalar>
+std::vector<ptrdiff_t> covsStrides(ptrdiff_t n) {
+    const ptrdiff_t size = sizeof(Scalar);
+    return {size, n * size, 3 * n * size};
+}
+
+template <typename Scalar>
+void defNodes(py::module& m, const char* name) {
+    static const ptrdiff_t scalar_size = sizeof(Scalar);
+    typedef GmmTreeNodesT<Scalar> Nodes;
+    py::class_<Nodes>(m, name)
+        .def(py::init<Integer>())
+        .def_property_readonly("weights",
+                               [](py::object self) {
+                                   auto& t = self.cast<Nodes&>();
+                                   const ptrdiff_t n = t.size();
+                                   return nodesView(self, t.weights_.data(), {n}, {scalar_size}, true);
+                               })
+        .def_property_readonly("means",
+                               [](py::object self) {
+                                   auto& t = self.cast<Nodes&>();
+                                   const ptrdiff_t n = t.size();
+                                   return nodesView(self, t.means_.data(), {n, 3}, meansStrides<Scalar>(n),
+                                                    true);
+                               })
+        .def_property_readonly("covs",
+                               [](py::object self) {
+                                   auto& t = self.cast<Nodes&>();
+                                   const ptrdiff_t n = t.size();
+                                   return nodesView(self, t.covs_.data(), {n, 3, 3}, covsStrides<Scalar>(n),
+                                                    true);
+                               })
+        .def("__len__", &Nodes::size);
+}
+
+// The overloads are dispatched on the dtype of the points. With mixed_precision, the moments of float32
+// points are summed in double and returned as GmmTreeNodes64, the M-step then solves in double.
+template <typename Scalar>
+void defGmmTree(py::module& m) {
+    m.def(
+        "build_gmmtree",
+        [](const MatrixX3CRefT<Scalar>& points, Integer max_tree_level, Scalar lambda_s, Scalar lambda_d,
+           unsigned int seed, bool mixed_precision) {
+            return mixed_precision
+                       ? buildGmmTree<Scalar, double>(points, max_tree_level, lambda_s, lambda_d, seed)
+                       : buildGmmTree<Scalar>(points, max_tree_level, lambda_s, lambda_d, seed);
+        },
+        py::arg("points"), py::arg("max_tree_level"), py::arg("lambda_s"), py::arg("lambda_d"),
+        py::arg("seed") = 0, py::arg("mixed_precision") = false);
+    m.def(
+        "gmmtree_reg_estep",
+        [](const MatrixX3CRefT<Scalar>& points, const GmmTreeNodesT<Scalar>& nodes, Integer max_tree_level,
+           Scalar lambda_c, bool mixed_precision) -> py::object {
+            if (mixed_precision) {
+                return py::cast(gmmTreeRegEstep<Scalar, double>(points, nodes, max_tree_level, lambda_c));
+            }
+            return py::cast(gmmTreeRegEstep<Scalar>(points, nodes, max_tree_level, lambda_c));
+        },
+        py::arg("points"), py::arg("nodes"), py::arg("max_tree_level"), py::arg("lambda_c"),
+        py::arg("mixed_precision") = false);
+    typedef GmmTreeNodesT<Scalar> Nodes;
+    m.def("gmmtree_reg_mstep", py::overload_cast<const Nodes&, const Nodes&>(&gmmTreeRegMstep<Scalar>),
+          py::arg("moments"), py::arg("nodes"));
+    // Builds the trees and registers the pairs (sources[i], targets[i]) on the OpenMP threads,
+    // the GIL is released for the whole batch.
+    m.def(
+        "gmmtree_register_many",
+        [](const std::vector<MatrixX3T<Scalar>>& sources, const std::vector<MatrixX3T<Scalar>>& targets,
+           Integer max_tree_level, Scalar lambda_s, Scalar lambda_d, Scalar lambda_c, Integer maxiter,
+           Scalar tol, bool mixed_precision) {
+            if (mixed_precision) {
+                return registerGmmTreeBatch<Scalar, double>(sources, targets, max_tree_level, lambda_s,
+                                                            lambda_d, lambda_c, maxiter, tol);
+            }
+            return registerGmmTreeBatch<Scalar>(sources, targets, max_tree_level, lambda_s, lambda_d,
+                                                lambda_c, maxiter, tol);
+        },
+        py::arg("sources"), py::arg("targets"), py::arg("max_tree_level") = 2, py::arg("lambda_s") = 0.001,
+        py::arg("lambda_d") = 1.0e-4, py::arg("lambda_c") = 0.01, py::arg("maxiter") = 20,
+        py::arg("tol") = 1.0e-4, py::arg("mixed_precision") = false,
+        py::call_guard<py::gil_scoped_release>());
+}
+
+template <typename Scalar>
+void defRegResult(py::module& m, const char* name) {
+    typedef GmmTreeRegResultT<Scalar> Result;
+    py::class_<Result>(m, name)
+        .def_readonly("rot", &Result::rot_)
+        .def_readonly("t", &Result::t_)
+        .def_readonly("q", &Result::q_)
+        .def_readonly("n_iter", &Result::n_iter_);
+}
+
+}  // namespace
+
 PYBIND11_MODULE(_gmmtree, m) {
-    m.def("build_gmmtree", buildGmmTree);
-    m.def("gmmtree_reg_estep", gmmTreeRegEstep);
+    static const ptrdiff_t float_size = sizeof(Float);
+    defNodes<float>(m, "GmmTreeNodes");
+    defNodes<double>(m, "GmmTreeNodes64");
+    defRegResult<float>(m, "GmmTreeRegResult");
+    defRegResult<double>(m, "GmmTreeRegResult64");
+
+    py::class_<MappedGmmTree>(m, "MappedGmmTree")
+        .def(py::init<std::string>())
+        .def_property_readonly("max_tree_level", &MappedGmmTree::maxTreeLevel)
+        .def_property_readonly("weights",
+                               [](py::object self) {
+                                   const auto& t = self.cast<const MappedGmmTree&>();
+                                   const ptrdiff_t n = t.size();
+                                   return nodesView(self, t.weights().data(), {n}, {float_size}, false);
+                               })
+        .def_property_readonly("means",
+                               [](py::object self) {
+                                   const auto& t = self.cast<const MappedGmmTree&>();
+                                   const ptrdiff_t n = t.size();
+                                   return nodesView(self, t.means().data(), {n, 3}, meansStrides<Float>(n),
+                                                    false);
+                               })
+        .def_property_readonly("covs",
+                               [](py::object self) {
+                                   const auto& t = self.cast<const MappedGmmTree&>();
+                                   const ptrdiff_t n = t.size();
+                                   return nodesView(self, t.covs().data(), {n, 3, 3}, covsStrides<Float>(n),
+                                                    false);
+                               })
+        .def("nodes", &MappedGmmTree::nodes)
+        .def("__len__", &MappedGmmTree::size);
+
+    defGmmTree<float>(m);
+    defGmmTree<double>(m);
+    m.def(
+        "gmmtree_reg_mstep",
+        py::overload_cast<const GmmTreeNodesT<double>&, const GmmTreeNodes&>(&gmmTreeRegMstep<Float, double>),
+        py::arg("moments"), py::arg("nodes"));
+
+    // The mapped trees are float32, the E-step of float64 points runs on a double copy of the cache.
+    m.def(
+        "gmmtree_reg_estep",
+        [](const MatrixX3CRef& points, const MappedGmmTree& tree, Integer max_tree_level, Float lambda_c,
+           bool mixed_precision) -> py::object {
+            if (mixed_precision) {
+                return py::cast(
+                    gmmTreeRegEstep<Float, double>(points, tree.cache(), max_tree_level, lambda_c));
+            }
+            return py::cast(gmmTreeRegEstep<Float>(points, tree.cache(), max_tree_level, lambda_c));
+        },
+        py::arg("points"), py::arg("nodes"), py::arg("max_tree_level"), py::arg("lambda_c"),
+        py::arg("mixed_precision") = false);
+    m.def(
+        "gmmtree_reg_estep",
+        [](const MatrixX3CRefT<double>& points, const MappedGmmTree& tree, Integer max_tree_level,
+           double lambda_c, bool) {
+            const NodeCacheT<double> cache = tree.cache().cast<double>();
+            return gmmTreeRegEstep<double>(points, cache, max_tree_level, lambda_c);
+        },
+        py::arg("points"), py::arg("nodes"), py::arg("max_tree_level"), py::arg("lambda_c"),
+        py::arg("mixed_precision") = false);
+    m.def(
+        "gmmtree_reg_mstep",
+        [](const GmmTreeNodes& moments, const MappedGmmTree& tree) {
+            return gmmTreeRegMstep<Float>(moments, tree.cache());
+        },
+        py::arg("moments"), py::arg("nodes"));
+    m.def(
+        "gmmtree_reg_mstep",
+        [](const GmmTreeNodesT<double>& moments, const MappedGmmTree& tree) {
+            return gmmTreeRegMstep<Float, double>(moments, tree.cache());
+        },
+        py::arg("moments"), py::arg("nodes"));
+    m.def("save_gmmtree", &saveGmmTree, py::arg("filename"), py::arg("nodes"), py::arg("max_tree_level"));
+    // The file format is float32.
+    m.def(
+        "save_gmmtree",
+        [](const std::string& filename, const GmmTreeNodesT<double>& nodes, Integer max_tree_level) {
+            saveGmmTree(filename, nodes.cast<Float>(), max_tree_level);
+        },
+        py::arg("filename"), py::arg("nodes"), py::arg("max_tree_level"));
+    m.def("load_gmmtree", [](const std::string& filename) {
+        MappedGmmTree tree(filename);
+        return py::make_tuple(tree.nodes(), tree.maxTreeLevel());
+    });
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
     m.attr("__version__") = "dev";
 #endif
-}
\ No newline at end of file
+}
@@ -1,6 +1,11 @@
 #include "ifgt.h"
+#include "chunks.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <limits>
 #include <stdexcept>
+#include <vector>
 
 using namespace probreg;
 
@@ -22,64 +27,176 @@ Integer nchoosek(Integer n, Integer k) {
     return nchsk;
 }
 
+template <typename Scalar>
 Integer chooseTruncationNumber(
-    Integer num_dims, Float h, Float r, Float eps, Float max_cluster_radius, Integer p_limit = 200) {
-    const Float h2 = h * h;
-    const Float& rx = max_cluster_radius;
-    const Float rx2 = rx * rx;
-    Float error = std::numeric_limits<Float>::max();
-    Float temp = 1.0;
+    Integer num_dims, Scalar h, Scalar r, Scalar eps, Scalar max_cluster_radius, Integer p_limit = 200) {
+    const Scalar h2 = h * h;
+    const Scalar& rx = max_cluster_radius;
+    const Scalar rx2 = rx * rx;
+    Scalar error = std::numeric_limits<Scalar>::max();
+    Scalar temp = 1.0;
     Integer p = 0;
     while ((error > eps) && (p <= p_limit)) {
         ++p;
-        const Float b = std::min(Float(rx + std::sqrt(rx2 + 2.0 * Float(p) * h2) * 0.5), rx + r);
-        const Float c = rx - b;
-        temp *= 2.0 * rx * b / h2 / Float(p);
+        const Scalar b = std::min(Scalar(rx + std::sqrt(rx2 + 2.0 * Scalar(p) * h2) * 0.5), rx + r);
+        const Scalar c = rx - b;
+        temp *= 2.0 * rx * b / h2 / Scalar(p);
         error = temp * std::exp(-(c * c) / h2);
     }
     return p;
 }
 
-IfgtParameters chooseIfgtParameters(
-    Integer num_dims, Float h, Float eps, Float max_range, Integer num_max_clusters, Integer p_limit = 200) {
-    const Float r = std::min(max_range * std::sqrt(num_dims), h * std::sqrt(std::log(1.0 / eps)));
-    Float complexity_min = std::numeric_limits<Float>::max();
-    Integer num_clusters = 0;
-    Integer p_max = p_limit;
-
-    for (Integer i = 0; i < num_max_clusters; ++i) {
-        const Float rx = max_range * std::pow(Float(i + 1), -1.0 / Float(num_dims));
-        const Float n = std::min(Float(i + 1), Float(std::pow(r / rx, num_dims)));
-        const Integer p = chooseTruncationNumber(num_dims, h, r, eps, rx, p_limit);
-        Float complexity = i + 1 + std::log(Float(i + 1)) + (n + 1) * nchoosek(p - 1 + num_dims, num_dims);
-        if (complexity < complexity_min) {
-            complexity_min = complexity;
-            num_clusters = i + 1;
-            p_max = p;
+// The number of clusters is searched on a geometric grid up to sqrt(N), then refined linearly
+// around the best grid point. Truncation numbers are memoized since both passes revisit the same counts.
+template <typename Scalar>
+IfgtParametersT<Scalar> chooseIfgtParameters(Integer num_dims,
+                                             Scalar h,
+                                             Scalar eps,
+                                             Scalar max_range,
+                                             Integer num_max_clusters,
+                                             Integer p_limit = 200) {
+    const Scalar r = std::min(max_range * std::sqrt(num_dims), h * std::sqrt(std::log(1.0 / eps)));
+    const Integer k_sqrt = std::ceil(std::sqrt(Scalar(num_max_clusters)));
+    const Integer k_limit = std::max(Integer(1), std::min(num_max_clusters, k_sqrt));
+    std::vector<Scalar> memo(k_limit + 1, -1.0);
+    std::vector<Integer> p_memo(k_limit + 1, 0);
+    auto complexity = [&](Integer k) {
+        if (memo[k] < 0.0) {
+            const Scalar rx = max_range * std::pow(Scalar(k), -1.0 / Scalar(num_dims));
+            const Scalar n = std::min(Scalar(k), Scalar(std::pow(r / rx, num_dims)));
+            p_memo[k] = chooseTruncationNumber(num_dims, h, r, eps, rx, p_limit);
+            memo[k] = k + std::log(Scalar(k)) + (n + 1) * nchoosek(p_memo[k] - 1 + num_dims, num_dims);
         }
+        return memo[k];
+    };
+
+    std::vector<Integer> grid(1, 1);
+    while (grid.back() < k_limit) {
+        grid.push_back(std::min(k_limit, std::max(grid.back() + 1, Integer(grid.back() * 1.25))));
+    }
+    size_t i_best = 0;
+    for (size_t i = 1; i < grid.size(); ++i) {
+        if (complexity(grid[i]) < complexity(grid[i_best])) i_best = i;
     }
-    return {num_clusters, r, p_max};
+    Integer k_best = grid[i_best];
+    const Integer kb = grid[i_best > 0 ? i_best - 1 : 0];
+    const Integer ke = grid[std::min(i_best + 1, grid.size() - 1)];
+    for (Integer k = kb; k <= ke; ++k) {
+        if (complexity(k) < complexity(k_best)) k_best = k;
+    }
+    return {k_best, r, p_memo[k_best], memo[k_best]};
 }
 
-Vector computeMonomials(Integer num_dims, const Vector& d, Integer p, Integer p_max_total) {
-    VectorXi heads = VectorXi::Zero(num_dims);
-    Vector monomials = Vector::Ones(p_max_total);
+// Writes the monomials of d up to the total degree p - 1 into monomials without allocating.
+// heads is a scratch buffer of num_dims elements.
+template <int Dim, typename Scalar>
+void computeMonomials(Integer num_dims, const Scalar* d, Integer p, Integer* heads, Scalar* monomials) {
+    const Integer nd = (Dim == Eigen::Dynamic) ? num_dims : Dim;
+    std::fill(heads, heads + nd, 0);
+    monomials[0] = 1.0;
     for (Integer k = 1, t = 1, tail = 1; k < p; ++k, tail = t) {
-        for (Integer i = 0; i < num_dims; ++i) {
-            Integer n = tail - heads[i];
-            monomials(Eigen::seqN(t, n)) = d[i] * monomials(Eigen::seqN(heads[i], n));
+        for (Integer i = 0; i < nd; ++i) {
+            const Integer n = tail - heads[i];
+            const Scalar di = d[i];
+            const Scalar* src = monomials + heads[i];
+            Scalar* dst = monomials + t;
+            for (Integer m = 0; m < n; ++m) dst[m] = di * src[m];
             heads[i] = t;
             t += n;
         }
     }
-    return monomials;
 }
 
-Vector computeConstantSeries(Integer num_dims, Integer p, Integer p_max_total) {
+// Scaled difference (x - c) / h and its squared norm.
+template <int Dim, typename Scalar>
+Scalar scaledDifference(Integer num_dims, const Scalar* x, const Scalar* c, Scalar h, Scalar* d) {
+    const Integer nd = (Dim == Eigen::Dynamic) ? num_dims : Dim;
+    Scalar distance = 0.0;
+    for (Integer i = 0; i < nd; ++i) {
+        const Scalar di = x[i] - c[i];
+        distance += di * di;
+        d[i] = di / h;
+    }
+    return distance;
+}
+
+static const Integer max_grid_dims = 3;
+static const double max_grid_cells = 1 << 20;
+
+// Grid coordinate of x along the axis k, clamped to [-2, dims + 1] so that it cannot overflow.
+template <typename Scalar>
+Integer cellCoordinate(const ClusterGridT<Scalar>& grid, Integer k, Scalar x) {
+    const Scalar c = std::floor((x - grid.origin_[k]) / grid.cell_size_);
+    return std::max(Scalar(-2), std::min(c, Scalar(grid.dims_[k] + 1)));
+}
+
+// Range of grid coordinates [lo, hi] along the axis k of the cells adjacent to x, empty if lo > hi.
+// The single cell of the grids above max_grid_dims is not bounded by the cell size, it is always visited.
+template <typename Scalar>
+void adjacentCells(const ClusterGridT<Scalar>& grid, Integer k, Scalar x, Integer& lo, Integer& hi) {
+    if (grid.dims_.size() > max_grid_dims) {
+        lo = hi = 0;
+        return;
+    }
+    const Integer c = cellCoordinate(grid, k, x);
+    lo = std::max(c - 1, 0);
+    hi = std::min(c + 1, grid.dims_[k] - 1);
+}
+
+template <typename Scalar>
+ClusterGridT<Scalar> buildClusterGrid(const MatrixT<Scalar>& centers, const VectorT<Scalar>& ry2) {
+    const Integer num_dims = centers.cols();
+    ClusterGridT<Scalar> grid;
+    grid.origin_ = centers.colwise().minCoeff();
+    const VectorT<Scalar> extent = centers.colwise().maxCoeff().transpose() - grid.origin_;
+    grid.cell_size_ = std::max(std::sqrt(ry2.maxCoeff()), std::numeric_limits<Scalar>::min());
+    grid.dims_ = VectorXi::Ones(num_dims);
+    if (num_dims <= max_grid_dims) {
+        auto num_cells = [&extent](Scalar cell_size) {
+            return (extent.array() / cell_size + 1.0).template cast<double>().floor().prod();
+        };
+        while (num_cells(grid.cell_size_) > max_grid_cells) grid.cell_size_ *= 2.0;
+        grid.dims_ = (extent.array() / grid.cell_size_).floor().template cast<Integer>() + 1;
+    }
+
+    const Integer num_cells = grid.dims_.prod();
+    VectorXi cells(centers.rows());
+    for (Integer j = 0; j < centers.rows(); ++j) {
+        Integer cell = 0;
+        for (Integer k = num_dims - 1; k >= 0; --k) {
+            const Integer c = cellCoordinate(grid, k, centers(j, k));
+            cell = cell * grid.dims_[k] + std::max(0, std::min(c, grid.dims_[k] - 1));
+        }
+        cells[j] = cell;
+    }
+    grid.cell_offsets_ = VectorXi::Zero(num_cells + 1);
+    for (Integer j = 0; j < cells.size(); ++j) ++grid.cell_offsets_[cells[j] + 1];
+    for (Integer c = 0; c < num_cells; ++c) grid.cell_offsets_[c + 1] += grid.cell_offsets_[c];
+    VectorXi next = grid.cell_offsets_.head(num_cells);
+    grid.cell_clusters_.resize(cells.size());
+    for (Integer j = 0; j < cells.size(); ++j) grid.cell_clusters_[next[cells[j]]++] = j;
+    return grid;
+}
+
+template <typename Scalar>
+const IfgtPlanT<Scalar>& checkPlan(const MatrixCRefT<Scalar>& source,
+                                   Scalar h,
+                                   const IfgtPlanT<Scalar>& plan) {
+    if (plan.order_.size() != source.rows() || plan.cluster_.cluster_centers_.cols() != source.cols()) {
+        throw std::invalid_argument("The plan was computed for a different source.");
+    }
+    if (plan.h_ != h) {
+        throw std::invalid_argument("The plan was computed for a different bandwidth.");
+    }
+    return plan;
+}
+
+template <typename Scalar>
+VectorT<Scalar> computeConstantSeries(Integer num_dims, Integer p, Integer p_max_total) {
     VectorXi heads = VectorXi::Zero(num_dims + 1);
     heads[num_dims] = std::numeric_limits<VectorXi::value_type>::max();
     VectorXi cinds = VectorXi::Zero(p_max_total);
-    Vector monomials = Vector::Ones(p_max_total);
+    VectorT<Scalar> monomials = VectorT<Scalar>::Ones(p_max_total);
 
     for (Integer k = 1, t = 1, tail = 1; k < p; ++k, tail = t) {
         for (Integer i = 0; i < num_dims; ++i) {
@@ -88,7 +205,7 @@ Vector computeConstantSeries(Integer num_dims, Integer p, Integer p_max_total) {
             cinds(Eigen::seqN(t, n)).array() =
                 (rng.array() < heads[i + 1]).select(cinds(Eigen::seqN(heads[i], n)).array() + 1, 1);
             monomials(Eigen::seqN(t, n)) = 2.0 * monomials(Eigen::seqN(heads[i], n));
-            monomials(Eigen::seqN(t, n)).array() /= cinds(Eigen::seqN(t, n)).array().cast<Float>();
+            monomials(Eigen::seqN(t, n)).array() /= cinds(Eigen::seqN(t, n)).array().cast<Scalar>();
             heads[i] = t;
             t += n;
         }
@@ -98,51 +215,219 @@ Vector computeConstantSeries(Integer num_dims, Integer p, Integer p_max_total) {
 
 }  // namespace
 
-Ifgt::Ifgt(const Matrix& source, Float h, Float eps) : source_(source), h_(h) {
-    const Integer num_max_clusters = source_.rows();
-    Float max_range = (source_.colwise().maxCoeff() - source_.colwise().minCoeff()).maxCoeff();
-    params_ = chooseIfgtParameters(source_.cols(), h_, eps, max_range, num_max_clusters);
-    if (params_.num_clusters_ == 0) {
+template <typename Scalar>
+IfgtPlanT<Scalar> probreg::computeIfgtPlan(const MatrixCRefT<Scalar>& source, Scalar h, Scalar eps) {
+    const Integer num_max_clusters = source.rows();
+    Scalar max_range = (source.colwise().maxCoeff() - source.colwise().minCoeff()).maxCoeff();
+    IfgtPlanT<Scalar> plan;
+    plan.h_ = h;
+    plan.eps_ = eps;
+    plan.params_ = chooseIfgtParameters(source.cols(), h, eps, max_range, num_max_clusters);
+    if (plan.params_.num_clusters_ == 0) {
         throw std::runtime_error("Result of K center clustering is 0.");
     }
-    cluster_ = computeKCenterClustering(source_, params_.num_clusters_, eps);
-    const Float r = std::min(max_range * std::sqrt(source_.cols()), h_ * std::sqrt(std::log(1.0 / eps)));
-    p_ = chooseTruncationNumber(source_.cols(), h_, r, eps, cluster_.max_cluster_radius_, params_.p_max_);
-    p_max_total_ = nchoosek(p_ - 1 + source_.cols(), source_.cols());
-    constant_series_ = computeConstantSeries(source_.cols(), p_, p_max_total_);
-    ry2_ = (params_.cutoff_radius_ * Vector::Ones(params_.num_clusters_) + cluster_.cluster_radii_)
-               .array()
-               .pow(2)
-               .matrix();
-}
-
-Ifgt::~Ifgt() {}
-
-Vector Ifgt::compute(const Matrix& target, const Vector& weights) const {
-    const Float h2 = h_ * h_;
-    Matrix cmat = Matrix::Zero(params_.num_clusters_, p_max_total_);
-    for (Integer i = 0; i < source_.rows(); ++i) {
-        Vector dx = source_.row(i) - cluster_.cluster_centers_.row(cluster_.cluster_index_[i]);
-        const Float distance = dx.array().pow(2).sum();
-        dx /= h_;
-        auto monomials = computeMonomials(source_.cols(), dx, p_, p_max_total_);
-        const Float f = weights[i] * std::exp(-distance / h2);
-        cmat.row(cluster_.cluster_index_[i]) += f * monomials;
-    }
-
-    cmat.array().rowwise() *= constant_series_.transpose().array();
-    Vector gvec = Vector::Zero(target.rows());
-    #pragma omp parallel for
+    plan.cluster_ = computeKCenterClustering(source, plan.params_.num_clusters_, eps);
+    const Scalar r = std::min(max_range * std::sqrt(source.cols()), h * std::sqrt(std::log(1.0 / eps)));
+    plan.p_ = chooseTruncationNumber(source.cols(), h, r, eps, plan.cluster_.max_cluster_radius_,
+                                     plan.params_.p_max_);
+    plan.p_max_total_ = nchoosek(plan.p_ - 1 + source.cols(), source.cols());
+    plan.constant_series_ = computeConstantSeries<Scalar>(source.cols(), plan.p_, plan.p_max_total_);
+    plan.ry2_ = (plan.params_.cutoff_radius_ * VectorT<Scalar>::Ones(plan.params_.num_clusters_) +
+                 plan.cluster_.cluster_radii_)
+                    .array()
+                    .pow(2)
+                    .matrix();
+
+    // Counting sort of the source points by cluster.
+    const VectorXi& labels = plan.cluster_.cluster_index_;
+    plan.cluster_offsets_ = VectorXi::Zero(plan.params_.num_clusters_ + 1);
+    for (Integer i = 0; i < labels.size(); ++i) ++plan.cluster_offsets_[labels[i] + 1];
+    for (Integer j = 0; j < plan.params_.num_clusters_; ++j) {
+        plan.cluster_offsets_[j + 1] += plan.cluster_offsets_[j];
+    }
+    VectorXi next = plan.cluster_offsets_.head(plan.params_.num_clusters_);
+    plan.order_.resize(labels.size());
+    for (Integer i = 0; i < labels.size(); ++i) plan.order_[next[labels[i]]++] = i;
+    plan.grid_ = buildClusterGrid(plan.cluster_.cluster_centers_, plan.ry2_);
+    return plan;
+}
+
+template <typename Scalar>
+Scalar probreg::estimateIfgtComplexity(const MatrixCRefT<Scalar>& source, Scalar h, Scalar eps) {
+    Scalar max_range = (source.colwise().maxCoeff() - source.colwise().minCoeff()).maxCoeff();
+    return chooseIfgtParameters(source.cols(), h, eps, max_range, source.rows()).complexity_;
+}
+
+template <typename Scalar>
+IfgtT<Scalar>::IfgtT(const MatrixCRefT<Scalar>& source, Scalar h, Scalar eps)
+    : h_(h), plan_(computeIfgtPlan(source, h, eps)), sorted_source_(source(plan_.order_, Eigen::all)) {}
+
+template <typename Scalar>
+IfgtT<Scalar>::IfgtT(const MatrixCRefT<Scalar>& source, Scalar h, const IfgtPlanT<Scalar>& plan)
+    : h_(h), plan_(checkPlan(source, h, plan)), sorted_source_(source(plan_.order_, Eigen::all)) {}
+
+template <typename Scalar>
+IfgtT<Scalar>::~IfgtT() {}
+
+template <typename Scalar>
+VectorT<Scalar> IfgtT<Scalar>::compute(const MatrixCRefT<Scalar>& target,
+                                       const VectorT<Scalar>& weights) const {
+    return compute(target, MatrixT<Scalar>(weights)).col(0);
+}
+
+template <typename Scalar>
+MatrixT<Scalar> IfgtT<Scalar>::compute(const MatrixCRefT<Scalar>& target,
+                                       const MatrixT<Scalar>& weights) const {
+    MatrixT<Scalar> gmat(target.rows(), weights.cols());
+    compute(target, weights, gmat);
+    return gmat;
+}
+
+template <typename Scalar>
+void IfgtT<Scalar>::compute(const MatrixCRefT<Scalar>& target,
+                            const MatrixT<Scalar>& weights,
+                            MatrixRefT<Scalar> gmat) const {
+    if (weights.rows() != sorted_source_.rows()) {
+        throw std::invalid_argument("The number of weights does not match the source.");
+    }
+    if (target.cols() != sorted_source_.cols()) {
+        throw std::invalid_argument("The dimensions of the target and the source do not match.");
+    }
+    if (gmat.rows() != target.rows() || gmat.cols() != weights.cols()) {
+        throw std::invalid_argument("The size of the output does not match the target and the weights.");
+    }
+    switch (sorted_source_.cols()) {
+        case 2:
+            computeImpl<2>(target, weights, gmat);
+            break;
+        case 3:
+            computeImpl<3>(target, weights, gmat);
+            break;
+        default:
+            computeImpl<Eigen::Dynamic>(target, weights, gmat);
+    }
+}
+
+template <typename Scalar>
+template <int Dim>
+void IfgtT<Scalar>::computeImpl(const MatrixCRefT<Scalar>& target,
+                                const MatrixT<Scalar>& weights,
+                                MatrixRefT<Scalar> gmat) const {
+    const Scalar h2 = h_ * h_;
+    const Integer num_dims = sorted_source_.cols();
+    const Integer num_clusters = plan_.params_.num_clusters_;
+    const Integer p_max_total = plan_.p_max_total_;
+    const ClusteringResultT<Scalar>& cluster = plan_.cluster_;
+    const RowMatrixT<Scalar> centers = cluster.cluster_centers_;
+
+    // Coefficients of the cluster j are the rows j * p_max_total ... (j + 1) * p_max_total - 1.
+    // The sorted source is split into chunks, each chunk only touches a contiguous range of clusters
+    // and accumulates them in its own buffer. The buffers are reduced in chunk order.
+    const Integer n_source = sorted_source_.rows();
+    const Integer n_chunks = numChunks(n_source);
+    std::vector<MatrixT<Scalar>> partials(n_chunks);
+    std::vector<Integer> first_cluster(n_chunks);
+
+    #pragma omp parallel
+    {
+        VectorXi heads(num_dims);
+        VectorT<Scalar> dx(num_dims);
+        VectorT<Scalar> monomials(p_max_total);
+        #pragma omp for schedule(static)
+        for (Integer c = 0; c < n_chunks; ++c) {
+            const Integer ib = chunkBegin(c, n_chunks, n_source);
+            const Integer ie = chunkBegin(c + 1, n_chunks, n_source);
+            if (ib == ie) continue;
+            const Integer jb = cluster.cluster_index_[plan_.order_[ib]];
+            const Integer je = cluster.cluster_index_[plan_.order_[ie - 1]] + 1;
+            first_cluster[c] = jb;
+            MatrixT<Scalar>& cmat = partials[c];
+            cmat.setZero((je - jb) * p_max_total, weights.cols());
+            for (Integer i = ib; i < ie; ++i) {
+                const Integer idx = plan_.order_[i];
+                const Integer j = cluster.cluster_index_[idx];
+                const Scalar distance = scaledDifference<Dim>(num_dims, sorted_source_.row(i).data(),
+                                                             centers.row(j).data(), h_, dx.data());
+                computeMonomials<Dim>(num_dims, dx.data(), plan_.p_, heads.data(), monomials.data());
+                const Scalar f = std::exp(-distance / h2);
+                cmat.middleRows((j - jb) * p_max_total, p_max_total).noalias() +=
+                    monomials * (f * weights.row(idx));
+            }
+        }
+    }
+    MatrixT<Scalar> cmat = MatrixT<Scalar>::Zero(num_clusters * p_max_total, weights.cols());
+    for (Integer c = 0; c < n_chunks; ++c) {
+        if (partials[c].size() == 0) continue;
+        cmat.middleRows(first_cluster[c] * p_max_total, partials[c].rows()) += partials[c];
+    }
+    for (Integer j = 0; j < num_clusters; ++j) {
+        cmat.middleRows(j * p_max_total, p_max_total).array().colwise() *= plan_.constant_series_.array();
+    }
+
+    // Targets are visited in the order of their grid cells, so consecutive targets share clusters
+    // and the coefficient rows they read stay in cache.
+    const ClusterGridT<Scalar>& grid = plan_.grid_;
+    const Integer num_cells = grid.dims_.prod();
+    VectorXi target_cells(target.rows());
+    VectorXi cell_offsets = VectorXi::Zero(num_cells + 1);
     for (Integer i = 0; i < target.rows(); ++i) {
-        for (Integer j = 0; j < params_.num_clusters_; ++j) {
-            Vector dy = target.row(i) - cluster_.cluster_centers_.row(j);
-            const Float distance = dy.array().pow(2).sum();
-            if (distance > ry2_[j]) continue;
-            dy /= h_;
-            auto monomials = computeMonomials(source_.cols(), dy, p_, p_max_total_);
-            const Float g = std::exp(-distance / h2);
-            gvec[i] += cmat.row(j) * g * monomials;
+        Integer cell = 0;
+        for (Integer k = num_dims - 1; k >= 0; --k) {
+            const Integer c = cellCoordinate(grid, k, target(i, k));
+            cell = cell * grid.dims_[k] + std::max(0, std::min(c, grid.dims_[k] - 1));
         }
+        target_cells[i] = cell;
+        ++cell_offsets[cell + 1];
     }
-    return gvec;
-}
\ No newline at end of file
+    for (Integer c = 0; c < num_cells; ++c) cell_offsets[c + 1] += cell_offsets[c];
+    VectorXi target_order(target.rows());
+    for (Integer i = 0; i < target.rows(); ++i) target_order[cell_offsets[target_cells[i]]++] = i;
+
+    gmat.setZero();
+    const RowMatrixT<Scalar> target_rows = target;
+    #pragma omp parallel
+    {
+        VectorXi heads(num_dims);
+        VectorXi lo(num_dims), hi(num_dims), cur(num_dims);
+        VectorT<Scalar> dy(num_dims);
+        VectorT<Scalar> monomials(p_max_total);
+        #pragma omp for schedule(static)
+        for (Integer s = 0; s < target.rows(); ++s) {
+            const Integer i = target_order[s];
+            bool empty = false;
+            for (Integer k = 0; k < num_dims; ++k) {
+                adjacentCells(grid, k, target_rows(i, k), lo[k], hi[k]);
+                empty = empty || lo[k] > hi[k];
+            }
+            if (empty) continue;
+            cur = lo;
+            while (true) {
+                Integer cell = 0;
+                for (Integer k = num_dims - 1; k >= 0; --k) cell = cell * grid.dims_[k] + cur[k];
+                for (Integer n = grid.cell_offsets_[cell]; n < grid.cell_offsets_[cell + 1]; ++n) {
+                    const Integer j = grid.cell_clusters_[n];
+                    const Scalar distance = scaledDifference<Dim>(num_dims, target_rows.row(i).data(),
+                                                                 centers.row(j).data(), h_, dy.data());
+                    if (distance > plan_.ry2_[j]) continue;
+                    computeMonomials<Dim>(num_dims, dy.data(), plan_.p_, heads.data(), monomials.data());
+                    const Scalar g = std::exp(-distance / h2);
+                    gmat.row(i).noalias() +=
+                        g * monomials.transpose() * cmat.middleRows(j * p_max_total, p_max_total);
+                }
+                Integer k = 0;
+                while (k < num_dims && ++cur[k] > hi[k]) {
+                    cur[k] = lo[k];
+                    ++k;
+                }
+                if (k == num_dims) break;
+            }
+        }
+    }
+}
+
+template IfgtPlanT<float> probreg::computeIfgtPlan(const MatrixCRefT<float>&, float, float);
+template IfgtPlanT<double> probreg::computeIfgtPlan(const MatrixCRefT<double>&, double, double);
+template float probreg::estimateIfgtComplexity(const MatrixCRefT<float>&, float, float);
+template double probreg::estimateIfgtComplexity(const MatrixCRefT<double>&, double, double);
+template class probreg::IfgtT<float>;
+template class probreg::IfgtT<double>;
\ No newline at end of file
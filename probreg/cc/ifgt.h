@@ -5,28 +5,82 @@
 
 namespace probreg {
 
-struct IfgtParameters {
+template <typename Scalar>
+struct IfgtParametersT {
     Integer num_clusters_;
-    Float cutoff_radius_;
+    Scalar cutoff_radius_;
     Integer p_max_;
+    Scalar complexity_;  // estimated number of operations per target point.
 };
 
-class Ifgt {
-   public:
-    Ifgt(const Matrix& source, Float h, Float eps);
-    ~Ifgt();
-    Vector compute(const Matrix& target, const Vector& weights) const;
+// Uniform grid over the cluster centers. The cell size is at least the largest interaction distance
+// sqrt(ry2_), so the clusters interacting with a point lie in its own cell or the adjacent ones.
+// Dimensions above 3 use a single cell.
+template <typename Scalar>
+struct ClusterGridT {
+    Scalar cell_size_;
+    VectorT<Scalar> origin_;
+    VectorXi dims_;
+    // Clusters of the cell c are cell_clusters_[cell_offsets_[c]:cell_offsets_[c + 1]].
+    VectorXi cell_offsets_;
+    VectorXi cell_clusters_;
+};
 
-   private:
-    const Matrix source_;
-    const Float h_;
-    IfgtParameters params_;
-    ClusteringResult cluster_;
+// Source-side structures of the IFGT: clustering, truncation number and constant series.
+// They only depend on the source, the bandwidth and eps, so they can be reused for any target and weights.
+template <typename Scalar>
+struct IfgtPlanT {
+    Scalar h_;
+    Scalar eps_;
+    IfgtParametersT<Scalar> params_;
+    ClusteringResultT<Scalar> cluster_;
     Integer p_;
     Integer p_max_total_;
-    Vector constant_series_;
-    Vector ry2_;
+    VectorT<Scalar> constant_series_;
+    VectorT<Scalar> ry2_;
+    // Source indices sorted by cluster,
+    // the cluster j owns order_[cluster_offsets_[j]:cluster_offsets_[j + 1]].
+    VectorXi order_;
+    VectorXi cluster_offsets_;
+    ClusterGridT<Scalar> grid_;
+};
+typedef IfgtPlanT<Float> IfgtPlan;
+
+template <typename Scalar>
+IfgtPlanT<Scalar> computeIfgtPlan(const MatrixCRefT<Scalar>& source, Scalar h, Scalar eps);
+
+// Estimated number of operations per target point of the IFGT, without clustering the source.
+template <typename Scalar>
+Scalar estimateIfgtComplexity(const MatrixCRefT<Scalar>& source, Scalar h, Scalar eps);
+
+template <typename Scalar>
+class IfgtT {
+   public:
+    IfgtT(const MatrixCRefT<Scalar>& source, Scalar h, Scalar eps);
+    // Reuses the plan of another transform of the same source and bandwidth.
+    IfgtT(const MatrixCRefT<Scalar>& source, Scalar h, const IfgtPlanT<Scalar>& plan);
+    ~IfgtT();
+    VectorT<Scalar> compute(const MatrixCRefT<Scalar>& target, const VectorT<Scalar>& weights) const;
+    // Evaluates the k columns of weights (M x k) in one pass over the clusters, returns N x k.
+    MatrixT<Scalar> compute(const MatrixCRefT<Scalar>& target, const MatrixT<Scalar>& weights) const;
+    // Same, writes the N x k result into gmat.
+    void compute(const MatrixCRefT<Scalar>& target,
+                 const MatrixT<Scalar>& weights,
+                 MatrixRefT<Scalar> gmat) const;
+    const IfgtPlanT<Scalar>& plan() const { return plan_; }
+
+   private:
+
+    template <int Dim>
+    void computeImpl(const MatrixCRefT<Scalar>& target,
+                     const MatrixT<Scalar>& weights,
+                     MatrixRefT<Scalar> gmat) const;
+
+    const Scalar h_;
+    const IfgtPlanT<Scalar> plan_;
+    const RowMatrixT<Scalar> sorted_source_;  // source points in the order of plan_.order_.
 };
+typedef IfgtT<Float> Ifgt;
 
 }  // namespace probreg
 
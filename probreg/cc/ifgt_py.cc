@@ -1,19 +1,58 @@
 #include <pybind11/eigen.h>
 #include <pybind11/pybind11.h>
+#include "direct_gauss_transform.h"
 #include "ifgt.h"
 
 namespace py = pybind11;
 using namespace probreg;
 
-PYBIND11_MODULE(_ifgt, m) {
-    Eigen::initParallel();
+namespace {
+
+// The transforms are dispatched on the dtype of the source, their float64 classes end with 64.
+template <typename Scalar>
+void defGaussTransform(py::module& m, const std::string& suffix) {
+    typedef MatrixCRefT<Scalar> CRef;
+    typedef IfgtPlanT<Scalar> Plan;
+    py::class_<Plan>(m, ("IfgtPlan" + suffix).c_str())
+        .def_readonly("h", &Plan::h_)
+        .def_readonly("eps", &Plan::eps_)
+        .def_property_readonly("num_clusters", [](const Plan& p) { return p.params_.num_clusters_; })
+        .def_property_readonly("truncation_number", [](const Plan& p) { return p.p_; })
+        .def_property_readonly("cutoff_radius", [](const Plan& p) { return p.params_.cutoff_radius_; })
+        .def_property_readonly("max_cluster_radius",
+                               [](const Plan& p) { return p.cluster_.max_cluster_radius_; })
+        .def_property_readonly("complexity", [](const Plan& p) { return p.params_.complexity_; });
+
+    typedef IfgtT<Scalar> IfgtS;
+    py::class_<IfgtS>(m, ("Ifgt" + suffix).c_str())
+        .def(py::init<const CRef&, Scalar, Scalar>())
+        .def(py::init<const CRef&, Scalar, const Plan&>())
+        .def_property_readonly("plan", &IfgtS::plan)
+        .def("compute", py::overload_cast<const CRef&, const VectorT<Scalar>&>(&IfgtS::compute, py::const_))
+        .def("compute", py::overload_cast<const CRef&, const MatrixT<Scalar>&>(&IfgtS::compute, py::const_));
+
+    typedef DirectGaussTransformT<Scalar> Direct;
+    py::class_<Direct>(m, ("DirectGaussTransform" + suffix).c_str())
+        .def(py::init<const CRef&, Scalar, Scalar>(), py::arg("source"), py::arg("h"),
+             py::arg("cutoff_radius") = 0.0)
+        .def("compute", py::overload_cast<const CRef&, const VectorT<Scalar>&>(&Direct::compute, py::const_))
+        .def("compute", py::overload_cast<const CRef&, const MatrixT<Scalar>&>(&Direct::compute, py::const_));
 
-    py::class_<Ifgt>(m, "Ifgt").def(py::init<Matrix, Float, Float>()).def("compute", &Ifgt::compute);
+    m.def("estimate_ifgt_complexity", &estimateIfgtComplexity<Scalar>);
 
-    m.def("_kcenter_clustering", [](const Matrix& data, Integer num_clusters) {
-        auto res = computeKCenterClustering(data, num_clusters, 1.0e-4);
+    m.def("_kcenter_clustering", [](const CRef& data, Integer num_clusters) {
+        auto res = computeKCenterClustering<Scalar>(data, num_clusters, 1.0e-4);
         return res.cluster_index_;
     });
+}
+
+}  // namespace
+
+PYBIND11_MODULE(_ifgt, m) {
+    Eigen::initParallel();
+
+    defGaussTransform<float>(m, "");
+    defGaussTransform<double>(m, "64");
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
@@ -1,49 +1,180 @@
 #include "kabsch.h"
 #include <Eigen/Dense>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace probreg;
 
-KabschResult probreg::computeKabsch(const MatrixX3& model,
-                                    const MatrixX3& target,
-                                    const Vector& weight) {
+namespace {
+
+// Solves the rows [begin, begin + n) with the centered points stored in the buffers,
+// the moments are column-wise dot products summed by blocks in Accum. The weighted sum of the squared
+// residuals goes to residual.
+template <typename Scalar, typename Accum, typename Points, typename Weights>
+KabschResultT<Scalar> solveKabsch(const Points& model,
+                                  const Points& target,
+                                  const Weights& weight,
+                                  Integer begin,
+                                  Integer n,
+                                  MatrixX3T<Scalar>& model_buffer,
+                                  MatrixX3T<Scalar>& target_buffer,
+                                  Scalar& residual) {
+    typedef Matrix3T<Accum> Matrix3A;
+    typedef Vector3T<Accum> Vector3A;
+    residual = 0.0;
+    const auto w = weight.segment(begin, n);
+    Accum total_weight = 0.0, h_weight = 0.0;
+    Vector3A model_sum = Vector3A::Zero(), target_sum = Vector3A::Zero();
+    for (Integer b = 0; b < n; b += accumulation_block_size) {
+        const Integer nb = std::min(accumulation_block_size, n - b);
+        const auto wb = w.segment(b, nb);
+        total_weight += wb.sum();
+        h_weight += wb.squaredNorm();
+        model_sum += (wb.transpose() * model.middleRows(begin + b, nb)).transpose().template cast<Accum>();
+        target_sum += (wb.transpose() * target.middleRows(begin + b, nb)).transpose().template cast<Accum>();
+    }
+    if (!(total_weight > 0.0)) {
+        return std::make_pair(Matrix3T<Scalar>::Identity(), Vector3T<Scalar>::Zero());
+    }
+
     //Compute the center
-    Vector3 model_center = Vector3::Zero();
-    Vector3 target_center = Vector3::Zero();
-    Float total_weight = 0.0f;
-    for(auto i = 0; i < model.rows(); ++i) {
-        const Float w_i = weight[i];
-        total_weight += w_i;
-        model_center.noalias() += w_i * model.row(i);
-        target_center.noalias() += w_i * target.row(i);
-    }
-    Float divided_by = 1.0f / total_weight;
-    model_center *= divided_by;
-    target_center *= divided_by;
+    const Vector3A model_center = model_sum / total_weight;
+    const Vector3A target_center = target_sum / total_weight;
 
     //Centralize them
+    if (model_buffer.rows() < n) {
+        model_buffer.resize(n, 3);
+        target_buffer.resize(n, 3);
+    }
+    auto centralized_model = model_buffer.topRows(n);
+    auto centralized_target = target_buffer.topRows(n);
+    centralized_model =
+        model.middleRows(begin, n).rowwise() - model_center.transpose().template cast<Scalar>();
+    centralized_target =
+        target.middleRows(begin, n).rowwise() - target_center.transpose().template cast<Scalar>();
+
     //Compute the H matrix
-    Float h_weight = 0.0f;
-    Matrix3 hh = Matrix3::Zero();
-    for(auto k = 0; k < model.rows(); ++k) {
-        const auto& model_k = model.row(k).transpose();
-        auto centralized_model_k = model_k - model_center;
-        const auto& target_k = target.row(k).transpose();
-        auto centralized_target_k = target_k - target_center;
-        const Float this_weight = weight[k];
-        h_weight += this_weight * this_weight;
-        hh.noalias() += (this_weight * this_weight) * centralized_model_k * centralized_target_k.transpose();
+    Matrix3A hh = Matrix3A::Zero();
+    for (Integer b = 0; b < n; b += accumulation_block_size) {
+        const Integer nb = std::min(accumulation_block_size, n - b);
+        const Matrix3T<Scalar> hb = (centralized_model.middleRows(b, nb).transpose() *
+                                     w.segment(b, nb).cwiseAbs2().asDiagonal())
+                                        .lazyProduct(centralized_target.middleRows(b, nb));
+        hh += hb.template cast<Accum>();
     }
 
     //Do svd
     hh /= h_weight;
-    Eigen::JacobiSVD<Matrix3> svd(hh, Eigen::ComputeFullU | Eigen::ComputeFullV);
-    Vector3 ss = Vector3::Ones(3);
+    Eigen::JacobiSVD<Matrix3A> svd(hh, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Vector3A ss = Vector3A::Ones(3);
     ss[2] = (svd.matrixU() * svd.matrixV()).determinant();
-    const Matrix3 r = svd.matrixV() * ss.asDiagonal() * svd.matrixU().transpose();
+    const Matrix3A r = svd.matrixV() * ss.asDiagonal() * svd.matrixU().transpose();
 
     //The translation
-    Vector3 translation = target_center;
+    Vector3A translation = target_center;
     translation.noalias() -= r * model_center;
 
-    return std::make_pair(r, translation);
-}
\ No newline at end of file
+    // R m + t - t' = R (m - model_center) - (t' - target_center)
+    const Matrix3T<Scalar> rs = r.template cast<Scalar>();
+    Accum residual_sum = 0.0;
+    for (Integer i = 0; i < n; ++i) {
+        const Vector3T<Scalar> d =
+            rs * centralized_model.row(i).transpose() - centralized_target.row(i).transpose();
+        residual_sum += w[i] * d.squaredNorm();
+    }
+    residual = residual_sum;
+    return std::make_pair(rs, translation.template cast<Scalar>());
+}
+
+template <typename Scalar, typename Accum, typename Points, typename Weights>
+void solveKabschBatch(const Points& model,
+                      const Points& target,
+                      const Weights& weight,
+                      const VectorXi& offsets,
+                      KabschBatchResultT<Scalar>& res) {
+    const Integer n_problems = offsets.size() - 1;
+    #pragma omp parallel
+    {
+        MatrixX3T<Scalar> model_buffer, target_buffer;
+        #pragma omp for schedule(dynamic, 64)
+        for (Integer p = 0; p < n_problems; ++p) {
+            const Integer begin = offsets[p], n = offsets[p + 1] - offsets[p];
+            const KabschResultT<Scalar> rt = solveKabsch<Scalar, Accum>(
+                model, target, weight, begin, n, model_buffer, target_buffer, res.residuals_[p]);
+            res.rotations_[p] = rt.first;
+            res.translations_.row(p) = rt.second.transpose();
+        }
+    }
+}
+
+template <typename Scalar>
+bool allContiguous(const MatrixX3CRefT<Scalar>& model,
+                   const MatrixX3CRefT<Scalar>& target,
+                   const VectorCRefT<Scalar>& weight) {
+    return hasContiguousColumns(model) && hasContiguousColumns(target) && hasContiguousColumns(weight);
+}
+
+}  // namespace
+
+template <typename Scalar, typename Accum>
+KabschResultT<Scalar> probreg::computeKabsch(const MatrixX3CRefT<Scalar>& model,
+                                             const MatrixX3CRefT<Scalar>& target,
+                                             const VectorCRefT<Scalar>& weight) {
+    MatrixX3T<Scalar> model_buffer, target_buffer;
+    Scalar residual;
+    if (allContiguous(model, target, weight)) {
+        return solveKabsch<Scalar, Accum>(mapColumns(model), mapColumns(target), mapColumns(weight), 0,
+                                          model.rows(), model_buffer, target_buffer, residual);
+    }
+    return solveKabsch<Scalar, Accum>(model, target, weight, 0, model.rows(), model_buffer, target_buffer,
+                                      residual);
+}
+
+template <typename Scalar, typename Accum>
+KabschBatchResultT<Scalar> probreg::computeKabschBatch(const MatrixX3CRefT<Scalar>& model,
+                                                       const MatrixX3CRefT<Scalar>& target,
+                                                       const VectorCRefT<Scalar>& weight,
+                                                       const VectorXi& offsets) {
+    if (target.rows() != model.rows() || weight.size() != model.rows()) {
+        throw std::invalid_argument("The sizes of model, target and weight do not match.");
+    }
+    if (offsets.size() == 0 || offsets[0] != 0 || offsets[offsets.size() - 1] != model.rows() ||
+        ((offsets.tail(offsets.size() - 1) - offsets.head(offsets.size() - 1)).array() < 0).any()) {
+        throw std::invalid_argument("The offsets must increase from 0 to the number of points.");
+    }
+    const Integer n_problems = offsets.size() - 1;
+    KabschBatchResultT<Scalar> res;
+    res.rotations_.resize(n_problems);
+    res.translations_.resize(n_problems, 3);
+    res.residuals_.resize(n_problems);
+    if (allContiguous(model, target, weight)) {
+        solveKabschBatch<Scalar, Accum>(mapColumns(model), mapColumns(target), mapColumns(weight), offsets,
+                                        res);
+    } else {
+        solveKabschBatch<Scalar, Accum>(model, target, weight, offsets, res);
+    }
+    return res;
+}
+
+template KabschResultT<float> probreg::computeKabsch<float, float>(const MatrixX3CRefT<float>&,
+                                                                   const MatrixX3CRefT<float>&,
+                                                                   const VectorCRefT<float>&);
+template KabschResultT<float> probreg::computeKabsch<float, double>(const MatrixX3CRefT<float>&,
+                                                                    const MatrixX3CRefT<float>&,
+                                                                    const VectorCRefT<float>&);
+template KabschResultT<double> probreg::computeKabsch<double, double>(const MatrixX3CRefT<double>&,
+                                                                      const MatrixX3CRefT<double>&,
+                                                                      const VectorCRefT<double>&);
+template KabschBatchResultT<float> probreg::computeKabschBatch<float, float>(const MatrixX3CRefT<float>&,
+                                                                             const MatrixX3CRefT<float>&,
+                                                                             const VectorCRefT<float>&,
+                                                                             const VectorXi&);
+template KabschBatchResultT<float> probreg::computeKabschBatch<float, double>(const MatrixX3CRefT<float>&,
+                                                                              const MatrixX3CRefT<float>&,
+                                                                              const VectorCRefT<float>&,
+                                                                              const VectorXi&);
+template KabschBatchResultT<double> probreg::computeKabschBatch<double, double>(
+    const MatrixX3CRefT<double>&,
+    const MatrixX3CRefT<double>&,
+    const VectorCRefT<double>&,
+    const VectorXi&);
@@ -3,15 +3,36 @@
 
 #include "types.h"
 #include <utility>
+#include <vector>
 
 namespace probreg {
 
-typedef std::pair<Matrix3, Vector3> KabschResult;
+template <typename Scalar>
+using KabschResultT = std::pair<Matrix3T<Scalar>, Vector3T<Scalar>>;
+typedef KabschResultT<Float> KabschResult;
 
-KabschResult computeKabsch(const MatrixX3& model,
-                           const MatrixX3& target,
-                           const Vector& weight);
+// The centers and the H matrix are summed in Accum, double sums of float points with Accum = double.
+template <typename Scalar, typename Accum = Scalar>
+KabschResultT<Scalar> computeKabsch(const MatrixX3CRefT<Scalar>& model,
+                                    const MatrixX3CRefT<Scalar>& target,
+                                    const VectorCRefT<Scalar>& weight);
+
+template <typename Scalar>
+struct KabschBatchResultT {
+    std::vector<Matrix3T<Scalar>> rotations_;
+    MatrixX3T<Scalar> translations_;
+    VectorT<Scalar> residuals_;  // sum of w_i |R m_i + t - t_i|^2 of each problem.
+};
+typedef KabschBatchResultT<Float> KabschBatchResult;
+
+// Independent problems packed in the same arrays: problem p is made of the rows [offsets[p], offsets[p + 1])
+// of model, target and weight. The problems are solved in parallel, the ones without weight give the identity.
+template <typename Scalar, typename Accum = Scalar>
+KabschBatchResultT<Scalar> computeKabschBatch(const MatrixX3CRefT<Scalar>& model,
+                                              const MatrixX3CRefT<Scalar>& target,
+                                              const VectorCRefT<Scalar>& weight,
+                                              const VectorXi& offsets);
 
 }  // namespace probreg
 
-#endif
\ No newline at end of file
+#endif
@@ -1,13 +1,55 @@
 #include "kabsch.h"
 #include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <Eigen/Geometry>
 
 using namespace probreg;
 namespace py = pybind11;
 
+namespace {
+
+// The overloads are dispatched on the dtype of the points, float32 arrays can be summed in double with
+// mixed_precision. The offsets are converted whatever their integer type, so that they do not take part in
+// the dispatch.
+template <typename Scalar>
+void defKabsch(py::module& m) {
+    m.def(
+        "kabsch",
+        [](const MatrixX3CRefT<Scalar>& model, const MatrixX3CRefT<Scalar>& target,
+           const VectorCRefT<Scalar>& weight, bool mixed_precision) {
+            return mixed_precision ? computeKabsch<Scalar, double>(model, target, weight)
+                                   : computeKabsch<Scalar>(model, target, weight);
+        },
+        py::arg("model"), py::arg("target"), py::arg("weight"), py::arg("mixed_precision") = false);
+    // Returns the rotations (P x 3 x 3), translations (P x 3) and residuals (P) of the problems.
+    m.def(
+        "kabsch_batch",
+        [](const MatrixX3CRefT<Scalar>& model, const MatrixX3CRefT<Scalar>& target,
+           const VectorCRefT<Scalar>& weight, py::object offsets, bool mixed_precision) {
+            const VectorXi offsets_i = offsets.cast<VectorXi>();
+            KabschBatchResultT<Scalar> res =
+                mixed_precision ? computeKabschBatch<Scalar, double>(model, target, weight, offsets_i)
+                                : computeKabschBatch<Scalar>(model, target, weight, offsets_i);
+            const py::ssize_t n_problems = res.rotations_.size();
+            py::array_t<Scalar> rotations({n_problems, py::ssize_t(3), py::ssize_t(3)});
+            auto r = rotations.template mutable_unchecked<3>();
+            for (py::ssize_t p = 0; p < n_problems; ++p) {
+                for (py::ssize_t i = 0; i < 3; ++i) {
+                    for (py::ssize_t j = 0; j < 3; ++j) r(p, i, j) = res.rotations_[p](i, j);
+                }
+            }
+            return py::make_tuple(rotations, res.translations_, res.residuals_);
+        },
+        py::arg("model"), py::arg("target"), py::arg("weight"), py::arg("offsets"),
+        py::arg("mixed_precision") = false);
+}
+
+}  // namespace
+
 PYBIND11_MODULE(_kabsch, m) {
-    m.def("kabsch", &computeKabsch);
+    defKabsch<float>(m);
+    defKabsch<double>(m);
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
@@ -1,24 +1,69 @@
 #include "kcenter_clustering.h"
 #include <limits>
+#include <vector>
+#include "chunks.h"
 
 using namespace probreg;
 
-ClusteringResult probreg::computeKCenterClustering(const Matrix& data,
-                                                   Integer num_clusters,
-                                                   Float eps,
-                                                   Integer num_max_iteration) {
-    auto idxs = (num_clusters * Vector::Random(num_clusters)).array().abs().cast<Integer>();
-    Matrix cluster_centers = data(idxs, Eigen::all);
-    Matrix temp_centers(num_clusters, data.cols());
+namespace {
+
+// Farthest point (Gonzalez) initialization. Starting from the first point, each new center is the point
+// farthest from the centers chosen so far, ties going to the smallest index.
+template <typename Scalar>
+MatrixT<Scalar> computeFarthestPointCenters(const MatrixCRefT<Scalar>& data, Integer num_clusters) {
+    const Integer n = data.rows();
+    const Integer n_chunks = numChunks(n);
+    MatrixT<Scalar> cluster_centers(num_clusters, data.cols());
+    VectorT<Scalar> min_distances = VectorT<Scalar>::Constant(n, std::numeric_limits<Scalar>::max());
+    std::vector<Scalar> max_distances(n_chunks);
+    std::vector<Integer> farthest(n_chunks);
+    Integer next = 0;
+    for (Integer k = 0; k < num_clusters; ++k) {
+        cluster_centers.row(k) = data.row(next);
+        #pragma omp parallel for schedule(static)
+        for (Integer c = 0; c < n_chunks; ++c) {
+            max_distances[c] = -1.0;
+            farthest[c] = 0;
+            const Integer ie = chunkBegin(c + 1, n_chunks, n);
+            for (Integer i = chunkBegin(c, n_chunks, n); i < ie; ++i) {
+                const Scalar distance = (data.row(i) - cluster_centers.row(k)).squaredNorm();
+                min_distances[i] = std::min(min_distances[i], distance);
+                if (min_distances[i] > max_distances[c]) {
+                    max_distances[c] = min_distances[i];
+                    farthest[c] = i;
+                }
+            }
+        }
+        Scalar max_distance = -1.0;
+        for (Integer c = 0; c < n_chunks; ++c) {
+            if (max_distances[c] > max_distance) {
+                max_distance = max_distances[c];
+                next = farthest[c];
+            }
+        }
+    }
+    return cluster_centers;
+}
+
+}  // namespace
+
+template <typename Scalar>
+ClusteringResultT<Scalar> probreg::computeKCenterClustering(const MatrixCRefT<Scalar>& data,
+                                                            Integer num_clusters,
+                                                            Scalar eps,
+                                                            Integer num_max_iteration) {
+    MatrixT<Scalar> cluster_centers = computeFarthestPointCenters(data, num_clusters);
+    MatrixT<Scalar> temp_centers(num_clusters, data.cols());
     VectorXi counts(num_clusters);
     VectorXi labels(data.rows());
-    Float p_err = 0.0;
+    Scalar p_err = 0.0;
 
     for (Integer n = 0; n < num_max_iteration; ++n) {
         counts.setZero();
         temp_centers.setZero();
-        const Float err = updateClustering(data, cluster_centers, labels, counts, temp_centers);
-        auto den = (counts.array() == 0).select(1, counts).replicate(1, data.cols()).array().cast<Float>();
+        const Scalar err = updateClustering(data, cluster_centers, labels, counts, temp_centers);
+        auto den =
+            (counts.array() == 0).select(1, counts).replicate(1, data.cols()).array().template cast<Scalar>();
         cluster_centers.noalias() = (temp_centers.array() / den).matrix();
         if (std::abs(err - p_err) < eps) break;
         p_err = err;
@@ -28,34 +73,81 @@ ClusteringResult probreg::computeKCenterClustering(const Matrix& data,
     return {radii.maxCoeff(), labels, cluster_centers, radii};
 }
 
-Float probreg::updateClustering(const Matrix& data,
-                                const Matrix& cluster_centers,
-                                VectorXi& labels,
-                                VectorXi& counts,
-                                Matrix& sum_members) {
-    Float err = 0.0;
-    #pragma omp parallel for
-    for (Integer i = 0; i < data.rows(); ++i) {
-        Float min_distance =
-            (cluster_centers.rowwise() - data.row(i)).rowwise().squaredNorm().minCoeff(&labels[i]);
-        #pragma omp critical
-        {
-            sum_members.row(labels[i]) += data.row(i);
-            ++counts[labels[i]];
-            err += min_distance;
+template <typename Scalar>
+Scalar probreg::updateClustering(const MatrixCRefT<Scalar>& data,
+                                 const MatrixT<Scalar>& cluster_centers,
+                                 VectorXi& labels,
+                                 VectorXi& counts,
+                                 MatrixT<Scalar>& sum_members) {
+    // Each chunk accumulates its own sums, they are merged once in chunk order.
+    const Integer n = data.rows();
+    const Integer num_clusters = cluster_centers.rows();
+    const Integer n_chunks = numChunks(n);
+    std::vector<MatrixT<Scalar>> partial_sums(n_chunks);
+    std::vector<VectorXi> partial_counts(n_chunks);
+    std::vector<double> partial_errs(n_chunks, 0.0);
+
+    #pragma omp parallel for schedule(static)
+    for (Integer c = 0; c < n_chunks; ++c) {
+        partial_sums[c].setZero(num_clusters, data.cols());
+        partial_counts[c].setZero(num_clusters);
+        VectorT<Scalar> distances(num_clusters);
+        const Integer ie = chunkBegin(c + 1, n_chunks, n);
+        for (Integer i = chunkBegin(c, n_chunks, n); i < ie; ++i) {
+            Integer label;
+            distances.noalias() = (cluster_centers.rowwise() - data.row(i)).rowwise().squaredNorm();
+            const Scalar min_distance = distances.minCoeff(&label);
+            labels[i] = label;
+            partial_sums[c].row(label) += data.row(i);
+            ++partial_counts[c][label];
+            partial_errs[c] += min_distance;
         }
     }
+    double err = 0.0;
+    for (Integer c = 0; c < n_chunks; ++c) {
+        sum_members += partial_sums[c];
+        counts += partial_counts[c];
+        err += partial_errs[c];
+    }
     return err;
 }
 
-Vector probreg::calcRadii(const Matrix& data,
-                          const Matrix& cluster_centers,
-                          const VectorXi& labels,
-                          Integer num_clusters) {
-    const Vector distances = (data - cluster_centers(labels.array(), Eigen::all)).rowwise().norm();
-    Vector radii = Vector::Zero(num_clusters);
+template <typename Scalar>
+VectorT<Scalar> probreg::calcRadii(const MatrixCRefT<Scalar>& data,
+                                   const MatrixT<Scalar>& cluster_centers,
+                                   const VectorXi& labels,
+                                   Integer num_clusters) {
+    const VectorT<Scalar> distances = (data - cluster_centers(labels.array(), Eigen::all)).rowwise().norm();
+    VectorT<Scalar> radii = VectorT<Scalar>::Zero(num_clusters);
     for (Integer i = 0; i < data.rows(); ++i) {
         radii[labels[i]] = std::max(radii[labels[i]], distances[i]);
     }
     return radii;
-}
\ No newline at end of file
+}
+
+template ClusteringResultT<float> probreg::computeKCenterClustering(const MatrixCRefT<float>&,
+                                                                   Integer,
+                                                                   float,
+                                                                   Integer);
+template ClusteringResultT<double> probreg::computeKCenterClustering(const MatrixCRefT<double>&,
+                                                                    Integer,
+                                                                    double,
+                                                                    Integer);
+template float probreg::updateClustering(const MatrixCRefT<float>&,
+                                         const MatrixT<float>&,
+                                         VectorXi&,
+                                         VectorXi&,
+                                         MatrixT<float>&);
+template double probreg::updateClustering(const MatrixCRefT<double>&,
+                                          const MatrixT<double>&,
+                                          VectorXi&,
+                                          VectorXi&,
+                                          MatrixT<double>&);
+template VectorT<float> probreg::calcRadii(const MatrixCRefT<float>&,
+                                           const MatrixT<float>&,
+                                           const VectorXi&,
+                                           Integer);
+template VectorT<double> probreg::calcRadii(const MatrixCRefT<double>&,
+                                            const MatrixT<double>&,
+                                            const VectorXi&,
+                                            Integer);
\ No newline at end of file
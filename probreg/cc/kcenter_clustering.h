@@ -5,28 +5,33 @@
 
 namespace probreg {
 
-struct ClusteringResult {
-    Float max_cluster_radius_;
+template <typename Scalar>
+struct ClusteringResultT {
+    Scalar max_cluster_radius_;
     VectorXi cluster_index_;
-    Matrix cluster_centers_;
-    Vector cluster_radii_;
+    MatrixT<Scalar> cluster_centers_;
+    VectorT<Scalar> cluster_radii_;
 };
-
-ClusteringResult computeKCenterClustering(const Matrix& data,
-                                          Integer num_clusters,
-                                          Float eps,
-                                          Integer num_max_iteration = 100);
-
-Float updateClustering(const Matrix& data,
-                       const Matrix& cluster_centers,
-                       VectorXi& labels,
-                       VectorXi& counts,
-                       Matrix& sum_menbers);
-
-Vector calcRadii(const Matrix& data,
-                 const Matrix& cluster_centers,
-                 const VectorXi& labels,
-                 Integer num_clusters);
+typedef ClusteringResultT<Float> ClusteringResult;
+
+template <typename Scalar>
+ClusteringResultT<Scalar> computeKCenterClustering(const MatrixCRefT<Scalar>& data,
+                                                   Integer num_clusters,
+                                                   Scalar eps,
+                                                   Integer num_max_iteration = 100);
+
+template <typename Scalar>
+Scalar updateClustering(const MatrixCRefT<Scalar>& data,
+                        const MatrixT<Scalar>& cluster_centers,
+                        VectorXi& labels,
+                        VectorXi& counts,
+                        MatrixT<Scalar>& sum_menbers);
+
+template <typename Scalar>
+VectorT<Scalar> calcRadii(const MatrixCRefT<Scalar>& data,
+                          const MatrixT<Scalar>& cluster_centers,
+                          const VectorXi& labels,
+                          Integer num_clusters);
 
 }  // namespace probreg
 
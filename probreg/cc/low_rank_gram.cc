@@ -0,0 +1,67 @@
+#include "low_rank_gram.h"
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
+#include <stdexcept>
+#include "kcenter_clustering.h"
+#include "math_utils.h"
+
+using namespace probreg;
+
+namespace {
+
+static const Integer num_clustering_iterations = 10;
+// Eigenvalues of the landmark kernel below this fraction of the largest are dropped, their directions are
+// below float precision.
+static const double min_relative_eigenvalue = 1.0e-6;
+
+}  // namespace
+
+LowRankGram::LowRankGram(const MatrixCRef& points, Float beta, Integer rank) {
+    if (beta <= 0.0) {
+        throw std::invalid_argument("Beta must be positive.");
+    }
+    if (rank <= 0) {
+        throw std::invalid_argument("The rank must be positive.");
+    }
+    if (points.rows() == 0) {
+        factor_.resize(0, 0);
+        return;
+    }
+    const Integer k = std::min(rank, Integer(points.rows()));
+    const Matrix landmarks =
+        computeKCenterClustering<Float>(points, k, 1.0e-4, num_clustering_iterations).cluster_centers_;
+    // G ~ C W^+ C^T with C = K(points, landmarks) and W = K(landmarks, landmarks) = V S V^T,
+    // U = C V S^(-1/2) on the eigenvalues kept.
+    const Matrix c = rbfKernel<Float>(points, landmarks, beta);
+    const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(
+        rbfKernel<Float>(landmarks, landmarks, beta).cast<double>());
+    const Eigen::VectorXd& s = es.eigenvalues();
+    Integer first = 0;
+    while (first < k && s[first] <= min_relative_eigenvalue * s[k - 1]) ++first;
+    const Eigen::MatrixXd v =
+        es.eigenvectors().rightCols(k - first) * s.tail(k - first).cwiseSqrt().cwiseInverse().asDiagonal();
+    factor_.noalias() = c * v.cast<Float>();
+}
+
+Matrix LowRankGram::multiply(const Matrix& w) const {
+    if (w.rows() != factor_.rows()) {
+        throw std::invalid_argument("The number of rows of w does not match the Gram matrix.");
+    }
+    const Matrix uw = factor_.transpose() * w;
+    return factor_ * uw;
+}
+
+Matrix LowRankGram::solve(const Vector& p1, const Matrix& rhs, Float lambda) const {
+    if (p1.size() != factor_.rows() || rhs.rows() != factor_.rows()) {
+        throw std::invalid_argument("The sizes of p1 and rhs do not match the Gram matrix.");
+    }
+    if (lambda <= 0.0) {
+        throw std::invalid_argument("Lambda must be positive.");
+    }
+    // (lambda I + diag(p1) U U^T)^-1 = (I - diag(p1) U (lambda I + U^T diag(p1) U)^-1 U^T) / lambda
+    const Matrix pu = p1.asDiagonal() * factor_;
+    Eigen::MatrixXd inner = (factor_.transpose() * pu).cast<double>();
+    inner.diagonal().array() += lambda;
+    const Eigen::MatrixXd z = inner.llt().solve((factor_.transpose() * rhs).cast<double>());
+    return (rhs - pu * z.cast<Float>()) / lambda;
+}
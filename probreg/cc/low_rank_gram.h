@@ -0,0 +1,27 @@
+#ifndef __probreg_low_rank_gram_h__
+#define __probreg_low_rank_gram_h__
+
+#include "types.h"
+
+namespace probreg {
+
+// Nystrom approximation G ~ U U^T of the RBF Gram matrix G(i, j) = exp(-|x_i - x_j|^2 / (2 beta)) of M points,
+// with k-center cluster centers as landmarks. U is M x k, so the matrix is never stored and products and
+// regularized solves cost O(Mk) and O(Mk^2). A larger rank gives a more accurate approximation.
+class LowRankGram {
+   public:
+    LowRankGram(const MatrixCRef& points, Float beta, Integer rank);
+    // G w
+    Matrix multiply(const Matrix& w) const;
+    // Solution w of (diag(p1) G + lambda I) w = rhs, through the Woodbury identity.
+    Matrix solve(const Vector& p1, const Matrix& rhs, Float lambda) const;
+    Integer rank() const { return factor_.cols(); }
+    const Matrix& factor() const { return factor_; }
+
+   private:
+    Matrix factor_;
+};
+
+}  // namespace probreg
+
+#endif
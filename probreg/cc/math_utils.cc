@@ -1,30 +1,207 @@
 #include "math_utils.h"
+#include <stdexcept>
+#include <vector>
 
 using namespace probreg;
 
-Matrix probreg::kernelBase(const Matrix& x, const Matrix& y, const func_type& fn) {
-    Matrix k = Matrix::Zero(x.rows(), y.rows());
-    #pragma omp parallel for
-    for (Integer i = 0; i < y.rows(); ++i) {
-        auto diff2 = (x.rowwise() - y.row(i)).rowwise().squaredNorm();
-        k(Eigen::all, i) = fn(diff2);
+namespace {
+
+struct SquaredFn {
+    template <typename Array>
+    void operator()(Array&) const {}
+};
+
+template <typename Scalar>
+struct RbfFn {
+    Scalar scale;
+    template <typename Array>
+    void operator()(Array& d2) const {
+        d2 = (d2 * scale).exp();
+    }
+};
+
+// r^2 log(r) = d2 log(d2) / 2
+struct Tps2dFn {
+    template <typename Array>
+    void operator()(Array& d2) const {
+        typedef typename Array::Scalar Scalar;
+        static const Scalar eps = 1.0e-9;
+        d2 = (d2 > eps).select(Scalar(0.5) * d2 * d2.log(), Scalar(0.0));
+    }
+};
+
+struct Tps3dFn {
+    template <typename Array>
+    void operator()(Array& d2) const {
+        d2 = -d2.sqrt();
+    }
+};
+
+template <typename Scalar>
+void checkDimensions(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y) {
+    if (x.cols() != y.cols()) {
+        throw std::invalid_argument("The dimensions of x and y do not match.");
     }
+}
+
+template <typename Scalar, typename Fn>
+MatrixT<Scalar> kernel(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, const Fn& fn) {
+    checkDimensions(x, y);
+    MatrixT<Scalar> k(x.rows(), y.rows());
+    kernelBase<Scalar>(x, y, fn, k);
     return k;
 }
 
-Matrix probreg::squaredKernel(const Matrix& x, const Matrix& y) { return kernelBase(x, y); }
+// The transpose of a row-major out is the column-major kernel of y and x, the functions are symmetric.
+template <typename Scalar, typename Fn>
+void kernel(const MatrixCRefT<Scalar>& x,
+            const MatrixCRefT<Scalar>& y,
+            const Fn& fn,
+            RowMatrixRefT<Scalar> out) {
+    checkDimensions(x, y);
+    if (out.rows() != x.rows() || out.cols() != y.rows()) {
+        throw std::invalid_argument("The shape of out does not match x and y.");
+    }
+    kernelBase<Scalar>(y, x, fn, out.transpose());
+}
+
+template <typename Scalar>
+RbfFn<Scalar> rbfFn(Scalar beta) {
+    return RbfFn<Scalar>{Scalar(-1.0 / (2.0 * beta))};
+}
+
+}  // namespace
+
+template <typename Scalar>
+MatrixT<Scalar> probreg::squaredKernel(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y) {
+    return kernel(x, y, SquaredFn());
+}
+
+template <typename Scalar>
+void probreg::squaredKernel(const MatrixCRefT<Scalar>& x,
+                            const MatrixCRefT<Scalar>& y,
+                            RowMatrixRefT<Scalar> out) {
+    kernel(x, y, SquaredFn(), out);
+}
+
+template <typename Scalar>
+Scalar probreg::squaredKernelSum(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, bool exact) {
+    checkDimensions(x, y);
+    const Integer n = x.rows(), m = y.rows();
+    if (n == 0 || m == 0) return 0.0;
+    if (exact) {
+        MatrixT<Scalar> x_buffer;
+        const MatrixCMapT<Scalar> xc = contiguousColumns(x, x_buffer);
+        // Partial sums of the column tiles are added in order, the result does not depend on the number of threads
+        const Integer n_col_tiles = (m + kernel_col_tile_size - 1) / kernel_col_tile_size;
+        std::vector<double> partial(n_col_tiles, 0.0);
+        #pragma omp parallel
+        {
+            VectorT<Scalar> d2(kernel_row_tile_size);
+            #pragma omp for schedule(static)
+            for (Integer ct = 0; ct < n_col_tiles; ++ct) {
+                const Integer cb = ct * kernel_col_tile_size;
+                const Integer ce = std::min(m, cb + kernel_col_tile_size);
+                for (Integer rb = 0; rb < n; rb += kernel_row_tile_size) {
+                    const Integer nr = std::min(kernel_row_tile_size, n - rb);
+                    auto d = d2.head(nr).array();
+                    for (Integer j = cb; j < ce; ++j) {
+                        d.setZero();
+                        for (Integer l = 0; l < x.cols(); ++l) {
+                            d += (xc.col(l).segment(rb, nr).array() - y(j, l)).square();
+                        }
+                        partial[ct] += d.sum();
+                    }
+                }
+            }
+        }
+        double sum = 0.0;
+        for (double p : partial) sum += p;
+        return sum;
+    }
+    // sum_ij |x_i - y_j|^2 = M sum_i |x_i - c|^2 + N sum_j |y_j - c|^2 - 2 sum_i (x_i - c).sum_j (y_j - c),
+    // the last term vanishes with c the mean of y and the others are sums of positive terms.
+    double sx = 0.0, sy = 0.0;
+    for (Integer l = 0; l < x.cols(); ++l) {
+        double c = 0.0;
+        for (Integer j = 0; j < m; ++j) c += y(j, l);
+        c /= m;
+        for (Integer i = 0; i < n; ++i) sx += (x(i, l) - c) * (x(i, l) - c);
+        for (Integer j = 0; j < m; ++j) sy += (y(j, l) - c) * (y(j, l) - c);
+    }
+    return m * sx + n * sy;
+}
+
+template <typename Scalar>
+MatrixT<Scalar> probreg::rbfKernel(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, Scalar beta) {
+    return kernel(x, y, rbfFn(beta));
+}
+
+template <typename Scalar>
+void probreg::rbfKernel(const MatrixCRefT<Scalar>& x,
+                        const MatrixCRefT<Scalar>& y,
+                        Scalar beta,
+                        RowMatrixRefT<Scalar> out) {
+    kernel(x, y, rbfFn(beta), out);
+}
+
+template <typename Scalar>
+MatrixT<Scalar> probreg::tpsKernel2d(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y) {
+    return kernel(x, y, Tps2dFn());
+}
+
+template <typename Scalar>
+void probreg::tpsKernel2d(const MatrixCRefT<Scalar>& x,
+                          const MatrixCRefT<Scalar>& y,
+                          RowMatrixRefT<Scalar> out) {
+    kernel(x, y, Tps2dFn(), out);
+}
 
-Matrix probreg::rbfKernel(const Matrix& x, const Matrix& y, Float beta) {
-    return kernelBase(x, y, [&beta](const Vector& diff2) { return (-diff2 / (2.0 * beta)).array().exp(); });
+template <typename Scalar>
+MatrixT<Scalar> probreg::tpsKernel3d(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y) {
+    return kernel(x, y, Tps3dFn());
 }
 
-Matrix probreg::tpsKernel2d(const Matrix& x, const Matrix& y) {
-    static const Float eps = 1.0e-9;
-    return kernelBase(x, y, [](const Vector& diff2) {
-        return (diff2.array() > eps).select(diff2.array() * diff2.array().sqrt().log(), 0.0);
-    });
+template <typename Scalar>
+void probreg::tpsKernel3d(const MatrixCRefT<Scalar>& x,
+                          const MatrixCRefT<Scalar>& y,
+                          RowMatrixRefT<Scalar> out) {
+    kernel(x, y, Tps3dFn(), out);
 }
 
-Matrix probreg::tpsKernel3d(const Matrix& x, const Matrix& y) {
-    return kernelBase(x, y, [](const Vector& diff2) { return -diff2.array().sqrt(); });
-}
\ No newline at end of file
+template MatrixT<float> probreg::squaredKernel(const MatrixCRefT<float>&, const MatrixCRefT<float>&);
+template void probreg::squaredKernel(const MatrixCRefT<float>&,
+                                     const MatrixCRefT<float>&,
+                                     RowMatrixRefT<float>);
+template float probreg::squaredKernelSum(const MatrixCRefT<float>&, const MatrixCRefT<float>&, bool);
+template MatrixT<float> probreg::rbfKernel(const MatrixCRefT<float>&, const MatrixCRefT<float>&, float);
+template void probreg::rbfKernel(const MatrixCRefT<float>&,
+                                 const MatrixCRefT<float>&,
+                                 float,
+                                 RowMatrixRefT<float>);
+template MatrixT<float> probreg::tpsKernel2d(const MatrixCRefT<float>&, const MatrixCRefT<float>&);
+template void probreg::tpsKernel2d(const MatrixCRefT<float>&,
+                                   const MatrixCRefT<float>&,
+                                   RowMatrixRefT<float>);
+template MatrixT<float> probreg::tpsKernel3d(const MatrixCRefT<float>&, const MatrixCRefT<float>&);
+template void probreg::tpsKernel3d(const MatrixCRefT<float>&,
+                                   const MatrixCRefT<float>&,
+                                   RowMatrixRefT<float>);
+template MatrixT<double> probreg::squaredKernel(const MatrixCRefT<double>&, const MatrixCRefT<double>&);
+template void probreg::squaredKernel(const MatrixCRefT<double>&,
+                                     const MatrixCRefT<double>&,
+                                     RowMatrixRefT<double>);
+template double probreg::squaredKernelSum(const MatrixCRefT<double>&, const MatrixCRefT<double>&, bool);
+template MatrixT<double> probreg::rbfKernel(const MatrixCRefT<double>&, const MatrixCRefT<double>&, double);
+template void probreg::rbfKernel(const MatrixCRefT<double>&,
+                                 const MatrixCRefT<double>&,
+                                 double,
+                                 RowMatrixRefT<double>);
+template MatrixT<double> probreg::tpsKernel2d(const MatrixCRefT<double>&, const MatrixCRefT<double>&);
+template void probreg::tpsKernel2d(const MatrixCRefT<double>&,
+                                   const MatrixCRefT<double>&,
+                                   RowMatrixRefT<double>);
+template MatrixT<double> probreg::tpsKernel3d(const MatrixCRefT<double>&, const MatrixCRefT<double>&);
+template void probreg::tpsKernel3d(const MatrixCRefT<double>&,
+                                   const MatrixCRefT<double>&,
+                                   RowMatrixRefT<double>);
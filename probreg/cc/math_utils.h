@@ -1,24 +1,74 @@
 #ifndef __probreg_math_utils_h__
 #define __probreg_math_utils_h__
 
-#include <functional>
+#include <algorithm>
 #include "types.h"
 
 namespace probreg {
 
-typedef std::function<Vector(const Vector&)> func_type;
+static const Integer kernel_row_tile_size = 1024;
+static const Integer kernel_col_tile_size = 64;
 
-Matrix kernelBase(const Matrix& x, const Matrix& y, const func_type& fn = [](const Vector& diff2) {
-    return diff2;
-});
+// Kernel matrix K(i, j) = fn(|x_i - y_j|^2) of the rows of x and y, written to k (N x M).
+// The matrix is filled by tiles of rows and columns in parallel over the columns. fn is called in place on
+// the Eigen array of the squared distances of a tile column, so that it is inlined and vectorized.
+template <typename Scalar, typename Fn>
+void kernelBase(const MatrixCRefT<Scalar>& x,
+                const MatrixCRefT<Scalar>& y,
+                const Fn& fn,
+                Eigen::Ref<MatrixT<Scalar>> k) {
+    const Integer n = x.rows(), m = y.rows();
+    MatrixT<Scalar> x_buffer;
+    const MatrixCMapT<Scalar> xc = contiguousColumns(x, x_buffer);
+    const Integer n_col_tiles = (m + kernel_col_tile_size - 1) / kernel_col_tile_size;
+    #pragma omp parallel for schedule(static)
+    for (Integer ct = 0; ct < n_col_tiles; ++ct) {
+        const Integer cb = ct * kernel_col_tile_size;
+        const Integer ce = std::min(m, cb + kernel_col_tile_size);
+        for (Integer rb = 0; rb < n; rb += kernel_row_tile_size) {
+            const Integer nr = std::min(kernel_row_tile_size, n - rb);
+            for (Integer j = cb; j < ce; ++j) {
+                auto d2 = k.col(j).segment(rb, nr).array();
+                d2.setZero();
+                for (Integer l = 0; l < x.cols(); ++l) {
+                    d2 += (xc.col(l).segment(rb, nr).array() - y(j, l)).square();
+                }
+                fn(d2);
+            }
+        }
+    }
+}
 
-Matrix squaredKernel(const Matrix& x, const Matrix& y);
+template <typename Scalar>
+MatrixT<Scalar> squaredKernel(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y);
 
-Matrix rbfKernel(const Matrix& x, const Matrix& y, Float beta);
+// The kernels below can also be written to a caller-provided out (N x M), without allocating the matrix.
+template <typename Scalar>
+void squaredKernel(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, RowMatrixRefT<Scalar> out);
 
-Matrix tpsKernel2d(const Matrix& x, const Matrix& y);
+// Sum of |x_i - y_j|^2 over all the pairs of rows of x and y, without storing the kernel matrix.
+// The closed form only needs the second moments of x and y about the mean of y, in O(N + M).
+// exact sums every pair by tiles instead. Both sum in double.
+template <typename Scalar>
+Scalar squaredKernelSum(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, bool exact = false);
 
-Matrix tpsKernel3d(const Matrix& x, const Matrix& y);
+template <typename Scalar>
+MatrixT<Scalar> rbfKernel(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, Scalar beta);
+template <typename Scalar>
+void rbfKernel(const MatrixCRefT<Scalar>& x,
+               const MatrixCRefT<Scalar>& y,
+               Scalar beta,
+               RowMatrixRefT<Scalar> out);
+
+template <typename Scalar>
+MatrixT<Scalar> tpsKernel2d(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y);
+template <typename Scalar>
+void tpsKernel2d(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, RowMatrixRefT<Scalar> out);
+
+template <typename Scalar>
+MatrixT<Scalar> tpsKernel3d(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y);
+template <typename Scalar>
+void tpsKernel3d(const MatrixCRefT<Scalar>& x, const MatrixCRefT<Scalar>& y, RowMatrixRefT<Scalar> out);
 
 }  // namespace probreg
 
@@ -1,17 +1,53 @@
 #include <pybind11/eigen.h>
 #include <pybind11/pybind11.h>
+#include "low_rank_gram.h"
 #include "math_utils.h"
 
 namespace py = pybind11;
 using namespace probreg;
 
+namespace {
+
+// The kernels are dispatched on the dtype of x and y.
+template <typename Scalar>
+void defKernels(py::module& m) {
+    typedef MatrixCRefT<Scalar> CRef;
+    m.def("squared_kernel", py::overload_cast<const CRef&, const CRef&>(&squaredKernel<Scalar>));
+    m.def("squared_kernel_sum", &squaredKernelSum<Scalar>, py::arg("x"), py::arg("y"),
+          py::arg("exact") = false);
+    m.def("rbf_kernel", py::overload_cast<const CRef&, const CRef&, Scalar>(&rbfKernel<Scalar>));
+    m.def("tps_kernel_2d", py::overload_cast<const CRef&, const CRef&>(&tpsKernel2d<Scalar>));
+    m.def("tps_kernel_3d", py::overload_cast<const CRef&, const CRef&>(&tpsKernel3d<Scalar>));
+    // The kernels are written in place to out, a C-contiguous array of shape (N, M) and of the dtype of x.
+    m.def("squared_kernel",
+          py::overload_cast<const CRef&, const CRef&, RowMatrixRefT<Scalar>>(&squaredKernel<Scalar>),
+          py::arg("x"), py::arg("y"), py::arg("out").noconvert());
+    m.def("rbf_kernel",
+          py::overload_cast<const CRef&, const CRef&, Scalar, RowMatrixRefT<Scalar>>(&rbfKernel<Scalar>),
+          py::arg("x"), py::arg("y"), py::arg("beta"), py::arg("out").noconvert());
+    m.def("tps_kernel_2d",
+          py::overload_cast<const CRef&, const CRef&, RowMatrixRefT<Scalar>>(&tpsKernel2d<Scalar>),
+          py::arg("x"), py::arg("y"), py::arg("out").noconvert());
+    m.def("tps_kernel_3d",
+          py::overload_cast<const CRef&, const CRef&, RowMatrixRefT<Scalar>>(&tpsKernel3d<Scalar>),
+          py::arg("x"), py::arg("y"), py::arg("out").noconvert());
+}
+
+}  // namespace
+
 PYBIND11_MODULE(_math, m) {
     Eigen::initParallel();
 
-    m.def("squared_kernel", &squaredKernel);
-    m.def("rbf_kernel", &rbfKernel);
-    m.def("tps_kernel_2d", &tpsKernel2d);
-    m.def("tps_kernel_3d", &tpsKernel3d);
+    defKernels<float>(m);
+    defKernels<double>(m);
+
+    py::class_<LowRankGram>(m, "LowRankGram")
+        .def(py::init<const MatrixCRef&, Float, Integer>(), py::arg("points"), py::arg("beta"),
+             py::arg("rank"))
+        .def_property_readonly("rank", &LowRankGram::rank)
+        .def_property_readonly("factor", &LowRankGram::factor)
+        .def("multiply", &LowRankGram::multiply)
+        .def("solve", &LowRankGram::solve, py::arg("p1"), py::arg("rhs"), py::arg("lmd"));
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
@@ -1,5 +1,7 @@
 #include <pybind11/eigen.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "filterreg.h"
 #include "permutohedral.h"
 #include "permutohedral_preload_filter.h"
 #include "types.h"
@@ -7,6 +9,16 @@
 namespace py = pybind11;
 using namespace probreg;
 
+namespace {
+
+py::tuple estepTuple(const FilterRegEstepResult& res, bool compute_m2, bool with_normals) {
+    py::object m2 = compute_m2 ? py::cast(res.m2_) : py::none();
+    py::object nx = with_normals ? py::cast(res.nx_) : py::none();
+    return py::make_tuple(res.m0_, res.m1_, m2, nx);
+}
+
+}  // namespace
+
 PYBIND11_MODULE(_permutohedral_lattice, m) {
     py::class_<Permutohedral>(m, "Permutohedral")
         .def(py::init())
@@ -26,6 +38,46 @@ PYBIND11_MODULE(_permutohedral_lattice, m) {
         ph.compute(out, v);
         return out;
     });
+
+    m.def("vector_width", &Permutohedral::vectorWidth);
+    m.def("set_max_vector_width", &Permutohedral::setMaxVectorWidth, py::arg("width"));
+    m.def("filterreg_estep",
+          [](const MatrixCRef& source, const MatrixCRef& target, Float sigma2, Float alpha, bool compute_m2,
+             const MatrixCRef& target_normals) {
+              auto res = computeFilterRegEstep(source, target, sigma2, alpha, compute_m2, target_normals);
+              return estepTuple(res, compute_m2, target_normals.size() > 0);
+          },
+          py::arg("source"), py::arg("target"), py::arg("sigma2"), py::arg("alpha"), py::arg("compute_m2"),
+          py::arg("target_normals") = probreg::Matrix());
+    py::class_<FilterRegEstep>(m, "FilterRegEstep")
+        .def(py::init<const MatrixCRef&, Integer, Float, Float, bool, const MatrixCRef&>(),
+             py::arg("target"), py::arg("num_source"), py::arg("sigma2"), py::arg("alpha"),
+             py::arg("compute_m2"), py::arg("target_normals") = probreg::Matrix())
+        .def("compute", [](FilterRegEstep& estep, const MatrixCRef& source) {
+            return estepTuple(estep.compute(source), estep.computeM2(), estep.withNormals());
+        });
+
+    py::class_<FilterRegTrackerResult>(m, "FilterRegTrackerResult")
+        .def_readonly("rot", &FilterRegTrackerResult::rot_)
+        .def_readonly("t", &FilterRegTrackerResult::t_)
+        .def_readonly("sigma2", &FilterRegTrackerResult::sigma2_)
+        .def_readonly("q", &FilterRegTrackerResult::q_)
+        .def_readonly("n_iter", &FilterRegTrackerResult::n_iter_);
+    // The GIL is released while a frame is registered.
+    py::class_<FilterRegTracker>(m, "FilterRegTracker")
+        .def(py::init<const MatrixX3CRef&, Float, Float, Float, bool, Integer, Float>(), py::arg("source"),
+             py::arg("sigma2") = 0.0, py::arg("alpha") = 0.015, py::arg("w") = 0.0,
+             py::arg("point_to_plane") = false, py::arg("maxiter") = 50, py::arg("tol") = 0.001)
+        .def("track", &FilterRegTracker::track, py::arg("target"), py::arg("target_normals") = MatrixX3(),
+             py::call_guard<py::gil_scoped_release>())
+        .def("reset", &FilterRegTracker::reset)
+        .def_property_readonly("result", &FilterRegTracker::result);
+    // Registers the pairs (sources[i], targets[i]) on the OpenMP threads,
+    // the GIL is released for the whole batch.
+    m.def("filterreg_register_many", &registerFilterRegBatch, py::arg("sources"), py::arg("targets"),
+          py::arg("target_normals") = std::vector<MatrixX3>(), py::arg("sigma2") = 0.0,
+          py::arg("alpha") = 0.015, py::arg("w") = 0.0, py::arg("point_to_plane") = false,
+          py::arg("maxiter") = 50, py::arg("tol") = 0.001, py::call_guard<py::gil_scoped_release>());
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
 #else
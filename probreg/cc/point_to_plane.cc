@@ -1,26 +1,167 @@
 #include "point_to_plane.h"
 #include <Eigen/Dense>
+#include <algorithm>
+#include <stdexcept>
 
 using namespace probreg;
 
-Pt2PlResult probreg::computeTwistForPointToPlane(const MatrixX3& model,
-                                                 const MatrixX3& target,
-                                                 const MatrixX3& target_normal,
-                                                 const Vector& weight) {
-    Matrix6 ata = Matrix6::Zero();
-    Vector6 atb = Vector6::Zero();
-    Float r_sum = 0.0;
-
-    for (auto k = 0; k < model.rows(); ++k){
-        const auto& vertex_k = model.row(k).transpose();
-        const auto& target_k = target.row(k).transpose();
-        const auto& normal_k = target_normal.row(k).transpose();
-        const auto& weight_k = weight[k];
-        const Float residual = normal_k.dot(target_k - vertex_k);
-        const Vector6 jac = (Vector6() << vertex_k.cross(normal_k), normal_k).finished();
-        ata.noalias() += weight_k * jac * jac.transpose();
-        atb.noalias() += weight_k * residual * jac;
-        r_sum += weight_k * weight_k * residual * residual;
+namespace {
+
+// Solves the rows [begin, begin + n), the jacobians of the rows are stored in the buffer so that the normal
+// equations are column-wise dot products, summed by blocks in Accum.
+template <typename Scalar, typename Accum, typename Points, typename Weights>
+Pt2PlResultT<Scalar> solvePointToPlane(const Points& model,
+                                       const Points& target,
+                                       const Points& target_normal,
+                                       const Weights& weight,
+                                       Integer begin,
+                                       Integer n,
+                                       MatrixX6T<Scalar>& jac_buffer,
+                                       VectorT<Scalar>& residual_buffer) {
+    if (jac_buffer.rows() < n) {
+        jac_buffer.resize(n, 6);
+        residual_buffer.resize(n);
+    }
+    const auto vertex = model.middleRows(begin, n).array();
+    const auto normal = target_normal.middleRows(begin, n).array();
+    const auto w = weight.segment(begin, n);
+    auto jac = jac_buffer.topRows(n);
+    auto residual = residual_buffer.head(n);
+    // jacobian = (vertex x normal, normal)
+    jac.col(0) = vertex.col(1) * normal.col(2) - vertex.col(2) * normal.col(1);
+    jac.col(1) = vertex.col(2) * normal.col(0) - vertex.col(0) * normal.col(2);
+    jac.col(2) = vertex.col(0) * normal.col(1) - vertex.col(1) * normal.col(0);
+    jac.rightCols(3) = normal;
+    residual = ((target.middleRows(begin, n).array() - vertex) * normal).rowwise().sum();
+
+    Matrix6T<Accum> ata = Matrix6T<Accum>::Zero();
+    Vector6T<Accum> atb = Vector6T<Accum>::Zero();
+    Accum r_sum = 0.0;
+    for (Integer b = 0; b < n; b += accumulation_block_size) {
+        const Integer nb = std::min(accumulation_block_size, n - b);
+        const auto jb = jac.middleRows(b, nb);
+        const auto wb = w.segment(b, nb);
+        const auto wr = wb.cwiseProduct(residual.segment(b, nb));
+        const Matrix6T<Scalar> ata_b = (jb.transpose() * wb.asDiagonal()).lazyProduct(jb);
+        const Vector6T<Scalar> atb_b = jb.transpose().lazyProduct(wr);
+        ata += ata_b.template cast<Accum>();
+        atb += atb_b.template cast<Accum>();
+        r_sum += wr.squaredNorm();
+    }
+    const Vector6T<Accum> x = ata.template selfadjointView<Eigen::Upper>().ldlt().solve(atb);
+    return std::make_pair(Vector6T<Scalar>(x.template cast<Scalar>()), Scalar(r_sum));
+}
+
+template <typename Scalar, typename Accum, typename Points, typename Weights>
+void solvePointToPlaneBatch(const Points& model,
+                            const Points& target,
+                            const Points& target_normal,
+                            const Weights& weight,
+                            const VectorXi& offsets,
+                            MatrixX6T<Scalar>& twists,
+                            VectorT<Scalar>& residuals) {
+    const Integer n_problems = offsets.size() - 1;
+    #pragma omp parallel
+    {
+        MatrixX6T<Scalar> jac_buffer;
+        VectorT<Scalar> residual_buffer;
+        #pragma omp for schedule(dynamic, 64)
+        for (Integer p = 0; p < n_problems; ++p) {
+            const Pt2PlResultT<Scalar> res =
+                solvePointToPlane<Scalar, Accum>(model, target, target_normal, weight, offsets[p],
+                                                 offsets[p + 1] - offsets[p], jac_buffer, residual_buffer);
+            twists.row(p) = res.first.transpose();
+            residuals[p] = res.second;
+        }
+    }
+}
+
+template <typename Scalar>
+bool allContiguous(const MatrixX3CRefT<Scalar>& model,
+                   const MatrixX3CRefT<Scalar>& target,
+                   const MatrixX3CRefT<Scalar>& target_normal,
+                   const VectorCRefT<Scalar>& weight) {
+    return hasContiguousColumns(model) && hasContiguousColumns(target) &&
+           hasContiguousColumns(target_normal) && hasContiguousColumns(weight);
+}
+
+}  // namespace
+
+template <typename Scalar, typename Accum>
+Pt2PlResultT<Scalar> probreg::computeTwistForPointToPlane(const MatrixX3CRefT<Scalar>& model,
+                                                          const MatrixX3CRefT<Scalar>& target,
+                                                          const MatrixX3CRefT<Scalar>& target_normal,
+                                                          const VectorCRefT<Scalar>& weight) {
+    MatrixX6T<Scalar> jac_buffer;
+    VectorT<Scalar> residual_buffer;
+    if (allContiguous(model, target, target_normal, weight)) {
+        return solvePointToPlane<Scalar, Accum>(mapColumns(model), mapColumns(target),
+                                                mapColumns(target_normal), mapColumns(weight), 0,
+                                                model.rows(), jac_buffer, residual_buffer);
     }
-    return std::make_pair(ata.selfadjointView<Eigen::Upper>().ldlt().solve(atb), r_sum);
+    return solvePointToPlane<Scalar, Accum>(model, target, target_normal, weight, 0, model.rows(), jac_buffer,
+                                            residual_buffer);
 }
+
+template <typename Scalar, typename Accum>
+Pt2PlBatchResultT<Scalar> probreg::computeTwistForPointToPlaneBatch(
+    const MatrixX3CRefT<Scalar>& model,
+    const MatrixX3CRefT<Scalar>& target,
+    const MatrixX3CRefT<Scalar>& target_normal,
+    const VectorCRefT<Scalar>& weight,
+    const VectorXi& offsets) {
+    if (target.rows() != model.rows() || target_normal.rows() != model.rows() ||
+        weight.size() != model.rows()) {
+        throw std::invalid_argument("The sizes of model, target, target_normal and weight do not match.");
+    }
+    if (offsets.size() == 0 || offsets[0] != 0 || offsets[offsets.size() - 1] != model.rows() ||
+        ((offsets.tail(offsets.size() - 1) - offsets.head(offsets.size() - 1)).array() < 0).any()) {
+        throw std::invalid_argument("The offsets must increase from 0 to the number of points.");
+    }
+    const Integer n_problems = offsets.size() - 1;
+    MatrixX6T<Scalar> twists(n_problems, 6);
+    VectorT<Scalar> residuals(n_problems);
+    if (allContiguous(model, target, target_normal, weight)) {
+        solvePointToPlaneBatch<Scalar, Accum>(mapColumns(model), mapColumns(target),
+                                              mapColumns(target_normal), mapColumns(weight), offsets, twists,
+                                              residuals);
+    } else {
+        solvePointToPlaneBatch<Scalar, Accum>(model, target, target_normal, weight, offsets, twists,
+                                              residuals);
+    }
+    return std::make_pair(twists, residuals);
+}
+
+template Pt2PlResultT<float> probreg::computeTwistForPointToPlane<float, float>(
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const VectorCRefT<float>&);
+template Pt2PlResultT<float> probreg::computeTwistForPointToPlane<float, double>(
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const VectorCRefT<float>&);
+template Pt2PlResultT<double> probreg::computeTwistForPointToPlane<double, double>(
+    const MatrixX3CRefT<double>&,
+    const MatrixX3CRefT<double>&,
+    const MatrixX3CRefT<double>&,
+    const VectorCRefT<double>&);
+template Pt2PlBatchResultT<float> probreg::computeTwistForPointToPlaneBatch<float, float>(
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const VectorCRefT<float>&,
+    const VectorXi&);
+template Pt2PlBatchResultT<float> probreg::computeTwistForPointToPlaneBatch<float, double>(
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const MatrixX3CRefT<float>&,
+    const VectorCRefT<float>&,
+    const VectorXi&);
+template Pt2PlBatchResultT<double> probreg::computeTwistForPointToPlaneBatch<double, double>(
+    const MatrixX3CRefT<double>&,
+    const MatrixX3CRefT<double>&,
+    const MatrixX3CRefT<double>&,
+    const VectorCRefT<double>&,
+    const VectorXi&);
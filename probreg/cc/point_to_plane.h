@@ -6,13 +6,33 @@
 
 namespace probreg {
 
-typedef std::pair<Vector6, Float> Pt2PlResult;
+template <typename Scalar>
+using Pt2PlResultT = std::pair<Vector6T<Scalar>, Scalar>;
+typedef Pt2PlResultT<Float> Pt2PlResult;
 
-Pt2PlResult computeTwistForPointToPlane(const MatrixX3& model,
-                                        const MatrixX3& target,
-                                        const MatrixX3& target_normal,
-                                        const Vector& weight);
+// The normal equations are summed in Accum, double sums of float points with Accum = double.
+template <typename Scalar, typename Accum = Scalar>
+Pt2PlResultT<Scalar> computeTwistForPointToPlane(const MatrixX3CRefT<Scalar>& model,
+                                                 const MatrixX3CRefT<Scalar>& target,
+                                                 const MatrixX3CRefT<Scalar>& target_normal,
+                                                 const VectorCRefT<Scalar>& weight);
+
+template <typename Scalar>
+using MatrixX6T = Eigen::Matrix<Scalar, Eigen::Dynamic, 6>;
+typedef MatrixX6T<Float> MatrixX6;
+template <typename Scalar>
+using Pt2PlBatchResultT = std::pair<MatrixX6T<Scalar>, VectorT<Scalar>>;
+typedef Pt2PlBatchResultT<Float> Pt2PlBatchResult;
+
+// Independent problems packed in the same arrays: problem p is made of the rows [offsets[p], offsets[p + 1])
+// of model, target, target_normal and weight. Returns the twists (one row per problem) and the residuals.
+template <typename Scalar, typename Accum = Scalar>
+Pt2PlBatchResultT<Scalar> computeTwistForPointToPlaneBatch(const MatrixX3CRefT<Scalar>& model,
+                                                           const MatrixX3CRefT<Scalar>& target,
+                                                           const MatrixX3CRefT<Scalar>& target_normal,
+                                                           const VectorCRefT<Scalar>& weight,
+                                                           const VectorXi& offsets);
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -5,8 +5,43 @@
 using namespace probreg;
 namespace py = pybind11;
 
+namespace {
+
+// Dispatched on the dtype of the points like the Kabsch solvers.
+template <typename Scalar>
+void defPointToPlane(py::module& m) {
+    m.def(
+        "compute_twist_for_pt2pl",
+        [](const MatrixX3CRefT<Scalar>& model, const MatrixX3CRefT<Scalar>& target,
+           const MatrixX3CRefT<Scalar>& target_normal, const VectorCRefT<Scalar>& weight,
+           bool mixed_precision) {
+            return mixed_precision
+                       ? computeTwistForPointToPlane<Scalar, double>(model, target, target_normal, weight)
+                       : computeTwistForPointToPlane<Scalar>(model, target, target_normal, weight);
+        },
+        py::arg("model"), py::arg("target"), py::arg("target_normal"), py::arg("weight"),
+        py::arg("mixed_precision") = false);
+    m.def(
+        "compute_twist_for_pt2pl_batch",
+        [](const MatrixX3CRefT<Scalar>& model, const MatrixX3CRefT<Scalar>& target,
+           const MatrixX3CRefT<Scalar>& target_normal, const VectorCRefT<Scalar>& weight, py::object offsets,
+           bool mixed_precision) {
+            const VectorXi offsets_i = offsets.cast<VectorXi>();
+            if (mixed_precision) {
+                return computeTwistForPointToPlaneBatch<Scalar, double>(model, target, target_normal, weight,
+                                                                        offsets_i);
+            }
+            return computeTwistForPointToPlaneBatch<Scalar>(model, target, target_normal, weight, offsets_i);
+        },
+        py::arg("model"), py::arg("target"), py::arg("target_normal"), py::arg("weight"), py::arg("offsets"),
+        py::arg("mixed_precision") = false);
+}
+
+}  // namespace
+
 PYBIND11_MODULE(_pt2pl, m) {
-    m.def("compute_twist_for_pt2pl", &computeTwistForPointToPlane);
+    defPointToPlane<float>(m);
+    defPointToPlane<double>(m);
 
 #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
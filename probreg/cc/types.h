@@ -2,29 +2,104 @@
 #define __probreg_types_h__
 
 #include <Eigen/Core>
-//#define USE_DOUBLE
 
 namespace probreg {
-#ifdef USE_DOUBLE
-typedef double Float;
 typedef int Integer;
-typedef Eigen::MatrixXd Matrix;
-typedef Eigen::VectorXd Vector;
 typedef Eigen::VectorXi VectorXi;
-typedef Eigen::Matrix3d Matrix3;
-typedef Eigen::Vector3d Vector3;
-#else
+
+// The kernels (Kabsch, point-to-plane, kernel matrices, GMM tree, IFGT) are templated on the scalar type
+// and instantiated for float and double, the bindings dispatch on the dtype of the arrays.
+// Some of them are also templated on the type of the sums of the moments, float arrays can be summed in
+// double (mixed precision). Float is the precision of the other parts.
 typedef float Float;
-typedef int Integer;
-typedef Eigen::MatrixXf Matrix;
-typedef Eigen::VectorXf Vector;
-typedef Eigen::VectorXi VectorXi;
-typedef Eigen::Matrix3f Matrix3;
-typedef Eigen::Vector3f Vector3;
-#endif
-typedef Eigen::Matrix<Float, Eigen::Dynamic, 3> MatrixX3;
-typedef Eigen::Vector<Float, 6> Vector6;
-typedef Eigen::Matrix<Float, 6, 6> Matrix6;
+
+// Long sums add the sums of blocks of rows computed in the scalar type, so that the blocks are vectorized.
+static const Integer accumulation_block_size = 1024;
+
+template <typename Scalar>
+using MatrixT = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+template <typename Scalar>
+using VectorT = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+template <typename Scalar>
+using Matrix3T = Eigen::Matrix<Scalar, 3, 3>;
+template <typename Scalar>
+using Vector3T = Eigen::Matrix<Scalar, 3, 1>;
+template <typename Scalar>
+using MatrixX3T = Eigen::Matrix<Scalar, Eigen::Dynamic, 3>;
+template <typename Scalar>
+using Vector6T = Eigen::Matrix<Scalar, 6, 1>;
+template <typename Scalar>
+using Matrix6T = Eigen::Matrix<Scalar, 6, 6>;
+template <typename Scalar>
+using RowMatrixT = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+typedef MatrixT<Float> Matrix;
+typedef VectorT<Float> Vector;
+typedef Matrix3T<Float> Matrix3;
+typedef Vector3T<Float> Vector3;
+typedef MatrixX3T<Float> MatrixX3;
+typedef Vector6T<Float> Vector6;
+typedef Matrix6T<Float> Matrix6;
+typedef RowMatrixT<Float> RowMatrix;
+
+// Views of the input arrays with any strides, so that NumPy arrays of the scalar type are bound without a
+// copy whether they are C or Fortran ordered. Other dtypes are converted by pybind11.
+typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> AnyStride;
+template <typename Scalar>
+using MatrixCRefT = Eigen::Ref<const MatrixT<Scalar>, 0, AnyStride>;
+template <typename Scalar>
+using MatrixX3CRefT = Eigen::Ref<const MatrixX3T<Scalar>, 0, AnyStride>;
+template <typename Scalar>
+using VectorCRefT = Eigen::Ref<const VectorT<Scalar>, 0, Eigen::InnerStride<>>;
+// Output arrays provided by the caller, a C-ordered NumPy array.
+template <typename Scalar>
+using RowMatrixRefT = Eigen::Ref<RowMatrixT<Scalar>>;
+// Output blocks of columns of a matrix or vector owned by the caller.
+template <typename Scalar>
+using MatrixRefT = Eigen::Ref<MatrixT<Scalar>>;
+
+template <typename Scalar>
+using MatrixCMapT = Eigen::Map<const MatrixT<Scalar>, 0, Eigen::OuterStride<>>;
+template <typename Scalar>
+using MatrixX3CMapT = Eigen::Map<const MatrixX3T<Scalar>, 0, Eigen::OuterStride<>>;
+template <typename Scalar>
+using VectorCMapT = Eigen::Map<const VectorT<Scalar>>;
+
+typedef MatrixCRefT<Float> MatrixCRef;
+typedef MatrixX3CRefT<Float> MatrixX3CRef;
+typedef VectorCRefT<Float> VectorCRef;
+typedef RowMatrixRefT<Float> RowMatrixRef;
+
+// Column-major view of x for the kernels that read contiguous columns.
+// x is only copied to buffer if its columns are not contiguous.
+template <typename Scalar>
+MatrixCMapT<Scalar> contiguousColumns(const MatrixCRefT<Scalar>& x, MatrixT<Scalar>& buffer) {
+    if (x.innerStride() == 1) {
+        return MatrixCMapT<Scalar>(x.data(), x.rows(), x.cols(), Eigen::OuterStride<>(x.outerStride()));
+    }
+    buffer = x;
+    return MatrixCMapT<Scalar>(buffer.data(), buffer.rows(), buffer.cols(),
+                               Eigen::OuterStride<>(buffer.rows()));
+}
+
+// The strides of the views are only known at run time, which prevents the vectorization over the columns.
+// Views with contiguous columns can be mapped again as such.
+template <typename Scalar>
+bool hasContiguousColumns(const MatrixX3CRefT<Scalar>& x) {
+    return x.innerStride() == 1;
+}
+template <typename Scalar>
+bool hasContiguousColumns(const VectorCRefT<Scalar>& x) {
+    return x.innerStride() == 1;
+}
+template <typename Scalar>
+MatrixX3CMapT<Scalar> mapColumns(const MatrixX3CRefT<Scalar>& x) {
+    return MatrixX3CMapT<Scalar>(x.data(), x.rows(), 3, Eigen::OuterStride<>(x.outerStride()));
+}
+template <typename Scalar>
+VectorCMapT<Scalar> mapColumns(const VectorCRefT<Scalar>& x) {
+    return VectorCMapT<Scalar>(x.data(), x.size());
+}
 }  // namespace probreg
 
-#endif
\ No newline at end of file
+#endif
@@ -8,10 +8,12 @@ import open3d as o3
 from . import transformation as tf
 from . import gauss_transform as gt
 from . import math_utils as mu
+from . import _cpd
 
 
 EstepResult = namedtuple('EstepResult', ['pt1', 'p1', 'px', 'n_p'])
 MstepResult = namedtuple('MstepResult', ['transformation', 'sigma2', 'q'])
+CpdHistory = namedtuple('CpdHistory', ['q', 'sigma2'])
 
 
 @six.add_metaclass(abc.ABCMeta)
@@ -22,6 +24,8 @@ class CoherentPointDrift():
     according to the type of transformation.
     In this class, Estimation step in EM algorithm is implemented and
     Maximazation step is implemented in the inherited classes.
+    The values of q and sigma2 after each iteration of the last registration
+    are kept in `history`.
 
     Args:
         source (numpy.ndarray, optional): Source point cloud data.
@@ -30,9 +34,12 @@ class CoherentPointDrift():
         self._source = source
         self._tf_type = None
         self._callbacks = []
+        self._native = None
+        self.history = None
 
     def set_source(self, source):
         self._source = source
+        self._native = None
 
     def set_callbacks(self, callbacks):
         self._callbacks.extend(callbacks)
@@ -55,8 +62,9 @@ class CoherentPointDrift():
         a = 1.0 / (kt1 + c)
         pt1 = 1.0 - c * a
         gtrans = gt.GaussTransform(target, h)
-        p1 = gtrans.compute(t_source, a)
-        px = gtrans.compute(t_source, np.tile(a, (ndim, 1)) * target.T).T
+        p1_px = gtrans.compute(t_source, np.r_[[a], a * target.T])
+        p1 = p1_px[0]
+        px = p1_px[1:].T
         return EstepResult(pt1, p1, px, np.sum(p1))
 
     def maximization_step(self, target, estep_res, sigma2_p=None):
@@ -67,28 +75,76 @@ class CoherentPointDrift():
     def _maximization_step(source, target, estep_res, sigma2_p=None):
         return None
 
+    def _create_native(self):
+        """Native engine running the whole EM loop, None if the loop runs in Python.
+        """
+        return None
+
+    def _native_class(self):
+        # float64 sources are registered in double, the others in float.
+        suffix = '64' if np.asarray(self._source).dtype == np.float64 else ''
+        return getattr(_cpd, 'CoherentPointDrift' + suffix)
+
+    def _native_transformation(self, res):
+        return None
+
+    def _native_registration(self, target, w, maxiter, tol):
+        callback = None
+        if self._callbacks:
+            def callback(res):
+                for c in self._callbacks:
+                    c(self._native_transformation(res))
+        res = self._native.registration(target, w, maxiter, tol, callback)
+        self.history = CpdHistory(np.array(res.q_history), np.array(res.sigma2_history))
+        return MstepResult(self._native_transformation(res), res.sigma2, res.q)
+
     def registration(self, target, w=0.0,
                      maxiter=50, tol=0.001):
         assert not self._tf_type is None, "transformation type is None."
+        if self._native is None:
+            self._native = self._create_native()
+        if not self._native is None:
+            return self._native_registration(target, w, maxiter, tol)
         res = self._initialize(target)
         q = res.q
+        history = CpdHistory([], [])
         for _ in range(maxiter):
             t_source = res.transformation.transform(self._source)
             estep_res = self.expectation_step(t_source, target, res.sigma2, w)
             res = self.maximization_step(target, estep_res, res.sigma2)
+            history.q.append(res.q)
+            history.sigma2.append(res.sigma2)
             for c in self._callbacks:
                 c(res.transformation)
             if abs(res.q - q) < tol:
                 break
             q = res.q
+        self.history = CpdHistory(np.array(history.q), np.array(history.sigma2))
         return res
 
 
 class RigidCPD(CoherentPointDrift):
-    def __init__(self, source=None, update_scale=True):
+    """Rigid CPD.
+
+    Args:
+        source (numpy.ndarray, optional): Source point cloud data.
+        update_scale (bool, optional): If False, the scale is fixed to 1.
+        use_native (bool, optional): If True, the EM loop runs in C++ without the GIL.
+    """
+    def __init__(self, source=None, update_scale=True, use_native=True):
         super(RigidCPD, self).__init__(source)
         self._tf_type = tf.RigidTransformation
         self._update_scale = update_scale
+        self._use_native = use_native
+
+    def _create_native(self):
+        if not self._use_native:
+            return None
+        return self._native_class()(self._source, _cpd.CpdTransformationType.RIGID,
+                                    self._update_scale)
+
+    def _native_transformation(self, res):
+        return tf.RigidTransformation(res.rot, res.t, res.scale)
 
     def _initialize(self, target):
         ndim = self._source.shape[1]
@@ -130,9 +186,24 @@ class RigidCPD(CoherentPointDrift):
 
 
 class AffineCPD(CoherentPointDrift):
-    def __init__(self, source=None):
+    """Affine CPD.
+
+    Args:
+        source (numpy.ndarray, optional): Source point cloud data.
+        use_native (bool, optional): If True, the EM loop runs in C++ without the GIL.
+    """
+    def __init__(self, source=None, use_native=True):
         super(AffineCPD, self).__init__(source)
         self._tf_type = tf.AffineTransformation
+        self._use_native = use_native
+
+    def _create_native(self):
+        if not self._use_native:
+            return None
+        return self._native_class()(self._source, _cpd.CpdTransformationType.AFFINE)
+
+    def _native_transformation(self, res):
+        return tf.AffineTransformation(res.rot, res.t)
 
     def _initialize(self, target):
         ndim = self._source.shape[1]
@@ -164,18 +235,29 @@ class AffineCPD(CoherentPointDrift):
 
 
 class NonRigidCPD(CoherentPointDrift):
-    def __init__(self, source=None, beta=2.0, lmd=2.0):
+    """Nonrigid CPD.
+
+    Args:
+        source (numpy.ndarray, optional): Source point cloud data.
+        beta (float, optional): Width of the RBF kernel of the displacement field.
+        lmd (float, optional): Weight of the regularization of the displacement field.
+        rank (int, optional): If given, the Gram matrix is approximated with this number of
+            landmarks (Nystrom) and the M-step costs O(M rank^2) instead of O(M^3).
+            A larger rank is more accurate.
+    """
+    def __init__(self, source=None, beta=2.0, lmd=2.0, rank=None):
         super(NonRigidCPD, self).__init__(source)
         self._tf_type = tf.NonRigidTransformation
         self._beta = beta
         self._lmd = lmd
+        self._rank = rank
         self._tf_obj = None
         if not self._source is None:
-            self._tf_obj = self._tf_type(None, self._source, self._beta)
+            self._tf_obj = self._tf_type(None, self._source, self._beta, self._rank)
 
     def set_source(self, source):
         self._source = source
-        self._tf_obj = self._tf_type(None, self._source, self._beta)
+        self._tf_obj = self._tf_type(None, self._source, self._beta, self._rank)
 
     def maximization_step(self, target, estep_res, sigma2_p=None):
         return self._maximization_step(self._source, target, estep_res,
@@ -192,9 +274,12 @@ class NonRigidCPD(CoherentPointDrift):
     def _maximization_step(source, target, estep_res, sigma2_p, tf_obj, lmd):
         pt1, p1, px, n_p = estep_res
         ndim = source.shape[1]
-        w = np.linalg.solve((p1 * tf_obj.g).T + lmd * sigma2_p * np.identity(source.shape[0]),
-                            px - (source.T * p1).T)
-        t = source + np.dot(tf_obj.g, w)
+        if tf_obj.low_rank_g is None:
+            w = np.linalg.solve((p1 * tf_obj.g).T + lmd * sigma2_p * np.identity(source.shape[0]),
+                                px - (source.T * p1).T)
+        else:
+            w = tf_obj.low_rank_g.solve(p1, px - (source.T * p1).T, lmd * sigma2_p)
+        t = source + tf_obj.dot_g(w)
         tr_xp1x = np.trace(np.dot(target.T * pt1, target))
         tr_pxt = np.trace(np.dot(px.T, t))
         tr_tpt = np.trace(np.dot(t.T * p1, t))
@@ -229,4 +314,38 @@ def registration_cpd(source, target, tf_type_name='rigid',
         raise ValueError('Unknown transformation type %s' % tf_type_name)
     cpd.set_callbacks(callbacks)
     return cpd.registration(cv(target),
-                            w, maxiter, tol)
\ No newline at end of file
+                            w, maxiter, tol)
+
+
+def registration_cpd_many(sources, targets, tf_type_name='rigid',
+                          w=0.0, maxiter=50, tol=0.001, update_scale=True, sw_h=0.3):
+    """Rigid or affine CPD of each source to the target of the same index.
+    The pairs are registered in parallel in C++ without the GIL.
+
+    Args:
+        sources (:obj:`list` of :obj:`numpy.ndarray`): Source point clouds.
+        targets (:obj:`list` of :obj:`numpy.ndarray`): Target point clouds.
+        tf_type_name (str): Transformation type('rigid', 'affine')
+        w (float): Weight of the uniform distribution, 0 < `w` < 1.
+        maxiter (int): Maximum number of iterations to EM algorithm.
+        tol (float): Tolerance for termination.
+        update_scale (bool, optional): If False, the scale of the rigid transformation is fixed to 1.
+        sw_h (float, optional): Value of the bandwidth parameter under which the Gauss transforms
+            are direct and exact, they use IFGT above it.
+    """
+    cv = lambda x: np.asarray(x.points if isinstance(x, o3.PointCloud) else x)
+    if tf_type_name == 'rigid':
+        tf_type = _cpd.CpdTransformationType.RIGID
+        to_tf = lambda r: tf.RigidTransformation(r.rot, r.t, r.scale)
+    elif tf_type_name == 'affine':
+        tf_type = _cpd.CpdTransformationType.AFFINE
+        to_tf = lambda r: tf.AffineTransformation(r.rot, r.t)
+    else:
+        raise ValueError('Unknown transformation type %s' % tf_type_name)
+    sources = [cv(s) for s in sources]
+    targets = [cv(t) for t in targets]
+    # float64 point clouds are registered in double, the others in float.
+    suffix = '64' if sources and sources[0].dtype == np.float64 else ''
+    res = getattr(_cpd, 'register_many' + suffix)(sources, targets, tf_type, update_scale,
+                                                  w, maxiter, tol, sw_h)
+    return [MstepResult(to_tf(r), r.sigma2, r.q) for r in res]
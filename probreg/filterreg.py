@@ -6,11 +6,11 @@ import six
 import numpy as np
 import open3d as o3
 from . import transformation as tf
-from . import gaussian_filtering as gf
 from . import gauss_transform as gt
 from . import se3_op as so
 from . import _kabsch as kabsch
 from . import _pt2pl as pt2pl
+from . import _permutohedral_lattice
 from . import math_utils as mu
 
 
@@ -39,6 +39,7 @@ class FilterReg():
         self._tf_type = None
         self._tf_result = None
         self._callbacks = []
+        self._estep = None
 
     def set_source(self, source):
         self._source = source
@@ -54,36 +55,25 @@ class FilterReg():
         """Expectation step
         """
         assert t_source.ndim == 2 and target.ndim == 2, "source and target must have 2 dimensions."
-        m, ndim = t_source.shape
-        n = target.shape[0]
-        sigma = np.sqrt(sigma2)
-        fx = t_source / sigma
-        fy = target / sigma
-        zero_m1 = np.zeros((m, 1))
-        zeros_md = np.zeros_like(fx)
-        dem = np.power(2.0 * np.pi * sigma2, ndim * 0.5)
-        fin = np.r_[fx, fy]
-        ph = gf.Permutohedral(fin)
-        if ph.get_lattice_size() < n * alpha:
-            ph = gf.Permutohedral(fin, False)
-        vin0 = np.r_[zero_m1, np.ones((n, 1)) / dem]
-        vin1 = np.r_[zeros_md, target / dem]
-        m0 = ph.filter(vin0, m).flatten()[:m]
-        m1 = ph.filter(vin1, m)[:m]
-        if self._update_sigma2:
-            vin2 = np.r_[zero_m1,
-                         np.expand_dims(np.square(target).sum(axis=1), axis=1) / dem]
-            m2 = ph.filter(vin2, m).flatten()[:m]
-        else:
-            m2 = None
         if objective_type == 'pt2pt':
-            nx = None
+            normals = np.zeros((0, t_source.shape[1]))
         elif objective_type == 'pt2pl':
-            vin = np.r_[zeros_md, self._target_normals / dem]
-            nx = ph.filter(vin, m)[:m]
+            normals = self._target_normals
         else:
             raise ValueError('Unknown objective_type: %s.' % objective_type)
-        return EstepResult(m0, m1, m2, nx)
+        if self._update_sigma2:
+            m0, m1, m2, nx = _permutohedral_lattice.filterreg_estep(t_source, target, sigma2, alpha,
+                                                                    True, normals)
+            return EstepResult(m0, m1, m2, nx)
+        # With a fixed sigma2 the target part of the lattice is kept between the iterations.
+        # The arrays are compared by identity, modifying them in place is not detected.
+        params = (objective_type, sigma2, alpha, t_source.shape[0])
+        if self._estep is None or self._estep[0] is not target or \
+           self._estep[1] is not self._target_normals or self._estep[2] != params:
+            self._estep = (target, self._target_normals, params,
+                           _permutohedral_lattice.FilterRegEstep(target, t_source.shape[0], sigma2,
+                                                                 alpha, False, normals))
+        return EstepResult(*self._estep[3].compute(t_source))
 
     def maximization_step(self, t_source, target, estep_res, w=0.0,
                           objective_type='pt2pt'):
@@ -152,11 +142,55 @@ class RigidFilterReg(FilterReg):
             raise ValueError('Unknown objective_type: %s.' % objective_type)
 
         if not m2 is None:
-            sigma2 = (m0 *(np.square(t_source).sum(axis=1) - 2.0 * (t_source * m1).sum(axis=1) + m2) / (m0 + c)).sum()
+            sigma2 = ((m0 * np.square(t_source).sum(axis=1) - 2.0 * (t_source * m1).sum(axis=1) + m2) / (m0 + c)).sum()
             sigma2 /= (3*m0m0.sum())
         return MstepResult(tf.RigidTransformation(rot, t), sigma2, q)
 
 
+class FilterRegTracker(object):
+    """Rigid FilterReg of a source to the frames of a sequence.
+    Each frame starts from the pose of the previous one, the whole
+    EM loop runs in C++ without the GIL and reuses its buffers between the frames.
+
+    Args:
+        source (numpy.ndarray): Source point cloud data.
+        sigma2 (Float, optional): Variance parameter. If this variable is None,
+            it is estimated on each frame and updated in Mstep.
+            A fixed sigma2 is faster, the target lattice is built once per frame.
+        objective_type (str, optional): 'pt2pt' or 'pt2pl'.
+        w (Float, optional): Weight of the uniform distribution.
+        alpha (Float, optional): The lattice is not blurred if it has less than
+            `alpha` times the number of target points.
+        maxiter (int, optional): Maximum number of iterations for each frame.
+        tol (Float, optional): Tolerance for termination.
+    """
+    def __init__(self, source, sigma2=None, objective_type='pt2pt',
+                 w=0.0, alpha=0.015, maxiter=50, tol=0.001):
+        if not objective_type in ['pt2pt', 'pt2pl']:
+            raise ValueError('Unknown objective_type: %s.' % objective_type)
+        self._tracker = _permutohedral_lattice.FilterRegTracker(source, 0.0 if sigma2 is None else sigma2,
+                                                                alpha, w, objective_type == 'pt2pl',
+                                                                maxiter, tol)
+
+    def track(self, target, target_normals=None):
+        """Register the source to a new frame.
+
+        Args:
+            target (numpy.ndarray): Target point cloud data of the frame.
+            target_normals (numpy.ndarray, optional): Normals of target points, required by 'pt2pl'.
+        """
+        if target_normals is None:
+            res = self._tracker.track(target)
+        else:
+            res = self._tracker.track(target, target_normals)
+        return MstepResult(tf.RigidTransformation(res.rot, res.t), res.sigma2, res.q)
+
+    def reset(self):
+        """Restart from the identity.
+        """
+        self._tracker.reset()
+
+
 def registration_filterreg(source, target, target_normals=None,
                            sigma2=None, objective_type='pt2pt', maxiter=50, tol=0.001,
                            callbacks=[], **kargs):
@@ -164,3 +198,26 @@ def registration_filterreg(source, target, target_normals=None,
     frg = RigidFilterReg(cv(source), cv(target_normals), sigma2, **kargs)
     frg.set_callbacks(callbacks)
     return frg.registration(cv(target), objective_type=objective_type, maxiter=maxiter, tol=tol)
+
+
+def registration_filterreg_many(sources, targets, target_normals=None,
+                                sigma2=None, objective_type='pt2pt', w=0.0, alpha=0.015,
+                                maxiter=50, tol=0.001):
+    """Rigid FilterReg of each source to the target of the same index,
+    with the parameters of `FilterRegTracker`.
+    The pairs are registered in parallel in C++ without the GIL.
+
+    Args:
+        sources (:obj:`list` of :obj:`numpy.ndarray`): Source point clouds.
+        targets (:obj:`list` of :obj:`numpy.ndarray`): Target point clouds.
+        target_normals (:obj:`list` of :obj:`numpy.ndarray`, optional): Normals of the targets,
+            required by 'pt2pl'.
+    """
+    if not objective_type in ['pt2pt', 'pt2pl']:
+        raise ValueError('Unknown objective_type: %s.' % objective_type)
+    cv = lambda x: np.asarray(x.points if isinstance(x, o3.PointCloud) else x)
+    normals = [] if target_normals is None else [np.asarray(n) for n in target_normals]
+    res = _permutohedral_lattice.filterreg_register_many([cv(s) for s in sources], [cv(t) for t in targets],
+                                                         normals, 0.0 if sigma2 is None else sigma2, alpha, w,
+                                                         objective_type == 'pt2pl', maxiter, tol)
+    return [MstepResult(tf.RigidTransformation(r.rot, r.t), r.sigma2, r.q) for r in res]
@@ -6,9 +6,10 @@ from . import _ifgt
 def _gauss_transform_direct(source, target, weights, h):
     """
     \sum_{j} weights[j] * \exp{ - \frac{||target[i] - source[j]||^2}{h^2} }
+    weights can also be a (M, k) matrix, the result is then (N, k).
     """
     h2 = h * h
-    fn = lambda t: np.dot(weights, np.exp(-np.sum(np.square(t - source), axis=1) / h2))
+    fn = lambda t: np.dot(np.exp(-np.sum(np.square(t - source), axis=1) / h2), weights)
     return np.apply_along_axis(fn, 1, target)
 
 class Direct(object):
@@ -27,15 +28,23 @@ class GaussTransform(object):
         source (numpy.ndarray): Source data.
         h (float): Bandwidth parameter of the Gaussian.
         eps (float): Small floating point used in Gauss Transform.
-        sw_h (float): Value of the bandwidth parameter to
-            switch between direct method and IFGT.
+        sw_h (float, optional): Value of the bandwidth parameter to
+            switch between direct method and IFGT. If None, the method
+            with the lower estimated cost per target point is used.
+            The direct method is exact, IFGT is accurate to `eps`.
     """
     def __init__(self, source, h, eps=1.0e-4, sw_h=0.3):
         self._m = source.shape[0]
-        if h < sw_h:
-            self._impl = Direct(source, h)
+        if sw_h is None:
+            use_direct = _ifgt.estimate_ifgt_complexity(source, h, eps) > self._m
         else:
-            self._impl = _ifgt.Ifgt(source, h, eps)
+            use_direct = h < sw_h
+        # float64 sources are transformed in double, the others in float.
+        suffix = '64' if source.dtype == np.float64 else ''
+        if use_direct:
+            self._impl = getattr(_ifgt, 'DirectGaussTransform' + suffix)(source, h)
+        else:
+            self._impl = getattr(_ifgt, 'Ifgt' + suffix)(source, h, eps)
 
     def compute(self, target, weights=None):
         """Compute gauss transform
@@ -43,12 +52,13 @@ class GaussTransform(object):
         Args:
             target (numpy.ndarray): Target data.
             weights (numpy.ndarray): Weights of Gauss Transform.
+                A (k, M) array is evaluated as k weight vectors in a single pass.
         """
         if weights is None:
             weights = np.ones(self._m)
         if weights.ndim == 1:
             return self._impl.compute(target, weights)
         elif weights.ndim == 2:
-            return np.r_[[self._impl.compute(target, w) for w in weights]]
+            return self._impl.compute(target, weights.T).T
         else:
             raise ValueError("weights.ndim must be 1 or 2.")
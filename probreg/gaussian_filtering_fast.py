@@ -5,11 +5,21 @@ from . import _preload_lattice
 
 
 class Permutohedral_fast(object):
-    def __init__(self, N,M,d,with_blur=True):
-        self._impl = _preload_lattice.Permutohedral_p(N,M,d,with_blur)
+    """Permutohedral lattice built once from the values of fixed points,
+    then filtered at any number of query point sets.
 
-    def init_with_val(self,features,in_tmp,with_blur):
-        return self._impl.init_with_val(features.T,in_tmp.T,with_blur)
+    Args:
+        p (numpy.ndarray): Features of the fixed points (N x d).
+        v (numpy.ndarray): Values of the fixed points (N x k).
+        with_blur (bool, optional): Blur the lattice.
+    """
+    def __init__(self, p, v, with_blur=True):
+        self._impl = _preload_lattice.Permutohedral_p()
+        self._impl.init(p.T, v.T, with_blur)
 
-    def apply(self, out, feature):
-        return self._impl.apply(out.T, feature.T)
+    def get_lattice_size(self):
+        return self._impl.get_lattice_size()
+
+    def filter(self, q):
+        """Filtered values (K x k) at the query features q (K x d)."""
+        return self._impl.apply(q.T).T
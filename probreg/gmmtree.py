@@ -37,6 +37,24 @@ class GMMTree():
                                              self._tree_level,
                                              0.001, 1.0e-4)
 
+    def save_tree(self, filename):
+        """Save the GMM tree built from the source to a binary file.
+
+        Args:
+            filename (str): Output file name.
+        """
+        _gmmtree.save_gmmtree(filename, self._nodes, self._tree_level)
+
+    def load_tree(self, filename):
+        """Load a GMM tree saved with `save_tree` instead of building it from the source.
+        The file is memory-mapped, so processes loading the same file share it.
+
+        Args:
+            filename (str): Input file name.
+        """
+        self._nodes = _gmmtree.MappedGmmTree(filename)
+        self._tree_level = self._nodes.max_tree_level
+
     def set_callbacks(self, callbacks):
         self._callbacks = callbacks
 
@@ -46,21 +64,7 @@ class GMMTree():
         return EstepResult(res)
 
     def maximization_step(self, estep_res, trans_p):
-        moments = estep_res.moments
-        n = len(moments)
-        amat = np.zeros((n * 3, 6))
-        bmat = np.zeros(n * 3)
-        for i, m in enumerate(moments):
-            if m[0] < np.finfo(np.float32).eps:
-                continue
-            lmd, nn = np.linalg.eigh(self._nodes[i][2])
-            s = m[1] / m[0]
-            nn = np.multiply(nn, np.sqrt(m[0] / lmd))
-            sl = slice(3 * i, 3 * (i + 1))
-            bmat[sl] = np.dot(nn.T, self._nodes[i][1]) - np.dot(nn.T, s)
-            amat[sl, :3] = np.cross(s, nn.T)
-            amat[sl, 3:] = nn.T
-        x, q, _, _ = np.linalg.lstsq(amat, bmat, rcond=-1)
+        x, q = _gmmtree.gmmtree_reg_mstep(estep_res.moments, self._nodes)
         rot, t = so.twist_mul(x, trans_p.rot, trans_p.t)
         return MstepResult(tf.RigidTransformation(rot, t), q)
 
@@ -84,4 +88,19 @@ def registration_gmmtree(source, target, maxiter=20, tol=1.0e-4,
     cv = lambda x: np.asarray(x.points if isinstance(x, o3.PointCloud) else x)
     gt = GMMTree(cv(source), **kargs)
     gt.set_callbacks(callbacks)
-    return gt.registration(cv(target), maxiter, tol)
\ No newline at end of file
+    return gt.registration(cv(target), maxiter, tol)
+
+
+def registration_gmmtree_many(sources, targets, tree_level=2, lambda_c=0.01,
+                              maxiter=20, tol=1.0e-4):
+    """GMMTree registration of each source to the target of the same index.
+    The trees are built and the pairs registered in parallel in C++ without the GIL.
+
+    Args:
+        sources (:obj:`list` of :obj:`numpy.ndarray`): Source point clouds.
+        targets (:obj:`list` of :obj:`numpy.ndarray`): Target point clouds.
+    """
+    cv = lambda x: np.asarray(x.points if isinstance(x, o3.PointCloud) else x)
+    res = _gmmtree.gmmtree_register_many([cv(s) for s in sources], [cv(t) for t in targets],
+                                         tree_level, 0.001, 1.0e-4, lambda_c, maxiter, tol)
+    return [MstepResult(tf.RigidTransformation(r.rot, r.t), r.q) for r in res]
@@ -15,21 +15,42 @@ class Normalizer(object):
         return x * self._scale + self._centroid
 
 
-def squared_kernel_sum(x, y):
+def squared_kernel_sum(x, y, exact=False):
+    """Mean squared distance between the points of x and y per dimension.
+    The pairwise distances are never stored: the sum is computed in closed form from
+    the second moments of x and y, or by tiles of pairs if exact is True.
     """
-    """
-    return _math.squared_kernel(x, y).sum() / (x.shape[0] * x.shape[1] * y.shape[0])
+    return _math.squared_kernel_sum(x, y, exact) / (x.shape[0] * x.shape[1] * y.shape[0])
 
 
-def rbf_kernel(x, y, beta):
-    return _math.rbf_kernel(x, y, beta)
+def rbf_kernel(x, y, beta, out=None):
+    """RBF kernel matrix of the points of x and y.
+    If out is given, a C-contiguous array of shape (N, M) and of the dtype of x,
+    the kernel is written to it in place and it is returned.
+    """
+    if out is None:
+        return _math.rbf_kernel(x, y, float(beta))
+    _math.rbf_kernel(x, y, float(beta), out)
+    return out
 
 
-def tps_kernel(x, y):
+def tps_kernel(x, y, out=None):
     assert x.shape[1] == y.shape[1], "x and y must have same dimensions."
     if x.shape[1] == 2:
-        return _math.tps_kernel_2d(x, y)
+        fn = _math.tps_kernel_2d
     elif x.shape[1] == 3:
-        return _math.tps_kernel_3d(x, y)
+        fn = _math.tps_kernel_3d
     else:
         raise ValueError('Invalid dimension of x: %d.' % x.shape[1])
+    if out is None:
+        return fn(x, y)
+    fn(x, y, out)
+    return out
+
+
+def low_rank_rbf_kernel(x, beta, rank):
+    """Nystrom approximation G ~ U U^T of the RBF Gram matrix of x
+    with `rank` k-center landmarks. Products and regularized solves
+    with the returned object cost O(Mk) and O(Mk^2).
+    """
+    return _math.LowRankGram(x, beta, rank)
@@ -55,13 +55,27 @@ class AffineTransformation(Transformation):
 
 
 class NonRigidTransformation(Transformation):
-    def __init__(self, w, points, beta=2.0):
+    """Nonrigid displacement G w of the points.
+    If rank is given, the Gram matrix G is replaced by a low rank approximation
+    and `g` is None.
+    """
+    def __init__(self, w, points, beta=2.0, rank=None):
         super(NonRigidTransformation, self).__init__()
-        self.g = mu.rbf_kernel(points, points, beta)
+        if rank is None:
+            self.g = mu.rbf_kernel(points, points, beta)
+            self.low_rank_g = None
+        else:
+            self.g = None
+            self.low_rank_g = mu.low_rank_rbf_kernel(points, beta, rank)
         self.w = w
 
+    def dot_g(self, w):
+        if self.low_rank_g is None:
+            return np.dot(self.g, w)
+        return self.low_rank_g.multiply(w)
+
     def _transform(self, points):
-        return points + np.dot(self.g, self.w)
+        return points + self.dot_g(self.w)
 
 
 class TPSTransformation(Transformation):
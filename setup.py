@@ -114,7 +114,8 @@ use_omp = _check_for_openmp()
 ext_modules = [
     Extension(
         'probreg._ifgt',
-        ['probreg/cc/ifgt_py.cc', 'probreg/cc/ifgt.cc', 'probreg/cc/kcenter_clustering.cc'],
+        ['probreg/cc/ifgt_py.cc', 'probreg/cc/ifgt.cc', 'probreg/cc/kcenter_clustering.cc',
+         'probreg/cc/direct_gauss_transform.cc'],
         include_dirs=[
             # Path to pybind11 headers
             get_pybind_include(),
@@ -126,7 +127,21 @@ ext_modules = [
     ),
     Extension(
         'probreg._math',
-        ['probreg/cc/math_utils_py.cc', 'probreg/cc/math_utils.cc'],
+        ['probreg/cc/math_utils_py.cc', 'probreg/cc/math_utils.cc', 'probreg/cc/low_rank_gram.cc',
+         'probreg/cc/kcenter_clustering.cc'],
+        include_dirs=[
+            # Path to pybind11 headers
+            get_pybind_include(),
+            get_pybind_include(user=True),
+            find_eigen(['third_party/eigen'])
+        ],
+        extra_link_args=['-lgomp'] if use_omp else [],
+        language='c++'
+    ),
+    Extension(
+        'probreg._cpd',
+        ['probreg/cc/cpd_py.cc', 'probreg/cc/cpd.cc', 'probreg/cc/ifgt.cc', 'probreg/cc/kcenter_clustering.cc',
+         'probreg/cc/direct_gauss_transform.cc', 'probreg/cc/math_utils.cc'],
         include_dirs=[
             # Path to pybind11 headers
             get_pybind_include(),
@@ -145,6 +160,7 @@ ext_modules = [
             get_pybind_include(user=True),
             find_eigen(['third_party/eigen'])
         ],
+        extra_link_args=['-lgomp'] if use_omp else [],
         language='c++'
     ),
     Extension(
@@ -156,22 +172,26 @@ ext_modules = [
             get_pybind_include(user=True),
             find_eigen(['third_party/eigen'])
         ],
+        extra_link_args=['-lgomp'] if use_omp else [],
         language='c++'
     ),
     Extension(
         'probreg._gmmtree',
-        ['probreg/cc/gmmtree_py.cc', 'probreg/cc/gmmtree.cc'],
+        ['probreg/cc/gmmtree_py.cc', 'probreg/cc/gmmtree.cc', 'probreg/cc/gmmtree_io.cc'],
         include_dirs=[
             # Path to pybind11 headers
             get_pybind_include(),
             get_pybind_include(user=True),
             find_eigen(['third_party/eigen'])
         ],
+        extra_link_args=['-lgomp'] if use_omp else [],
         language='c++'
     ),
     Extension(
         'probreg._permutohedral_lattice',
-        ['probreg/cc/permutohedral_lattice_py.cc', 'third_party/permutohedral/permutohedral.cpp'],
+        ['probreg/cc/permutohedral_lattice_py.cc', 'probreg/cc/filterreg.cc', 'probreg/cc/kabsch.cc',
+         'probreg/cc/point_to_plane.cc', 'probreg/cc/math_utils.cc',
+         'third_party/permutohedral/permutohedral.cpp'],
         include_dirs=[
             # Path to pybind11 headers
             get_pybind_include(),
@@ -179,12 +199,14 @@ ext_modules = [
             find_eigen(['third_party/eigen']),
             'third_party/permutohedral'
         ],
+        extra_link_args=['-lgomp'] if use_omp else [],
         language='c++'
     ),
 
     Extension(
         'probreg._preload_lattice',
-        ['probreg/cc/preload_lattice_py.cc', 'third_party/permutohedral/permutohedral_preload_filter.cpp'],
+        ['probreg/cc/preload_lattice_py.cc', 'third_party/permutohedral/permutohedral_preload_filter.cpp',
+         'third_party/permutohedral/permutohedral.cpp'],
         include_dirs=[
             # Path to pybind11 headers
             get_pybind_include(),
@@ -192,6 +214,7 @@ ext_modules = [
             find_eigen(['third_party/eigen']),
             'third_party/permutohedral'
         ],
+        extra_link_args=['-lgomp'] if use_omp else [],
         language='c++'
     ),
 ]
@@ -248,8 +271,13 @@ class BuildExt(build_ext):
                 opts.append('-fvisibility=hidden')
         elif ct == 'msvc':
             opts.append('/DVERSION_INFO=\\"%s\\"' % self.distribution.get_version())
+        # The AVX-512 kernels of the permutohedral lattice must round like the SSE/AVX2 ones,
+        # only the extensions built with the lattice give up the fused multiply-adds.
+        fp_contract_off = ct == 'unix' and has_flag(self.compiler, '-ffp-contract=off')
         for ext in self.extensions:
-            ext.extra_compile_args = opts
+            ext.extra_compile_args = list(opts)
+            if fp_contract_off and 'third_party/permutohedral/permutohedral.cpp' in ext.sources:
+                ext.extra_compile_args.append('-ffp-contract=off')
         build_ext.build_extensions(self)
 
 setup(
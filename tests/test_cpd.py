@@ -25,5 +25,28 @@ class CPDTest(unittest.TestCase):
                                     trans.euler_from_matrix(ref_rot), atol=1.0e-2, rtol=1.0e-2))
         self.assertTrue(np.allclose(res.transformation.t, self._tf.t, atol=1.0e-4, rtol=1.0e-4))
 
+    def test_native_registration(self):
+        for cls in [cpd.RigidCPD, cpd.AffineCPD]:
+            native = cls(self._source)
+            python = cls(self._source, use_native=False)
+            n_calls = [0]
+            native.set_callbacks([lambda t: n_calls.__setitem__(0, n_calls[0] + 1)])
+            res = native.registration(self._target)
+            ref = python.registration(self._target)
+            self.assertEqual(n_calls[0], len(native.history.q))
+            self.assertAlmostEqual(res.sigma2, native.history.sigma2[-1], places=6)
+            self.assertTrue(np.allclose(res.transformation.transform(self._source),
+                                        ref.transformation.transform(self._source), atol=1.0e-3))
+
+    def test_register_many(self):
+        res = cpd.registration_cpd_many([self._source] * 2, [self._target] * 2)
+        ref = cpd.registration_cpd(self._source, self._target)
+        self.assertEqual(len(res), 2)
+        for r in res:
+            self.assertTrue(np.allclose(r.transformation.transform(self._source),
+                                        ref.transformation.transform(self._source), atol=1.0e-3))
+        with self.assertRaises(ValueError):
+            cpd.registration_cpd_many([self._source], [self._target] * 2)
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -39,5 +39,50 @@ class FilterRegTest(unittest.TestCase):
                                     trans.euler_from_matrix(ref_rot), atol=2.0e-1, rtol=1.0e-1))
         self.assertTrue(np.allclose(res.transformation.t, self._tf.t, atol=1.0e-2, rtol=1.0e-3))
 
+    def test_maximization_step_sigma2(self):
+        rng = np.random.RandomState(0)
+        t_source = rng.rand(50, 3)
+        # Each point matches two target points at a distance d, sigma2 is d^2 / 3 per dimension.
+        d = 0.1
+        m0 = np.full(50, 2.0)
+        m1 = 2.0 * t_source
+        m2 = 2.0 * (np.square(t_source).sum(axis=1) + d * d)
+        res = filterreg.RigidFilterReg._maximization_step(t_source, t_source,
+                                                          filterreg.EstepResult(m0, m1, m2, None),
+                                                          tf.RigidTransformation(), 1.0)
+        self.assertAlmostEqual(res.sigma2, d * d / 3.0)
+
+    def test_filterreg_tracker(self):
+        tracker = filterreg.FilterRegTracker(self._source, sigma2=1.0e-4)
+        for i in range(1, 6):
+            rot = trans.euler_matrix(0.02 * i, -0.01 * i, 0.03 * i)[:3, :3]
+            t = np.array([0.002, -0.001, 0.001]) * i
+            res = tracker.track(np.dot(self._source, rot.T) + t)
+            self.assertTrue(np.allclose(res.transformation.rot, rot, atol=1.0e-2))
+            self.assertTrue(np.allclose(res.transformation.t, t, atol=1.0e-2))
+
+    def test_register_many(self):
+        rots = [trans.euler_matrix(0.02 * i, -0.01 * i, 0.03 * i)[:3, :3] for i in range(1, 3)]
+        ts = [np.array([0.002, -0.001, 0.001]) * i for i in range(1, 3)]
+        targets = [np.dot(self._source, r.T) + t for r, t in zip(rots, ts)]
+        source_normals = np.dot(self._target_normals, self._tf.rot)
+        normals = [np.dot(source_normals, r.T) for r in rots]
+        for objective_type in ['pt2pt', 'pt2pl']:
+            target_normals = normals if objective_type == 'pt2pl' else None
+            res = filterreg.registration_filterreg_many([self._source] * 2, targets, target_normals,
+                                                        sigma2=1.0e-4, objective_type=objective_type)
+            self.assertEqual(len(res), 2)
+            for i, r in enumerate(res):
+                tracker = filterreg.FilterRegTracker(self._source, sigma2=1.0e-4,
+                                                     objective_type=objective_type)
+                ref = tracker.track(targets[i], None if target_normals is None else target_normals[i])
+                self.assertTrue(np.allclose(r.transformation.rot, ref.transformation.rot, atol=1.0e-4))
+                self.assertTrue(np.allclose(r.transformation.t, ref.transformation.t, atol=1.0e-4))
+        with self.assertRaises(ValueError):
+            filterreg.registration_filterreg_many([self._source], targets)
+        with self.assertRaises(ValueError):
+            filterreg.registration_filterreg_many([self._source] * 2, targets, normals[:1],
+                                                  objective_type='pt2pl')
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -13,6 +13,7 @@ class GaussTransformTest(unittest.TestCase):
         x = np.r_[k1s, k2s]
         idxs = _ifgt._kcenter_clustering(x, 2)
         self.assertTrue((idxs[:n] != idxs[n:]).all())
+        self.assertTrue((idxs == _ifgt._kcenter_clustering(x, 2)).all())
 
     def test_gauss_transform(self):
         x = np.random.rand(10, 3)
@@ -27,5 +28,63 @@ class GaussTransformTest(unittest.TestCase):
         trans = gt.GaussTransform(x, h, sw_h=0.0)
         self.assertTrue(np.allclose(ans, trans.compute(y, w), atol=1.0e-4, rtol=1.0e-4))
 
+    def test_gauss_transform_batch(self):
+        rng = np.random.RandomState(0)
+        x = rng.rand(10, 3)
+        y = rng.rand(5, 3)
+        w = rng.rand(4, 10)
+        h = 1.0
+        ans = gt._gauss_transform_direct(x, y, w.T, h).T
+        trans = gt.GaussTransform(x, h, sw_h=0.0)
+        res = trans.compute(y, w)
+        self.assertEqual(res.shape, (4, 5))
+        self.assertTrue(np.allclose(ans, res, atol=1.0e-4, rtol=1.0e-4))
+        self.assertTrue(np.allclose(ans[1], trans.compute(y, w[1]), atol=1.0e-4, rtol=1.0e-4))
+
+    def test_gauss_transform_high_dims(self):
+        rng = np.random.RandomState(0)
+        centers = np.array([[0.0] * 4, [8.0] * 4])
+        x = 0.2 * rng.rand(600, 4) + centers[np.arange(600) % 2]
+        y = 0.2 * rng.rand(200, 4) + centers[np.arange(200) % 2]
+        w = rng.rand(600)
+        h = 1.0
+        ans = gt._gauss_transform_direct(x, y, w, h)
+        trans = gt.GaussTransform(x, h, sw_h=0.0)
+        self.assertTrue(np.allclose(ans, trans.compute(y, w), atol=1.0e-4, rtol=1.0e-4))
+
+    def test_direct_gauss_transform(self):
+        rng = np.random.RandomState(0)
+        x = rng.rand(1000, 3)
+        y = rng.rand(300, 3)
+        w = rng.rand(2, 1000)
+        h = 0.05
+        ans = gt._gauss_transform_direct(x, y, w.T, h).T
+        trans = gt.GaussTransform(x, h, sw_h=1.0)
+        self.assertTrue(np.allclose(ans, trans.compute(y, w), atol=1.0e-4, rtol=1.0e-4))
+        direct = _ifgt.DirectGaussTransform(x, h)
+        self.assertTrue(np.allclose(ans[0], direct.compute(y, w[0]), atol=1.0e-5, rtol=1.0e-5))
+
+    def test_ifgt_plan(self):
+        rng = np.random.RandomState(0)
+        x = rng.rand(400, 3)
+        plan = _ifgt.Ifgt(x, 0.5, 1.0e-4).plan
+        self.assertTrue(1 <= plan.num_clusters <= 20)
+        self.assertTrue(plan.truncation_number > 0)
+        self.assertTrue(plan.cutoff_radius > 0.0)
+        self.assertTrue(plan.complexity > plan.num_clusters)
+
+    def test_ifgt_reuse_plan(self):
+        rng = np.random.RandomState(0)
+        x = rng.rand(400, 3)
+        y = rng.rand(100, 3)
+        w = rng.rand(400)
+        ifgt = _ifgt.Ifgt64(x, 0.5, 1.0e-4)
+        self.assertEqual(ifgt.plan.h, 0.5)
+        self.assertEqual(ifgt.plan.eps, 1.0e-4)
+        reused = _ifgt.Ifgt64(x, 0.5, ifgt.plan)
+        self.assertTrue(np.array_equal(ifgt.compute(y, w), reused.compute(y, w)))
+        with self.assertRaises(ValueError):
+            _ifgt.Ifgt64(x, 1.0, ifgt.plan)
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -1,7 +1,9 @@
 import unittest
 import numpy as np
 from probreg import gaussian_filtering as gf
+from probreg import gaussian_filtering_fast as gff
 from probreg import gauss_transform as gt
+from probreg import _permutohedral_lattice
 
 class GaussianFilteringTest(unittest.TestCase):
     def test_gaussian_filtering(self):
@@ -17,5 +19,58 @@ class GaussianFilteringTest(unittest.TestCase):
                                           v1.flatten()[5:], np.sqrt(2.0))
         self.assertTrue(np.allclose((out0 / out1), (out2 / out3), atol=0, rtol=3.0e-1))
 
+    def test_filterreg_estep(self):
+        source = np.random.rand(20, 3)
+        target = np.random.rand(30, 3)
+        sigma2 = 0.1
+        m0, m1, m2, nx = _permutohedral_lattice.filterreg_estep(source, target, sigma2, 0.015, True)
+        self.assertIsNone(nx)
+        dem = np.power(2.0 * np.pi * sigma2, 1.5)
+        ph = gf.Permutohedral(np.r_[source, target] / np.sqrt(sigma2))
+        if ph.get_lattice_size() < 30 * 0.015:
+            ph = gf.Permutohedral(np.r_[source, target] / np.sqrt(sigma2), False)
+        ref0 = ph.filter(np.r_[np.zeros((20, 1)), np.ones((30, 1)) / dem], 20).flatten()[:20]
+        ref1 = ph.filter(np.r_[np.zeros((20, 3)), target / dem], 20)[:20]
+        ref2 = ph.filter(np.r_[np.zeros((20, 1)), np.square(target).sum(axis=1)[:, None] / dem], 20).flatten()[:20]
+        self.assertTrue(np.allclose(m0, ref0, rtol=1.0e-4))
+        self.assertTrue(np.allclose(m1, ref1, rtol=1.0e-4))
+        self.assertTrue(np.allclose(m2, ref2, rtol=1.0e-4))
+
+    def test_incremental_filterreg_estep(self):
+        source = np.random.rand(20, 3)
+        target = np.random.rand(30, 3)
+        sigma2 = 0.1
+        estep = _permutohedral_lattice.FilterRegEstep(target, 20, sigma2, 0.015, False)
+        for i in range(3):
+            t_source = source + 0.05 * i
+            m0, m1, m2, _ = estep.compute(t_source)
+            self.assertIsNone(m2)
+            ref0, ref1, _, _ = _permutohedral_lattice.filterreg_estep(t_source, target, sigma2, 0.015, False)
+            self.assertTrue(np.allclose(m0, ref0, rtol=1.0e-4))
+            self.assertTrue(np.allclose(m1, ref1, rtol=1.0e-4))
+
+    def test_vector_widths(self):
+        x = np.random.rand(1000, 3) * 10.0
+        v = np.random.rand(1000, 11)
+        outs = []
+        try:
+            for w in [1, 4, 8, 16]:
+                _permutohedral_lattice.set_max_vector_width(w)
+                outs.append(gf.Permutohedral(x).filter(v))
+        finally:
+            _permutohedral_lattice.set_max_vector_width(16)
+        self.assertTrue(np.allclose(outs[0], outs[1], rtol=1.0e-3))
+        for out in outs[2:]:
+            self.assertTrue(np.array_equal(out, outs[1]))
+
+    def test_preloaded_filtering(self):
+        x = np.random.rand(500, 3) * 10.0
+        v = np.random.rand(500, 4)
+        ph = gff.Permutohedral_fast(x, v)
+        self.assertEqual(ph.get_lattice_size(), gf.Permutohedral(x).get_lattice_size())
+        self.assertTrue(np.allclose(ph.filter(x), gf.Permutohedral(x).filter(v), rtol=1.0e-4, atol=1.0e-6))
+        self.assertTrue(np.allclose(ph.filter(x[:10]), ph.filter(x)[:10]))
+        self.assertTrue(np.all(ph.filter(x + 1000.0) == 0.0))
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
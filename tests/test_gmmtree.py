@@ -0,0 +1,85 @@
+import os
+import tempfile
+import unittest
+import numpy as np
+from probreg import gmmtree
+from probreg import _gmmtree
+
+
+class GMMTreeTest(unittest.TestCase):
+    def setUp(self):
+        self._source = np.random.RandomState(0).rand(500, 3)
+        self._filename = os.path.join(tempfile.mkdtemp(), 'tree.bin')
+
+    def tearDown(self):
+        if os.path.exists(self._filename):
+            os.remove(self._filename)
+
+    def test_save_and_load_tree(self):
+        gt = gmmtree.GMMTree(self._source, tree_level=2)
+        gt.save_tree(self._filename)
+        nodes, tree_level = _gmmtree.load_gmmtree(self._filename)
+        self.assertEqual(tree_level, 2)
+        self.assertEqual(len(nodes), len(gt._nodes))
+        self.assertTrue(np.allclose(gt._nodes.weights, nodes.weights))
+        self.assertTrue(np.allclose(gt._nodes.means, nodes.means))
+        self.assertTrue(np.allclose(gt._nodes.covs, nodes.covs))
+
+        tree = _gmmtree.MappedGmmTree(self._filename)
+        self.assertEqual(tree.means.shape, (len(nodes), 3))
+        self.assertEqual(tree.covs.shape, (len(nodes), 3, 3))
+        self.assertTrue(np.allclose(tree.covs[5], nodes.covs[5]))
+        self.assertFalse(tree.covs.flags.writeable)
+        m0 = _gmmtree.gmmtree_reg_estep(self._source, gt._nodes, 2, 0.01)
+        m1 = _gmmtree.gmmtree_reg_estep(self._source, tree, 2, 0.01)
+        self.assertTrue(np.allclose(m0.weights, m1.weights))
+        x0, q0 = _gmmtree.gmmtree_reg_mstep(m0, gt._nodes)
+        x1, q1 = _gmmtree.gmmtree_reg_mstep(m1, tree)
+        self.assertTrue(np.allclose(x0, x1))
+
+    def test_mixed_precision(self):
+        source = self._source.astype(np.float32)
+        nodes = _gmmtree.build_gmmtree(source, 2, 0.001, 1.0e-4)
+        self.assertEqual(nodes.means.dtype, np.float32)
+        m32 = _gmmtree.gmmtree_reg_estep(source, nodes, 2, 0.01)
+        m64 = _gmmtree.gmmtree_reg_estep(source, nodes, 2, 0.01, mixed_precision=True)
+        self.assertEqual(m64.weights.dtype, np.float64)
+        self.assertTrue(np.allclose(m32.weights, m64.weights, rtol=1.0e-4))
+        x32, _ = _gmmtree.gmmtree_reg_mstep(m32, nodes)
+        x64, _ = _gmmtree.gmmtree_reg_mstep(m64, nodes)
+        self.assertTrue(np.allclose(x32, x64, atol=1.0e-4))
+
+    def test_node_views(self):
+        nodes = _gmmtree.build_gmmtree(self._source, 2, 0.001, 1.0e-4)
+        self.assertEqual(nodes.weights.shape, (len(nodes),))
+        self.assertTrue(np.allclose(nodes.covs, np.transpose(nodes.covs, (0, 2, 1))))
+        nodes.means[3] = [1.0, 2.0, 3.0]
+        self.assertTrue(np.allclose(nodes.means[3], [1.0, 2.0, 3.0]))
+
+    def test_registration(self):
+        rot = np.array([[0.99500417, -0.09983342, 0.0],
+                        [0.09983342, 0.99500417, 0.0],
+                        [0.0, 0.0, 1.0]])
+        target = np.dot(self._source, rot.T) + np.array([0.01, 0.0, 0.02])
+        res = gmmtree.registration_gmmtree(self._source, target, tree_level=2)
+        self.assertTrue(np.allclose(res.transformation.rot, rot, atol=1.0e-2))
+        self.assertTrue(np.allclose(res.transformation.t, [0.01, 0.0, 0.02], atol=1.0e-2))
+
+    def test_register_many(self):
+        rot = np.array([[0.99500417, -0.09983342, 0.0],
+                        [0.09983342, 0.99500417, 0.0],
+                        [0.0, 0.0, 1.0]])
+        targets = [np.dot(self._source, rot.T) + np.array([0.01, 0.0, 0.02]),
+                   np.dot(self._source, rot) - np.array([0.0, 0.02, 0.01])]
+        res = gmmtree.registration_gmmtree_many([self._source] * 2, targets)
+        self.assertEqual(len(res), 2)
+        for r, target in zip(res, targets):
+            ref = gmmtree.GMMTree(self._source).registration(target)
+            self.assertTrue(np.allclose(r.transformation.rot, ref.transformation.rot, atol=1.0e-4))
+            self.assertTrue(np.allclose(r.transformation.t, ref.transformation.t, atol=1.0e-4))
+            self.assertAlmostEqual(r.q, ref.q, places=4)
+        with self.assertRaises(ValueError):
+            gmmtree.registration_gmmtree_many([self._source], targets)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -9,11 +9,49 @@ class MathUtilsTest(unittest.TestCase):
         x = np.arange(n * dim).reshape((n, dim))
         ans = np.sum([np.sum((x[i] - x)**2) for i in range(n)]) / (n * n * dim)
         self.assertAlmostEqual(mu.squared_kernel_sum(x, x), ans)
+        self.assertAlmostEqual(mu.squared_kernel_sum(x, x, exact=True), ans)
+
+    def test_squared_kernel_sum(self):
+        x = np.random.rand(3000, 3) + 100.0
+        y = 2.0 * np.random.rand(200, 3) + 100.0
+        ans = np.square(x[:, None, :] - y[None, :, :]).sum() / (3000 * 3 * 200)
+        self.assertTrue(np.isclose(mu.squared_kernel_sum(x, y), ans, rtol=1.0e-5))
+        self.assertTrue(np.isclose(mu.squared_kernel_sum(x, y, exact=True), ans, rtol=1.0e-5))
 
     def test_rbf_kernel(self):
         x = np.random.rand(5, 3)
         g = mu.rbf_kernel(x, x, 1.0)
         self.assertTrue(np.allclose(g, g.T))
 
+    def test_kernels(self):
+        x = np.random.rand(1500, 3)
+        y = np.random.rand(70, 3)
+        d2 = np.square(x[:, None, :] - y[None, :, :]).sum(axis=2)
+        self.assertTrue(np.allclose(mu.rbf_kernel(x, y, 0.5), np.exp(-d2 / (2.0 * 0.5)), atol=1.0e-6))
+        self.assertTrue(np.allclose(mu.tps_kernel(x, y), -np.sqrt(d2), atol=1.0e-5))
+        d2 = np.square(x[:, None, :2] - y[None, :, :2]).sum(axis=2)
+        self.assertTrue(np.allclose(mu.tps_kernel(x[:, :2], y[:, :2]), 0.5 * d2 * np.log(d2), atol=1.0e-5))
+        self.assertTrue(np.all(np.diag(mu.tps_kernel(x[:, :2], x[:, :2])) == 0.0))
+
+    def test_kernels_out(self):
+        x = np.random.rand(300, 3).astype(np.float32)
+        y = np.asfortranarray(np.random.rand(50, 3).astype(np.float32))
+        out = np.empty((300, 50), dtype=np.float32)
+        self.assertIs(mu.rbf_kernel(x, y, 0.5, out=out), out)
+        self.assertTrue(np.allclose(out, mu.rbf_kernel(x, y, 0.5), atol=1.0e-6))
+        mu.tps_kernel(x[::2], y, out=out[:150])
+        self.assertTrue(np.allclose(out[:150], mu.tps_kernel(x[::2], y), atol=1.0e-5))
+
+    def test_low_rank_rbf_kernel(self):
+        x = np.random.rand(1000, 3)
+        g = mu.rbf_kernel(x, x, 2.0)
+        lr = mu.low_rank_rbf_kernel(x, 2.0, 100)
+        self.assertLessEqual(lr.rank, 100)
+        self.assertTrue(np.allclose(np.dot(lr.factor, lr.factor.T), g, atol=1.0e-3))
+        p1 = np.random.rand(1000)
+        rhs = np.sin(x)
+        w = np.linalg.solve((p1 * g).T + 0.1 * np.identity(1000), rhs)
+        self.assertTrue(np.allclose(lr.multiply(lr.solve(p1, rhs, 0.1)), np.dot(g, w), atol=1.0e-2))
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
@@ -2,6 +2,7 @@ import unittest
 import numpy as np
 import transformations as trans
 import open3d as o3
+from probreg import _kabsch as kabsch
 from probreg import _pt2pl as pt2pl
 from probreg import se3_op as so
 from probreg import transformation as tf
@@ -35,5 +36,41 @@ class Point2PlaneTest(unittest.TestCase):
                                     trans.euler_from_matrix(r1), atol=5.0e-2, rtol=1.0e-2))
         self.assertTrue(np.allclose(t, self._tf.t, atol=5.0e-2, rtol=1.0e-3))
 
+    def test_point_to_plane_batch(self):
+        n = self._source.shape[0]
+        offsets = np.array([0, n, n, 2 * n])
+        source = np.r_[self._source, self._source]
+        target = np.r_[self._target, self._source]
+        normals = np.r_[self._target_normals, self._target_normals]
+        tws, qs = pt2pl.compute_twist_for_pt2pl_batch(source, target, normals, np.ones(2 * n), offsets)
+        self.assertEqual(tws.shape, (3, 6))
+        tw, q = pt2pl.compute_twist_for_pt2pl(self._source, self._target, self._target_normals, np.ones(n))
+        self.assertTrue(np.allclose(tws[0], tw, atol=1.0e-5))
+        self.assertAlmostEqual(qs[0], q, places=5)
+        self.assertTrue(np.allclose(tws[1:], 0.0, atol=1.0e-5))
+
+    def test_kabsch_batch(self):
+        n = self._source.shape[0]
+        offsets = np.array([0, n, 2 * n])
+        source = np.r_[self._source, self._source]
+        target = np.r_[self._target, self._source + 1.0]
+        rots, ts, res = kabsch.kabsch_batch(source, target, np.ones(2 * n), offsets)
+        self.assertTrue(np.allclose(rots[0], self._tf.rot, atol=1.0e-4))
+        self.assertTrue(np.allclose(rots[1], np.identity(3), atol=1.0e-4))
+        self.assertTrue(np.allclose(ts, [self._tf.t, np.ones(3)], atol=1.0e-4))
+        self.assertTrue(np.allclose(res, 0.0, atol=1.0e-6))
+
+    def test_kabsch_precision(self):
+        w = np.ones(self._source.shape[0])
+        r64, t64 = kabsch.kabsch(self._source, self._target, w)
+        self.assertEqual(r64.dtype, np.float64)
+        self.assertTrue(np.allclose(r64, self._tf.rot, atol=1.0e-8))
+        args = [a.astype(np.float32) for a in (self._source, self._target, w)]
+        for mixed in [False, True]:
+            r32, t32 = kabsch.kabsch(*args, mixed_precision=mixed)
+            self.assertEqual(r32.dtype, np.float32)
+            self.assertTrue(np.allclose(r32, r64, atol=1.0e-5))
+            self.assertTrue(np.allclose(t32, t64, atol=1.0e-5))
+
 if __name__ == "__main__":
     unittest.main()
\ No newline at end of file
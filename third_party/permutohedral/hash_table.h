@@ -0,0 +1,214 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/************************************************/
+/***                Hash Table                ***/
+/************************************************/
+
+// Open addressing table of the lattice points. The keys (key_size shorts) are packed in 64-bit words,
+// four coordinates per word, and stored by id in insertion order. A slot is a 32-bit word holding the
+// id of its key in its low log2(capacity) bits and hash bits of the key in the others: the table is at
+// most half full, so the ids never need more bits and the smaller tables keep more hash bits. Lookups
+// probe linearly a window of 8 slots at a time, comparing the hash bits of the whole window with SSE2,
+// and only the candidate slots compare their key. The table is sized up front for the expected number
+// of keys and only grows beyond it, up to 2^30 keys. The only deletion is truncate, which drops the last
+// inserted keys. Lookups without create do not modify the table and can run concurrently.
+class HashTable{
+public:
+	enum { MAX_KEY_WORDS = 8 };
+protected:
+	enum { WINDOW = 8, MAX_ID_BITS = 31 };
+	// Neither the ids nor the tags of the slots are all ones, EMPTY never matches a lookup
+	static const uint32_t EMPTY = ~0u;
+	size_t key_size_, key_words_, filled_, mask_;
+	int shift_, id_bits_;
+	uint32_t tag_mask_;
+	// capacity+WINDOW-1 slots, the last ones repeat the first ones so that a window never wraps
+	std::vector< uint32_t > slots_;
+	std::vector< uint64_t > keys_;
+
+	// Multiplicative (Fibonacci) hashing, the high bits of the product mix all the bits of the key
+	uint64_t hash( const uint64_t * w ) const {
+		uint64_t h = w[0] * 0x9e3779b97f4a7c15ULL;
+		for( size_t i=1; i<key_words_; i++ )
+			h = (h ^ (h >> 32) ^ w[i]) * 0x9e3779b97f4a7c15ULL;
+		return h;
+	}
+	// The highest id_bits_ bits of the hash select the slot, the next ones down to bit 32 make the tag
+	size_t home( uint64_t h ) const {
+		return size_t( h >> shift_ );
+	}
+	// Hash bits stored above the id in the slot, all ones is left to EMPTY
+	uint32_t tag( uint64_t h ) const {
+		const uint32_t t = uint32_t( h >> 32 ) << id_bits_;
+		return t == tag_mask_ ? t - (1u << id_bits_) : t;
+	}
+	// Pack the coordinates in the words of the key, the unused coordinates of the last word are 0.
+	// Each word is assembled in a register: storing the shorts and reloading them as a word would
+	// stall the load until the stores retire.
+	void pack( const short * k, uint64_t * key ) const {
+		for( size_t i=0; i<key_words_; i++ ){
+			uint64_t w = 0;
+			for( size_t j=0; j<4 && 4*i+j<key_size_; j++ )
+				w |= uint64_t( uint16_t( k[4*i+j] ) ) << (16*j);
+			key[i] = w;
+		}
+	}
+	bool equal( int e, const uint64_t * w ) const {
+		const uint64_t * key = &keys_[ e*key_words_ ];
+		for( size_t i=0; i<key_words_; i++ )
+			if (key[i] != w[i])
+				return false;
+		return true;
+	}
+	size_t capacity() const {
+		return mask_+1;
+	}
+	// Bit i of the result is set if slot i of the window holds the tag, bit i of empty if it is empty
+	unsigned match( const uint32_t * window, uint32_t tag, unsigned & empty ) const {
+#if defined(__SSE2__)
+		const __m128i tag_mask = _mm_set1_epi32( int( tag_mask_ ) ), t = _mm_set1_epi32( int( tag ) ), e = _mm_set1_epi32( int( EMPTY ) );
+		const __m128i s0 = _mm_loadu_si128( (const __m128i*)window ), s1 = _mm_loadu_si128( (const __m128i*)(window+4) );
+		empty = unsigned( _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( s0, e ) ) ) )
+		      | unsigned( _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( s1, e ) ) ) ) << 4;
+		return unsigned( _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( s0, tag_mask ), t ) ) ) )
+		     | unsigned( _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( s1, tag_mask ), t ) ) ) ) << 4;
+#else
+		unsigned r = 0;
+		empty = 0;
+		for( int i=0; i<WINDOW; i++ ){
+			r |= unsigned( (window[i] & tag_mask_) == tag ) << i;
+			empty |= unsigned( window[i] == EMPTY ) << i;
+		}
+		return r;
+#endif
+	}
+	static int lowestBit( unsigned m ){
+#if defined(__GNUC__)
+		return __builtin_ctz( m );
+#else
+		int i = 0;
+		for( ; !(m & 1); m >>= 1 ) i++;
+		return i;
+#endif
+	}
+	void allocate( size_t n_elements ){
+		size_t capacity = 2*WINDOW;
+		int shift;
+		for( shift=64; size_t( 1 ) << (64-shift) < capacity; shift-- );
+		while( capacity < 2*n_elements ){
+			capacity *= 2;
+			shift--;
+		}
+		if (64-shift > MAX_ID_BITS)
+			throw std::length_error( "Too many lattice points." );
+		shift_ = shift;
+		id_bits_ = 64-shift;
+		tag_mask_ = ~0u << id_bits_;
+		mask_ = capacity - 1;
+		slots_.assign( capacity+WINDOW-1, uint32_t( EMPTY ) );
+	}
+	// The key goes to the first empty slot from its home
+	void insertSlot( uint64_t h, int e ){
+		for( size_t s=home( h );; s = (s+WINDOW) & mask_ ){
+			unsigned empty;
+			match( &slots_[s], 0, empty );
+			if (empty){
+				const size_t p = (s + lowestBit( empty )) & mask_;
+				slots_[p] = tag( h ) | uint32_t( e );
+				if (p < WINDOW-1)
+					slots_[p+capacity()] = slots_[p];
+				return;
+			}
+		}
+	}
+	void grow(){
+		allocate( capacity() );
+		for( size_t e=0; e<filled_; e++ )
+			insertSlot( hash( &keys_[e*key_words_] ), e );
+	}
+public:
+	// n_elements is the expected number of keys, the table only grows beyond it
+	explicit HashTable( int key_size, size_t n_elements ) : key_size_( key_size ), key_words_( (key_size+3)/4 ), filled_( 0 ) {
+		if (key_words_ == 0) key_words_ = 1;
+		if (key_words_ > MAX_KEY_WORDS)
+			throw std::invalid_argument( "The lattice dimension is too large for the hash table." );
+		allocate( n_elements );
+		keys_.reserve( n_elements*key_words_ );
+	}
+	int size() const {
+		return filled_;
+	}
+	// Pack the key k and return its hash, the window where the lookup starts is prefetched so that
+	// the lookups of several keys can be prepared before probing them
+	uint64_t prepare( const short * k, uint64_t * key ) const {
+		pack( k, key );
+		const uint64_t h = hash( key );
+#if defined(__GNUC__)
+		__builtin_prefetch( &slots_[ home( h ) ] );
+#endif
+		return h;
+	}
+	// Id of a packed key with hash h, -1 if it is not in the table
+	int find( const uint64_t * key, uint64_t h ) const {
+		const uint32_t t = tag( h );
+		// At most half full, most keys are in their home slot
+		const uint32_t first = slots_[ home( h ) ];
+		if ((first & tag_mask_) == t && equal( first & ~tag_mask_, key ))
+			return first & ~tag_mask_;
+		for( size_t s=home( h );; s = (s+WINDOW) & mask_ ){
+			const uint32_t * window = &slots_[s];
+			unsigned empty;
+			for( unsigned m = match( window, t, empty ); m; m &= m-1 ){
+				const int e = window[ lowestBit( m ) ] & ~tag_mask_;
+				if (equal( e, key ))
+					return e;
+			}
+			// A key is never past the first empty slot from its home
+			if (empty)
+				return -1;
+		}
+	}
+	int find( const short * k, bool create = false ){
+		uint64_t key[ MAX_KEY_WORDS ] = {};
+		pack( k, key );
+		const uint64_t h = hash( key );
+		const int e = find( key, h );
+		if (e >= 0 || !create)
+			return e;
+		// Insert a new key and return the new id
+		if (2*(filled_+1) > capacity()) grow();
+		keys_.insert( keys_.end(), key, key+key_words_ );
+		insertSlot( h, filled_ );
+		return filled_++;
+	}
+	// Remove the keys [n, size()). A key sits at the first empty slot from its home when it is inserted
+	// and the slots never move afterwards (growing reinserts the keys in id order), so emptying the slots
+	// of the last keys in reverse order leaves the table as it was after inserting the first n keys.
+	void truncate( int n ){
+		for( size_t e=filled_; e-- > size_t( n ); ){
+			for( size_t s=home( hash( &keys_[e*key_words_] ) );; s = (s+1) & mask_ ){
+				if (slots_[s] != EMPTY && (slots_[s] & ~tag_mask_) == e){
+					slots_[s] = EMPTY;
+					if (s < WINDOW-1)
+						slots_[s+capacity()] = EMPTY;
+					break;
+				}
+			}
+		}
+		filled_ = n;
+		keys_.resize( filled_*key_words_ );
+	}
+	// Coordinates of the key of the lattice point i
+	void getKey( int i, short * k ) const {
+		const uint64_t * key = &keys_[ i*key_words_ ];
+		for( size_t j=0; j<key_size_; j++ )
+			k[j] = short( uint16_t( key[j/4] >> (16*(j%4)) ) );
+	}
+};
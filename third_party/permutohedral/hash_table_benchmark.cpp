@@ -0,0 +1,185 @@
+// Lookup throughput of the lattice hash table against the previous linear probing table.
+// Build: g++ -O3 -std=c++14 -I. hash_table_benchmark.cpp -o hash_table_benchmark
+// Usage: ./hash_table_benchmark [N=1000000] [d=3] [repeat=5]
+#include "hash_table.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// Table used by the lattice up to the packed key table, sized with the number of elements
+class LegacyHashTable{
+protected:
+	size_t key_size_, filled_, capacity_;
+	std::vector< short > keys_;
+	std::vector< int > table_;
+	void grow(){
+		// Create the new memory and copy the values in
+		int old_capacity = capacity_;
+		capacity_ *= 2;
+		std::vector<short> old_keys( (old_capacity+10)*key_size_ );
+		std::copy( keys_.begin(), keys_.end(), old_keys.begin() );
+		std::vector<int> old_table( capacity_, -1 );
+		
+		// Swap the memory
+		table_.swap( old_table );
+		keys_.swap( old_keys );
+		
+		// Reinsert each element
+		for( int i=0; i<old_capacity; i++ )
+			if (old_table[i] >= 0){
+				int e = old_table[i];
+				size_t h = hash( getKey(e) ) % capacity_;
+				for(; table_[h] >= 0; h = h<capacity_-1 ? h+1 : 0);
+				table_[h] = e;
+			}
+	}
+	size_t hash( const short * k ) const {
+		size_t r = 0;
+		for( size_t i=0; i<key_size_; i++ ){
+			r += k[i];
+			r *= 1664525;
+		}
+		return r;
+	}
+public:
+	explicit LegacyHashTable( int key_size, int n_elements ) : key_size_ ( key_size ), filled_(0), capacity_(2*n_elements), keys_((capacity_/2+10)*key_size_), table_(2*n_elements,-1) {
+	}
+	int size() const {
+		return filled_;
+	}
+	void reset() {
+		filled_ = 0;
+		std::fill( table_.begin(), table_.end(), -1 );
+	}
+	// Lookups without create do not modify the table and can run concurrently
+	int find( const short * k, bool create = false ){
+		if (create && 2*filled_ >= capacity_) grow();
+		// Get the hash value
+		size_t h = hash( k ) % capacity_;
+		// Find the element with he right key, using linear probing
+		while(1){
+			int e = table_[h];
+			if (e==-1){
+				if (create){
+					// Insert a new key and return the new id
+					for( size_t i=0; i<key_size_; i++ )
+						keys_[ filled_*key_size_+i ] = k[i];
+					return table_[h] = filled_++;
+				}
+				else
+					return -1;
+			}
+			// Check if the current key is The One
+			bool good = true;
+			for( size_t i=0; i<key_size_ && good; i++ )
+				if (keys_[ e*key_size_+i ] != k[i])
+					good = false;
+			if (good)
+				return e;
+			// Continue searching
+			h++;
+			if (h==capacity_) h = 0;
+		}
+	}
+	const short * getKey( int i ) const{
+		return &keys_[i*key_size_];
+	}
+
+};
+
+// Keys of the d+1 vertices of N random elements, as produced by the lattice: the vertices of an
+// element are close to each other and shared with the neighboring elements
+static std::vector<short> latticeKeys( int N, int d ){
+	std::mt19937 rng( 0 );
+	std::uniform_real_distribution<float> u( 0.0f, 1.0f );
+	const float extent = std::pow( float(N), 1.0f/d );
+	std::vector<short> keys( (size_t)N*(d+1)*d );
+	for( int i=0; i<N; i++ ){
+		std::vector<short> base( d );
+		for( int k=0; k<d; k++ )
+			base[k] = short( (d+1)*int( u( rng )*extent ) );
+		for( int j=0; j<=d; j++ )
+			for( int k=0; k<d; k++ )
+				keys[ ((size_t)i*(d+1)+j)*d+k ] = short( base[k] + (k < j ? d+1-j : -j) );
+	}
+	return keys;
+}
+
+static long long lookup( LegacyHashTable & table, const std::vector<short> & queries, int d, bool ){
+	long long found = 0;
+	for( size_t i=0; i<queries.size(); i+=d )
+		found += table.find( &queries[i] ) >= 0;
+	return found;
+}
+// The prepared lookups go by batches of 2(d+1) keys like the blur neighbors of the lattice: all the keys
+// of a batch are packed and their slots prefetched before probing them
+static long long lookup( HashTable & table, const std::vector<short> & queries, int d, bool prepared ){
+	long long found = 0;
+	if (!prepared){
+		for( size_t i=0; i<queries.size(); i+=d )
+			found += table.find( &queries[i] ) >= 0;
+		return found;
+	}
+	const size_t batch = 2*(d+1);
+	std::vector<uint64_t> packed( batch*HashTable::MAX_KEY_WORDS ), hashes( batch );
+	for( size_t i=0; i<queries.size(); i+=batch*d ){
+		const size_t n = std::min( batch, (queries.size()-i)/d );
+		for( size_t j=0; j<n; j++ )
+			hashes[j] = table.prepare( &queries[i+j*d], &packed[j*HashTable::MAX_KEY_WORDS] );
+		for( size_t j=0; j<n; j++ )
+			found += table.find( &packed[j*HashTable::MAX_KEY_WORDS], hashes[j] ) >= 0;
+	}
+	return found;
+}
+
+// Best of several runs, lookups are only timed on the table built in the last run
+template<typename Table>
+static void run( const char * name, const std::vector<short> & keys, const std::vector<short> & queries, int d, size_t n_elements, int repeat, bool prepared = false ){
+	typedef std::chrono::steady_clock Clock;
+	const size_t n_keys = keys.size()/d, n_queries = queries.size()/d;
+	double build = 1e30, probe = 1e30;
+	long long found = 0;
+	int vertices = 0;
+	for( int r=0; r<repeat; r++ ){
+		Clock::time_point t0 = Clock::now();
+		Table table( d, n_elements );
+		for( size_t i=0; i<n_keys; i++ )
+			table.find( &keys[i*d], true );
+		Clock::time_point t1 = Clock::now();
+		found = lookup( table, queries, d, prepared );
+		Clock::time_point t2 = Clock::now();
+		build = std::min( build, std::chrono::duration<double>( t1-t0 ).count() );
+		probe = std::min( probe, std::chrono::duration<double>( t2-t1 ).count() );
+		vertices = table.size();
+	}
+	printf( "%-8s vertices %d  build %7.1f ms (%6.1f Minserts/s)  lookup %7.1f ms (%6.1f Mlookups/s, %lld hits)\n",
+		name, vertices, build*1e3, n_keys/build*1e-6, probe*1e3, n_queries/probe*1e-6, found );
+}
+
+int main( int argc, char ** argv ){
+	const int N = argc > 1 ? atoi( argv[1] ) : 1000000;
+	const int d = argc > 2 ? atoi( argv[2] ) : 3;
+	const int repeat = argc > 3 ? atoi( argv[3] ) : 5;
+	const std::vector<short> keys = latticeKeys( N, d );
+	// Blur lookups: the two neighbors of every key along each axis, in a shuffled order
+	std::vector<short> queries;
+	queries.reserve( keys.size()*2*(d+1) );
+	for( size_t i=0; i<keys.size(); i+=d )
+		for( int j=0; j<=d; j++ )
+			for( int s=-1; s<=1; s+=2 )
+				for( int k=0; k<d; k++ )
+					queries.push_back( short( keys[i+k] + s*(k == j ? -d : 1) ) );
+	std::vector<size_t> order( queries.size()/d );
+	for( size_t i=0; i<order.size(); i++ ) order[i] = i;
+	std::shuffle( order.begin(), order.end(), std::mt19937( 1 ) );
+	std::vector<short> shuffled( queries.size() );
+	for( size_t i=0; i<order.size(); i++ )
+		std::copy( &queries[order[i]*d], &queries[order[i]*d]+d, &shuffled[i*d] );
+	printf( "N = %d, d = %d, %zu inserts, %zu lookups\n", N, d, keys.size()/d, shuffled.size()/d );
+	run<LegacyHashTable>( "legacy", keys, shuffled, d, N, repeat );
+	run<HashTable>( "packed", keys, shuffled, d, (size_t)N*(d+1), repeat );
+	run<HashTable>( "prepared", keys, shuffled, d, (size_t)N*(d+1), repeat, true );
+	return 0;
+}
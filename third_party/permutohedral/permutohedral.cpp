@@ -26,6 +26,8 @@
 */
 
 #include "permutohedral.h"
+#include "hash_table.h"
+#include <stdexcept>
 
 #ifdef WIN32
 inline int round(double X) {
@@ -33,318 +35,419 @@ inline int round(double X) {
 }
 #endif
 
-#ifdef __SSE__
-// SSE Permutoheral lattice
-# define SSE_PERMUTOHEDRAL
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#ifdef _OPENMP
+# include <omp.h>
 #endif
 
-#if defined(SSE_PERMUTOHEDRAL)
-# include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+// Vectorized Permutoheral lattice, the instruction set is selected at runtime
+# define VECTOR_PERMUTOHEDRAL
 # include <xmmintrin.h>
-# ifdef __SSE4_1__
-#  include <smmintrin.h>
-# endif
 #endif
 
 
 /************************************************/
-/***                Hash Table                ***/
+/***        Vectorized lattice kernels        ***/
 /************************************************/
 
-class HashTable{
-protected:
-	size_t key_size_, filled_, capacity_;
-	std::vector< short > keys_;
-	std::vector< int > table_;
-	void grow(){
-		// Create the new memory and copy the values in
-		int old_capacity = capacity_;
-		capacity_ *= 2;
-		std::vector<short> old_keys( (old_capacity+10)*key_size_ );
-		std::copy( keys_.begin(), keys_.end(), old_keys.begin() );
-		std::vector<int> old_table( capacity_, -1 );
-		
-		// Swap the memory
-		table_.swap( old_table );
-		keys_.swap( old_keys );
-		
-		// Reinsert each element
-		for( int i=0; i<old_capacity; i++ )
-			if (old_table[i] >= 0){
-				int e = old_table[i];
-				size_t h = hash( getKey(e) ) % capacity_;
-				for(; table_[h] >= 0; h = h<capacity_-1 ? h+1 : 0);
-				table_[h] = e;
+#ifdef VECTOR_PERMUTOHEDRAL
+// The kernels process W floats at a time (4: SSE, 8: AVX2, 16: AVX-512) and are specialized for the
+// feature dimensions 3 and 6 (D < 0 means d_ is only known at runtime). They are inlined into entry
+// points compiled for each instruction set, the parallel loops stay in the callers.
+template<int W> struct VecTypes{
+	typedef float F __attribute__((vector_size(W*sizeof(float))));
+	typedef int I __attribute__((vector_size(W*sizeof(int))));
+};
+# define KERNEL inline __attribute__((always_inline))
+
+struct LatticeKernels{
+	// Simplex of the elements [k0, k1) of feature, stored at begin+k in the lattice. The vertex keys go to keys.
+	template<int W, int D>
+	static KERNEL void embed( Permutohedral & ph, const MatrixXf & feature, int begin, short * keys, int k0, int k1 ){
+		typedef typename VecTypes<W>::F F;
+		typedef typename VecTypes<W>::I I;
+		const int d = D > 0 ? D : ph.d_;
+		const F Zero = F{};
+		const F One = Zero + 1.0f;
+		const F dplus1 = Zero + float(d+1);
+		const F invdplus1 = Zero + 1.0f / (d+1);
+		// Adding and subtracting 1.5*2^23 rounds to the nearest integer (ties to even, as _mm_round_ps)
+		const F round_magic = Zero + 12582912.0f;
+
+		// Allocate the local memory
+		F * scale_factor = (F*) _mm_malloc( d*sizeof(F), sizeof(F) );
+		F * f            = (F*) _mm_malloc( d*sizeof(F), sizeof(F) );
+		F * elevated     = (F*) _mm_malloc( (d+1)*sizeof(F), sizeof(F) );
+		F * rem0         = (F*) _mm_malloc( (d+1)*sizeof(F), sizeof(F) );
+		F * rank         = (F*) _mm_malloc( (d+1)*sizeof(F), sizeof(F) );
+		float * barycentric = new float[(d+2)*W];
+		short * canonical = new short[(d+1)*(d+1)];
+
+		// Compute the canonical simplex
+		for( int i=0; i<=d; i++ ){
+			for( int j=0; j<=d-i; j++ )
+				canonical[i*(d+1)+j] = i;
+			for( int j=d-i+1; j<=d; j++ )
+				canonical[i*(d+1)+j] = i - (d+1);
+		}
+
+		// Expected standard deviation of our filter (p.6 in [Adams etal 2010])
+		float inv_std_dev = (ph.with_blur_)? sqrt(2.0 / 3.0)*(d+1) : sqrt(1.0 / 6.0)*(d+1);
+		// Compute the diagonal part of E (p.5 in [Adams etal 2010])
+		for( int i=0; i<d; i++ )
+			scale_factor[i] = Zero + float( 1.0 / sqrt( (i+2)*(i+1) ) * inv_std_dev );
+
+		// Compute the simplex each feature lies in
+		for( int k=k0; k<k1; k+=W ){
+			// Load the feature from memory
+			float * ff = (float*)f;
+			for( int j=0; j<d; j++ )
+				for( int i=0; i<W; i++ )
+					ff[ j*W + i ] = k+i < k1 ? feature(j,k+i) : 0.0f;
+
+			// Elevate the feature ( y = Ep, see p.5 in [Adams etal 2010])
+
+			// sm contains the sum of 1..n of our faeture vector
+			F sm = Zero;
+			for( int j=d; j>0; j-- ){
+				F cf = f[j-1]*scale_factor[j-1];
+				elevated[j] = sm - float(j)*cf;
+				sm += cf;
+			}
+			elevated[0] = sm;
+
+			// Find the closest 0-colored simplex through rounding
+			F sum = Zero;
+			for( int i=0; i<=d; i++ ){
+				F v = invdplus1 * elevated[i];
+				v = (v + round_magic) - round_magic;
+				rem0[i] = v*dplus1;
+				sum += v;
+			}
+
+			// Find the simplex we are in and store it in rank (where rank describes what position coorinate i has in the sorted order of the features values)
+			for( int i=0; i<=d; i++ )
+				rank[i] = Zero;
+			for( int i=0; i<d; i++ ){
+				F di = elevated[i] - rem0[i];
+				for( int j=i+1; j<=d; j++ ){
+					F dj = elevated[j] - rem0[j];
+					F c = (F)( (I)One & (di < dj) );
+					rank[i] += c;
+					rank[j] += One-c;
+				}
+			}
+
+			// If the point doesn't lie on the plane (sum != 0) bring it back
+			for( int i=0; i<=d; i++ ){
+				rank[i] += sum;
+				F add = (F)( (I)dplus1 & (rank[i] < Zero) );
+				F sub = (F)( (I)dplus1 & (rank[i] >= dplus1) );
+				rank[i] += add-sub;
+				rem0[i] += add-sub;
+			}
+
+			// Compute the barycentric coordinates (p.10 in [Adams etal 2010])
+			for( int i=0; i<(d+2)*W; i++ )
+				barycentric[ i ] = 0;
+			for( int i=0; i<=d; i++ ){
+				F v = (elevated[i] - rem0[i])*invdplus1;
+				const float * fv = (const float*)&v;
+				const float * frank = (const float*)&rank[i];
+				for( int j=0; j<W; j++ ){
+					int p = d-frank[j];
+					barycentric[j*(d+2)+p  ] += fv[j];
+					barycentric[j*(d+2)+p+1] -= fv[j];
+				}
+			}
+
+			// The rest is not vectorized
+			const float * frank = (const float*)rank;
+			const float * frem0 = (const float*)rem0;
+			for( int j=0; j<W && k+j<k1; j++ ){
+				// Wrap around
+				barycentric[j*(d+2)+0]+= 1 + barycentric[j*(d+2)+d+1];
+
+				// Compute all vertices
+				for( int remainder=0; remainder<=d; remainder++ ){
+					short * key = &keys[ ((size_t)(k+j)*(d+1)+remainder)*d ];
+					for( int i=0; i<d; i++ )
+						key[i] = frem0[i*W+j] + canonical[ remainder*(d+1) + (int)frank[i*W+j] ];
+					ph.rank_[ (begin+k+j)*(d+1)+remainder ] = frank[remainder*W+j];
+					ph.barycentric_[ (begin+k+j)*(d+1)+remainder ] = barycentric[ j*(d+2)+remainder ];
+				}
 			}
-	}
-	size_t hash( const short * k ) {
-		size_t r = 0;
-		for( size_t i=0; i<key_size_; i++ ){
-			r += k[i];
-			r *= 1664525;
 		}
-		return r;
+
+		_mm_free( scale_factor );
+		_mm_free( f );
+		_mm_free( elevated );
+		_mm_free( rem0 );
+		_mm_free( rank );
+		delete [] barycentric;
+		delete [] canonical;
 	}
-public:
-	explicit HashTable( int key_size, int n_elements ) : key_size_ ( key_size ), filled_(0), capacity_(2*n_elements), keys_((capacity_/2+10)*key_size_), table_(2*n_elements,-1) {
+	// Splat to the lattice points [o0, o1), the rows of values and in hold vw vectors
+	template<int W, int D>
+	static KERNEL void splat( const Permutohedral & ph, float * values, const float * in, int vw, int start, int o0, int o1 ){
+		typedef typename VecTypes<W>::F F;
+		const int d = D > 0 ? D : ph.d_;
+		for( int o=o0; o<o1; o++ ){
+			F * val = (F*)values + (o+1)*vw;
+			// The moving elements come before the fixed ones, in the order of the index of all the elements
+			for( int l=0; l<2; l++ ){
+				const std::vector<int> & offsets = l ? ph.fixed_splat_offsets_ : ph.splat_offsets_;
+				const std::vector<int> & elements = l ? ph.fixed_splat_elements_ : ph.splat_elements_;
+				if (o+1 >= (int)offsets.size()) continue;
+				for( int s=offsets[o]; s<offsets[o+1]; s++ ){
+					const int e = elements[s];
+					const int i = e / (d+1);
+					if (i < start) continue;
+					const F w = F{} + ph.barycentric_[e];
+					const F * sse_val = (const F*)in + (i-start)*vw;
+					for( int k=0; k<vw; k++ )
+						val[k] += w * sse_val[k];
+				}
+			}
+		}
 	}
-	int size() const {
-		return filled_;
+	// Splat the elements [i0, i1) in order, the input rows start at the element start
+	template<int W, int D>
+	static KERNEL void scatter( const Permutohedral & ph, float * values, const float * in, int vw, int start, int i0, int i1 ){
+		typedef typename VecTypes<W>::F F;
+		const int d = D > 0 ? D : ph.d_;
+		for( int i=i0; i<i1; i++ ){
+			const F * sse_val = (const F*)in + (i-start)*vw;
+			for( int j=0; j<=d; j++ ){
+				F * val = (F*)values + (ph.offset_[i*(d+1)+j]+1)*vw;
+				const F w = F{} + ph.barycentric_[i*(d+1)+j];
+				for( int k=0; k<vw; k++ )
+					val[k] += w * sse_val[k];
+			}
+		}
 	}
-	void reset() {
-		filled_ = 0;
-		std::fill( table_.begin(), table_.end(), -1 );
+	// Blur the lattice points [i0, i1) along the axis j
+	template<int W, int D>
+	static KERNEL void blur( const Permutohedral & ph, float * new_values, const float * values, int vw, int j, int i0, int i1 ){
+		typedef typename VecTypes<W>::F F;
+		const int d = D > 0 ? D : ph.d_;
+		const F half = F{} + 0.5f;
+		for( int i=i0; i<i1; i++ ){
+			const F * old_val = (const F*)values + (i+1)*vw;
+			F * new_val = (F*)new_values + (i+1)*vw;
+
+			int n1 = ph.blur_neighbors_[i*(d+1)+j].n1+1;
+			int n2 = ph.blur_neighbors_[i*(d+1)+j].n2+1;
+			const F * n1_val = (const F*)values + n1*vw;
+			const F * n2_val = (const F*)values + n2*vw;
+			for( int k=0; k<vw; k++ )
+				new_val[k] = old_val[k]+half*(n1_val[k] + n2_val[k]);
+		}
 	}
-	int find( const short * k, bool create = false ){
-		if (2*filled_ >= capacity_) grow();
-		// Get the hash value
-		size_t h = hash( k ) % capacity_;
-		// Find the element with he right key, using linear probing
-		while(1){
-			int e = table_[h];
-			if (e==-1){
-				if (create){
-					// Insert a new key and return the new id
-					for( size_t i=0; i<key_size_; i++ )
-						keys_[ filled_*key_size_+i ] = k[i];
-					return table_[h] = filled_++;
-				}
-				else
-					return -1;
+	// Slice the elements [i0, i1) to out, whose rows hold value_size floats
+	template<int W, int D>
+	static KERNEL void slice( const Permutohedral & ph, float * out, const float * values, int value_size, int vw, int i0, int i1 ){
+		typedef typename VecTypes<W>::F F;
+		const int d = D > 0 ? D : ph.d_;
+		// Alpha is a magic scaling constant (write Andrew if you really wanna understand this)
+		const float alpha = 1.0f / (1+powf(2, -d));
+		F * sse_val = (F*) _mm_malloc( vw*sizeof(F), sizeof(F) );
+		for( int i=i0; i<i1; i++ ){
+			for( int k=0; k<vw; k++ )
+				sse_val[ k ] = F{};
+			for( int j=0; j<=d; j++ ){
+				int o = ph.offset_[i*(d+1)+j]+1;
+				F w = F{} + ph.barycentric_[i*(d+1)+j] * alpha;
+				const F * val = (const F*)values + o*vw;
+				for( int k=0; k<vw; k++ )
+					sse_val[ k ] += w * val[k];
 			}
-			// Check if the current key is The One
-			bool good = true;
-			for( size_t i=0; i<key_size_ && good; i++ )
-				if (keys_[ e*key_size_+i ] != k[i])
-					good = false;
-			if (good)
-				return e;
-			// Continue searching
-			h++;
-			if (h==capacity_) h = 0;
+			memcpy( out+i*value_size, sse_val, value_size*sizeof(float) );
 		}
+		_mm_free( sse_val );
+	}
+	// Dispatch the feature dimension to the specialized kernels
+	template<int W>
+	static KERNEL void embedAny( Permutohedral & ph, const MatrixXf & feature, int begin, short * keys, int k0, int k1 ){
+		if (ph.d_ == 3) embed<W,3>( ph, feature, begin, keys, k0, k1 );
+		else if (ph.d_ == 6) embed<W,6>( ph, feature, begin, keys, k0, k1 );
+		else embed<W,-1>( ph, feature, begin, keys, k0, k1 );
+	}
+	template<int W>
+	static KERNEL void splatAny( const Permutohedral & ph, float * values, const float * in, int vw, int start, int o0, int o1 ){
+		if (ph.d_ == 3) splat<W,3>( ph, values, in, vw, start, o0, o1 );
+		else if (ph.d_ == 6) splat<W,6>( ph, values, in, vw, start, o0, o1 );
+		else splat<W,-1>( ph, values, in, vw, start, o0, o1 );
+	}
+	template<int W>
+	static KERNEL void scatterAny( const Permutohedral & ph, float * values, const float * in, int vw, int start, int i0, int i1 ){
+		if (ph.d_ == 3) scatter<W,3>( ph, values, in, vw, start, i0, i1 );
+		else if (ph.d_ == 6) scatter<W,6>( ph, values, in, vw, start, i0, i1 );
+		else scatter<W,-1>( ph, values, in, vw, start, i0, i1 );
+	}
+	template<int W>
+	static KERNEL void blurAny( const Permutohedral & ph, float * new_values, const float * values, int vw, int j, int i0, int i1 ){
+		if (ph.d_ == 3) blur<W,3>( ph, new_values, values, vw, j, i0, i1 );
+		else if (ph.d_ == 6) blur<W,6>( ph, new_values, values, vw, j, i0, i1 );
+		else blur<W,-1>( ph, new_values, values, vw, j, i0, i1 );
 	}
-	const short * getKey( int i ) const{
-		return &keys_[i*key_size_];
+	template<int W>
+	static KERNEL void sliceAny( const Permutohedral & ph, float * out, const float * values, int value_size, int vw, int i0, int i1 ){
+		if (ph.d_ == 3) slice<W,3>( ph, out, values, value_size, vw, i0, i1 );
+		else if (ph.d_ == 6) slice<W,6>( ph, out, values, value_size, vw, i0, i1 );
+		else slice<W,-1>( ph, out, values, value_size, vw, i0, i1 );
 	}
+};
 
+struct KernelTable{
+	int width;
+	void (*embed)( Permutohedral & ph, const MatrixXf & feature, int begin, short * keys, int k0, int k1 );
+	void (*splat)( const Permutohedral & ph, float * values, const float * in, int vw, int start, int o0, int o1 );
+	void (*scatter)( const Permutohedral & ph, float * values, const float * in, int vw, int start, int i0, int i1 );
+	void (*blur)( const Permutohedral & ph, float * new_values, const float * values, int vw, int j, int i0, int i1 );
+	void (*slice)( const Permutohedral & ph, float * out, const float * values, int value_size, int vw, int i0, int i1 );
 };
 
-/************************************************/
-/***          Permutohedral Lattice           ***/
-/************************************************/
+// Entry points of the kernels compiled for one instruction set
+# define DEFINE_KERNELS( NAME, TARGET, W ) \
+	TARGET static void NAME##Embed( Permutohedral & ph, const MatrixXf & feature, int begin, short * keys, int k0, int k1 ){ \
+		LatticeKernels::embedAny<W>( ph, feature, begin, keys, k0, k1 ); \
+	} \
+	TARGET static void NAME##Splat( const Permutohedral & ph, float * values, const float * in, int vw, int start, int o0, int o1 ){ \
+		LatticeKernels::splatAny<W>( ph, values, in, vw, start, o0, o1 ); \
+	} \
+	TARGET static void NAME##Scatter( const Permutohedral & ph, float * values, const float * in, int vw, int start, int i0, int i1 ){ \
+		LatticeKernels::scatterAny<W>( ph, values, in, vw, start, i0, i1 ); \
+	} \
+	TARGET static void NAME##Blur( const Permutohedral & ph, float * new_values, const float * values, int vw, int j, int i0, int i1 ){ \
+		LatticeKernels::blurAny<W>( ph, new_values, values, vw, j, i0, i1 ); \
+	} \
+	TARGET static void NAME##Slice( const Permutohedral & ph, float * out, const float * values, int value_size, int vw, int i0, int i1 ){ \
+		LatticeKernels::sliceAny<W>( ph, out, values, value_size, vw, i0, i1 ); \
+	} \
+	static const KernelTable NAME##_kernels = { W, NAME##Embed, NAME##Splat, NAME##Scatter, NAME##Blur, NAME##Slice };
 
-Permutohedral::Permutohedral():N_( 0 ), M_( 0 ), d_( 0 ), with_blur_( true ) {
-}
-#ifdef SSE_PERMUTOHEDRAL
-void Permutohedral::init ( const MatrixXf & feature, bool with_blur )
-{
-	// Compute the lattice coordinates for each feature [there is going to be a lot of magic here
-	N_ = feature.cols();
-	d_ = feature.rows();
-	with_blur_ = with_blur;
-	HashTable hash_table( d_, N_/**(d_+1)*/ );
-	
-	constexpr int blocksize = sizeof(__m128) / sizeof(float);
-	const __m128 invdplus1   = _mm_set1_ps( 1.0f / (d_+1) );
-	const __m128 dplus1      = _mm_set1_ps( d_+1 );
-	const __m128 Zero        = _mm_set1_ps( 0 );
-	const __m128 One         = _mm_set1_ps( 1 );
+DEFINE_KERNELS( sse, , 4 )
+DEFINE_KERNELS( avx2, __attribute__((target("avx2"))), 8 )
+DEFINE_KERNELS( avx512, __attribute__((target("avx512f"))), 16 )
 
-	// Allocate the class memory
-	offset_.resize( (d_+1)*(N_+16) );
-	std::fill( offset_.begin(), offset_.end(), 0 );
-	barycentric_.resize( (d_+1)*(N_+16) );
-	std::fill( barycentric_.begin(), barycentric_.end(), 0 );
-	rank_.resize( (d_+1)*(N_+16) );
-	
-	// Allocate the local memory
-	__m128 * scale_factor = (__m128*) _mm_malloc( (d_  )*sizeof(__m128) , 16 );
-	__m128 * f            = (__m128*) _mm_malloc( (d_  )*sizeof(__m128) , 16 );
-	__m128 * elevated     = (__m128*) _mm_malloc( (d_+1)*sizeof(__m128) , 16 );
-	__m128 * rem0         = (__m128*) _mm_malloc( (d_+1)*sizeof(__m128) , 16 );
-	__m128 * rank         = (__m128*) _mm_malloc( (d_+1)*sizeof(__m128), 16 );
-	float * barycentric = new float[(d_+2)*blocksize];
-	short * canonical = new short[(d_+1)*(d_+1)];
-	short * key = new short[d_+1];
-	
-	// Compute the canonical simplex
-	for( int i=0; i<=d_; i++ ){
-		for( int j=0; j<=d_-i; j++ )
-			canonical[i*(d_+1)+j] = i;
-		for( int j=d_-i+1; j<=d_; j++ )
-			canonical[i*(d_+1)+j] = i - (d_+1);
-	}
-	
-	// Expected standard deviation of our filter (p.6 in [Adams etal 2010])
-	float inv_std_dev = (with_blur_)? sqrt(2.0 / 3.0)*(d_+1) : sqrt(1.0 / 6.0)*(d_+1);
-	// Compute the diagonal part of E (p.5 in [Adams etal 2010])
-	for( int i=0; i<d_; i++ )
-		scale_factor[i] = _mm_set1_ps( 1.0 / sqrt( (i+2)*(i+1) ) * inv_std_dev );
-	
-	// Setup the SSE rounding
-#ifndef __SSE4_1__
-	const unsigned int old_rounding = _mm_getcsr();
-	_mm_setcsr( (old_rounding&~_MM_ROUND_MASK) | _MM_ROUND_NEAREST );
+static const KernelTable & kernelTable( int width ){
+	if (width >= 16) return avx512_kernels;
+	if (width >= 8) return avx2_kernels;
+	return sse_kernels;
+}
+// Elements per parallel task of the kernels, a multiple of every vector width
+static const int KERNEL_CHUNK = 1024;
 #endif
 
-	// Compute the simplex each feature lies in
-	for( int k=0; k<N_; k+=blocksize ){
-		// Load the feature from memory
-		float * ff = (float*)f;
-		for( int j=0; j<d_; j++ )
-			for( int i=0; i<blocksize; i++ )
-				ff[ j*blocksize + i ] = k+i < N_ ? feature(j,k+i) : 0.0;
-		
-		// Elevate the feature ( y = Ep, see p.5 in [Adams etal 2010])
-		
-		// sm contains the sum of 1..n of our faeture vector
-		__m128 sm = Zero;
-		for( int j=d_; j>0; j-- ){
-			__m128 cf = f[j-1]*scale_factor[j-1];
-			elevated[j] = sm - _mm_set1_ps(j)*cf;
-			sm += cf;
-		}
-		elevated[0] = sm;
-		
-		// Find the closest 0-colored simplex through rounding
-		__m128 sum = Zero;
-		for( int i=0; i<=d_; i++ ){
-			__m128 v = invdplus1 * elevated[i];
-#ifdef __SSE4_1__
-			v = _mm_round_ps( v, _MM_FROUND_TO_NEAREST_INT );
+// Several threads splat by gathering the elements of each lattice point, a single thread scatters the
+// elements in order. Both accumulate each lattice point in the same order.
+static bool gatherSplat(){
+#ifdef _OPENMP
+	return omp_get_max_threads() > 1;
 #else
-			v = _mm_cvtepi32_ps( _mm_cvtps_epi32( v ) );
+	return false;
 #endif
-			rem0[i] = v*dplus1;
-			sum += v;
-		}
-		
-		// Find the simplex we are in and store it in rank (where rank describes what position coorinate i has in the sorted order of the features values)
-		for( int i=0; i<=d_; i++ )
-			rank[i] = Zero;
-		for( int i=0; i<d_; i++ ){
-			__m128 di = elevated[i] - rem0[i];
-			for( int j=i+1; j<=d_; j++ ){
-				__m128 dj = elevated[j] - rem0[j];
-				__m128 c = _mm_and_ps( One, _mm_cmplt_ps( di, dj ) );
-				rank[i] += c;
-				rank[j] += One-c;
-			}
-		}
-		
-		// If the point doesn't lie on the plane (sum != 0) bring it back
-		for( int i=0; i<=d_; i++ ){
-			rank[i] += sum;
-			__m128 add = _mm_and_ps( dplus1, _mm_cmplt_ps( rank[i], Zero ) );
-			__m128 sub = _mm_and_ps( dplus1, _mm_cmpge_ps( rank[i], dplus1 ) );
-			rank[i] += add-sub;
-			rem0[i] += add-sub;
-		}
-		
-		// Compute the barycentric coordinates (p.10 in [Adams etal 2010])
-		for( int i=0; i<(d_+2)*blocksize; i++ )
-			barycentric[ i ] = 0;
-		for( int i=0; i<=d_; i++ ){
-			__m128 v = (elevated[i] - rem0[i])*invdplus1;
-			
-			// Didn't figure out how to SSE this
-			float * fv = (float*)&v;
-			float * frank = (float*)&rank[i];
-			for( int j=0; j<blocksize; j++ ){
-				int p = d_-frank[j];
-				barycentric[j*(d_+2)+p  ] += fv[j];
-				barycentric[j*(d_+2)+p+1] -= fv[j];
-			}
-		}
-		
-		// The rest is not SSE'd
-		for( int j=0; j<blocksize; j++ ){
-			// Wrap around
-			barycentric[j*(d_+2)+0]+= 1 + barycentric[j*(d_+2)+d_+1];
-			
-			float * frank = (float*)rank;
-			float * frem0 = (float*)rem0;
-			// Compute all vertices and their offset
-			for( int remainder=0; remainder<=d_; remainder++ ){
-				for( int i=0; i<d_; i++ ){
-					key[i] = frem0[i*blocksize+j] + canonical[ remainder*(d_+1) + (int)frank[i*blocksize+j] ];
-				}
-				offset_[ (j+k)*(d_+1)+remainder ] = hash_table.find( key, true );
-				rank_[ (j+k)*(d_+1)+remainder ] = frank[remainder*blocksize+j];
-				barycentric_[ (j+k)*(d_+1)+remainder ] = barycentric[ j*(d_+2)+remainder ];
-			}
-		}
-	}
-
-	_mm_free( scale_factor );
-	_mm_free( f );
-	_mm_free( elevated );
-	_mm_free( rem0 );
-	_mm_free( rank );
-	delete [] barycentric;
-	delete [] canonical;
-	delete [] key;
+}
 
-	// Reset the SSE rounding
-#ifndef __SSE4_1__
-	_mm_setcsr( old_rounding );
+static std::atomic<int> max_vector_width( 16 );
+static int cpuVectorWidth(){
+#ifdef VECTOR_PERMUTOHEDRAL
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return 16;
+	if (__builtin_cpu_supports("avx2")) return 8;
+	return 4;
+#else
+	return 1;
 #endif
-	
-	// This is normally fast enough so no SSE needed here
-	// Find the Neighbors of each lattice point
-	
-	// Get the number of vertices in the lattice
-	M_ = hash_table.size();
-	
-	if (with_blur_){
-		// Create the neighborhood structure
-		blur_neighbors_.resize( (d_+1)*M_ );
-
-		short * n1 = new short[d_+1];
-		short * n2 = new short[d_+1];
+}
+int Permutohedral::vectorWidth()
+{
+	static const int cpu_width = cpuVectorWidth();
+	const int width = std::min( cpu_width, max_vector_width.load( std::memory_order_relaxed ) );
+	return width >= 16 ? 16 : width >= 8 ? 8 : width >= 4 ? 4 : 1;
+}
+void Permutohedral::setMaxVectorWidth( int width )
+{
+	max_vector_width.store( width, std::memory_order_relaxed );
+}
 
-		// For each of d+1 axes,
-		for( int j = 0; j <= d_; j++ ){
-			for( int i=0; i<M_; i++ ){
-				const short * key = hash_table.getKey( i );
-				for( int k=0; k<d_; k++ ){
-					n1[k] = key[k] - 1;
-					n2[k] = key[k] + 1;
-				}
-				n1[j] = key[j] + d_;
-				n2[j] = key[j] - d_;
+/************************************************/
+/***          Permutohedral Lattice           ***/
+/************************************************/
 
-				blur_neighbors_[j*M_+i].n1 = hash_table.find( n1 );
-				blur_neighbors_[j*M_+i].n2 = hash_table.find( n2 );
-			}
-		}
-		delete[] n1;
-		delete[] n2;
-	}
+Permutohedral::Permutohedral():N_( 0 ), M_( 0 ), d_( 0 ), with_blur_( true ), incremental_( false ), num_moving_( 0 ), num_fixed_vertices_( 0 ), preloaded_size_( 0 ) {
+}
+Permutohedral::~Permutohedral() {
 }
-#else
 void Permutohedral::init ( const MatrixXf & feature, bool with_blur )
 {
 	// Compute the lattice coordinates for each feature [there is going to be a lot of magic here
 	N_ = feature.cols();
 	d_ = feature.rows();
 	with_blur_ = with_blur;
-	HashTable hash_table( d_, N_*(d_+1) );
+	// The table is kept to locate query features
+	table_.reset( new HashTable( d_, (size_t)N_*(d_+1) ) );
+	incremental_ = false;
+	fixed_splat_offsets_.clear();
+	fixed_splat_elements_.clear();
+	preloaded_.clear();
 
 	// Allocate the class memory
 	offset_.resize( (d_+1)*N_ );
 	rank_.resize( (d_+1)*N_ );
 	barycentric_.resize( (d_+1)*N_ );
 	
+	embed( feature, 0, *table_ );
+	
+	// Find the Neighbors of each lattice point
+	
+	// Get the number of vertices in the lattice
+	M_ = table_->size();
+	
+	if (with_blur_)
+		computeNeighbors( *table_, 0 );
+	computeSplatIndex( 0, N_, M_, splat_offsets_, splat_elements_ );
+}
+// Embed the features as the elements [begin, begin+feature.cols()) of the lattice
+void Permutohedral::embed ( const MatrixXf & feature, int begin, HashTable & hash_table )
+{
+	const int n = feature.cols();
+	// Keys of the d+1 vertices of each element, inserted in the hash table once all are known
+	std::vector<short> keys;
+	embedKeys( feature, begin, keys );
+
+	// Insert the vertices in the order of the elements, the lattice does not depend on the number of threads
+	for( int e=0; e<n*(d_+1); e++ )
+		offset_[ begin*(d_+1)+e ] = hash_table.find( &keys[(size_t)e*d_], true );
+}
+// Simplex of the elements [begin, begin+feature.cols()), the keys of their d+1 vertices go to keys
+void Permutohedral::embedKeys ( const MatrixXf & feature, int begin, std::vector<short> & keys )
+{
+	const int n = feature.cols();
+	keys.resize( (size_t)n*(d_+1)*d_ );
+#ifdef VECTOR_PERMUTOHEDRAL
+	const int width = vectorWidth();
+	if (width > 1){
+		const KernelTable & kernels = kernelTable( width );
+		#pragma omp parallel for schedule(static)
+		for( int c=0; c<(n+KERNEL_CHUNK-1)/KERNEL_CHUNK; c++ )
+			kernels.embed( *this, feature, begin, keys.data(), c*KERNEL_CHUNK, std::min( n, (c+1)*KERNEL_CHUNK ) );
+	}
+	else
+#endif
+		seqEmbed( feature, begin, keys.data() );
+}
+// Scalar reference of the embedding
+void Permutohedral::seqEmbed ( const MatrixXf & feature, int begin, short * keys )
+{
+	const int n = feature.cols();
 	// Allocate the local memory
 	float * scale_factor = new float[d_];
-	float * elevated = new float[d_+1];
-	float * rem0 = new float[d_+1];
-	float * barycentric = new float[d_+2];
-	short * rank = new short[d_+1];
 	short * canonical = new short[(d_+1)*(d_+1)];
-	short * key = new short[d_+1];
 	
 	// Compute the canonical simplex
 	for( int i=0; i<=d_; i++ ){
@@ -361,7 +464,15 @@ void Permutohedral::init ( const MatrixXf & feature, bool with_blur )
 		scale_factor[i] = 1.0 / sqrt( double((i+2)*(i+1)) ) * inv_std_dev;
 	
 	// Compute the simplex each feature lies in
-	for( int k=0; k<N_; k++ ){
+	#pragma omp parallel
+	{
+	float * elevated = new float[d_+1];
+	float * rem0 = new float[d_+1];
+	float * barycentric = new float[d_+2];
+	short * rank = new short[d_+1];
+
+	#pragma omp for schedule(static)
+	for( int k=0; k<n; k++ ){
 		// Elevate the feature ( y = Ep, see p.5 in [Adams etal 2010])
 		const float * f = &feature(0,k);
 		
@@ -430,83 +541,184 @@ void Permutohedral::init ( const MatrixXf & feature, bool with_blur )
 		// Wrap around
 		barycentric[0] += 1.0 + barycentric[d_+1];
 		
-		// Compute all vertices and their offset
+		// Compute all vertices
 		for( int remainder=0; remainder<=d_; remainder++ ){
+			short * key = &keys[ ((size_t)k*(d_+1)+remainder)*d_ ];
 			for( int i=0; i<d_; i++ )
 				key[i] = rem0[i] + canonical[ remainder*(d_+1) + rank[i] ];
-			offset_[ k*(d_+1)+remainder ] = hash_table.find( key, true );
-			rank_[ k*(d_+1)+remainder ] = rank[remainder];
-			barycentric_[ k*(d_+1)+remainder ] = barycentric[ remainder ];
+			rank_[ (begin+k)*(d_+1)+remainder ] = rank[remainder];
+			barycentric_[ (begin+k)*(d_+1)+remainder ] = barycentric[ remainder ];
 		}
 	}
-	delete [] scale_factor;
 	delete [] elevated;
 	delete [] rem0;
 	delete [] barycentric;
 	delete [] rank;
+	}
+	delete [] scale_factor;
 	delete [] canonical;
-	delete [] key;
-	
-	// Find the Neighbors of each lattice point
-	
-	// Get the number of vertices in the lattice
-	M_ = hash_table.size();
-	
-	if (with_blur_){
-		// Create the neighborhood structure
-		blur_neighbors_.resize( (d_+1)*M_ );
+}
+// Find the neighbors of the lattice points [begin, M_) along each of the d+1 axes.
+// Neighbors are symmetric, so the points before begin that neighbor a new point are patched too.
+void Permutohedral::computeNeighbors ( HashTable & hash_table, int begin )
+{
+	blur_neighbors_.resize( (d_+1)*M_ );
 
-		short * n1 = new short[d_+1];
-		short * n2 = new short[d_+1];
+	#pragma omp parallel
+	{
+	short * key = new short[d_+1];
+	short * n1 = new short[d_+1];
+	short * n2 = new short[d_+1];
+	// Packed keys and hashes of the 2(d+1) neighbors of a lattice point, all of them are prepared
+	// (and their slots prefetched) before the table is probed
+	std::vector<uint64_t> packed( 2*(d_+1)*HashTable::MAX_KEY_WORDS ), hashes( 2*(d_+1) );
 
+	#pragma omp for schedule(static)
+	for( int i=begin; i<M_; i++ ){
+		hash_table.getKey( i, key );
 		// For each of d+1 axes,
 		for( int j = 0; j <= d_; j++ ){
-			for( int i=0; i<M_; i++ ){
-				const short * key = hash_table.getKey( i );
-				for( int k=0; k<d_; k++ ){
-					n1[k] = key[k] - 1;
-					n2[k] = key[k] + 1;
-				}
+			for( int k=0; k<d_; k++ ){
+				n1[k] = key[k] - 1;
+				n2[k] = key[k] + 1;
+			}
+			if (j < d_){
 				n1[j] = key[j] + d_;
 				n2[j] = key[j] - d_;
+			}
+			hashes[2*j] = hash_table.prepare( n1, &packed[2*j*HashTable::MAX_KEY_WORDS] );
+			hashes[2*j+1] = hash_table.prepare( n2, &packed[(2*j+1)*HashTable::MAX_KEY_WORDS] );
+		}
+		for( int j = 0; j <= d_; j++ ){
+			blur_neighbors_[i*(d_+1)+j].n1 = hash_table.find( &packed[2*j*HashTable::MAX_KEY_WORDS], hashes[2*j] );
+			blur_neighbors_[i*(d_+1)+j].n2 = hash_table.find( &packed[(2*j+1)*HashTable::MAX_KEY_WORDS], hashes[2*j+1] );
+		}
+	}
+	delete[] key;
+	delete[] n1;
+	delete[] n2;
+	}
 
-				blur_neighbors_[j*M_+i].n1 = hash_table.find( n1 );
-				blur_neighbors_[j*M_+i].n2 = hash_table.find( n2 );
+	for( int i=begin; begin>0 && i<M_; i++ ){
+		for( int j = 0; j <= d_; j++ ){
+			const Neighbors & nb = blur_neighbors_[i*(d_+1)+j];
+			if (nb.n1 >= 0 && nb.n1 < begin){
+				blur_neighbors_[nb.n1*(d_+1)+j].n2 = i;
+				patched_.push_back( nb.n1*(d_+1)+j );
+			}
+			if (nb.n2 >= 0 && nb.n2 < begin){
+				blur_neighbors_[nb.n2*(d_+1)+j].n1 = i;
+				patched_.push_back( nb.n2*(d_+1)+j );
 			}
 		}
-		delete[] n1;
-		delete[] n2;
 	}
 }
-#endif
-void Permutohedral::seqCompute ( float* out, const float* in, int value_size, bool reverse, int start ) const
+// Vertex entries of the elements [begin, end) splatted to each of the lattice points [0, num_vertices):
+// elements[offsets[o]:offsets[o+1]] in increasing order, so the splat can be computed per lattice point
+// without conflicting writes
+void Permutohedral::computeSplatIndex ( int begin, int end, int num_vertices, std::vector<int> & offsets, std::vector<int> & elements ) const
+{
+	offsets.assign( num_vertices+1, 0 );
+	for( int e=begin*(d_+1); e<end*(d_+1); e++ )
+		offsets[ offset_[e]+1 ]++;
+	for( int o=0; o<num_vertices; o++ )
+		offsets[o+1] += offsets[o];
+	elements.resize( (end-begin)*(d_+1) );
+	std::vector<int> fill( offsets.begin(), offsets.end()-1 );
+	for( int e=begin*(d_+1); e<end*(d_+1); e++ )
+		elements[ fill[ offset_[e] ]++ ] = e;
+}
+void Permutohedral::initFixed ( const MatrixXf & fixed, int num_moving, bool with_blur )
+{
+	d_ = fixed.rows();
+	N_ = num_moving + fixed.cols();
+	num_moving_ = num_moving;
+	with_blur_ = with_blur;
+	offset_.resize( (d_+1)*N_ );
+	rank_.resize( (d_+1)*N_ );
+	barycentric_.resize( (d_+1)*N_ );
+
+	table_.reset( new HashTable( d_, (size_t)N_*(d_+1) ) );
+	incremental_ = true;
+	embed( fixed, num_moving, *table_ );
+	M_ = num_fixed_vertices_ = table_->size();
+	blur_neighbors_.clear();
+	patched_.clear();
+	if (with_blur_)
+		computeNeighbors( *table_, 0 );
+	computeSplatIndex( num_moving_, N_, num_fixed_vertices_, fixed_splat_offsets_, fixed_splat_elements_ );
+	splat_offsets_.assign( M_+1, 0 );
+	splat_elements_.clear();
+}
+void Permutohedral::updateMoving ( const MatrixXf & moving )
+{
+	if (!incremental_ || moving.cols() != num_moving_ || moving.rows() != d_)
+		throw std::invalid_argument( "The moving features do not match the fixed lattice." );
+	// Drop the vertices and neighbor links created by the previous moving features
+	table_->truncate( num_fixed_vertices_ );
+	preloaded_.clear();
+	for( size_t p=0; p<patched_.size(); p++ ){
+		if (blur_neighbors_[patched_[p]].n1 >= num_fixed_vertices_) blur_neighbors_[patched_[p]].n1 = -1;
+		if (blur_neighbors_[patched_[p]].n2 >= num_fixed_vertices_) blur_neighbors_[patched_[p]].n2 = -1;
+	}
+	patched_.clear();
+
+	embed( moving, 0, *table_ );
+	M_ = table_->size();
+	if (with_blur_)
+		computeNeighbors( *table_, num_fixed_vertices_ );
+	computeSplatIndex( 0, num_moving_, M_, splat_offsets_, splat_elements_ );
+}
+// Splat the elements [start, N) and blur, values holds M+2 rows of value_size floats
+void Permutohedral::seqSplatBlur ( std::vector<float> & lattice_values, const float* in, int value_size, bool reverse, int start ) const
 {
 	// Shift all values by 1 such that -1 -> 0 (used for blurring)
-	float * values = new float[ (M_+2)*value_size ];
-	float * new_values = new float[ (M_+2)*value_size ];
-	
-	for( int i=0; i<(M_+2)*value_size; i++ )
-		values[i] = new_values[i] = 0;
+	std::vector<float> buffer( (M_+2)*value_size, 0.0f );
+	lattice_values.assign( (M_+2)*value_size, 0.0f );
+	float * values = lattice_values.data();
+	float * new_values = buffer.data();
 	
 	// Splatting
-	for( int i=start;  i<N_; i++ ){
-		for( int j=0; j<=d_; j++ ){
-			const int o = offset_[i*(d_+1)+j]+1;
-			const float& w = barycentric_[i*(d_+1)+j];
-			for( int k=0; k<value_size; k++ )
-				values[ o*value_size+k ] += w * in[ i*value_size+k ];
+	if (gatherSplat()){
+		#pragma omp parallel for schedule(static)
+		for( int o=0; o<M_; o++ ){
+			float * val = values + (o+1)*value_size;
+			for( int l=0; l<2; l++ ){
+				const std::vector<int> & offsets = l ? fixed_splat_offsets_ : splat_offsets_;
+				const std::vector<int> & elements = l ? fixed_splat_elements_ : splat_elements_;
+				if (o+1 >= (int)offsets.size()) continue;
+				for( int s=offsets[o]; s<offsets[o+1]; s++ ){
+					const int e = elements[s];
+					const int i = e / (d_+1);
+					if (i < start) continue;
+					const float& w = barycentric_[e];
+					for( int k=0; k<value_size; k++ )
+						val[k] += w * in[ i*value_size+k ];
+				}
+			}
+		}
+	}
+	else{
+		for( int i=start;  i<N_; i++ ){
+			for( int j=0; j<=d_; j++ ){
+				const int o = offset_[i*(d_+1)+j]+1;
+				const float& w = barycentric_[i*(d_+1)+j];
+				for( int k=0; k<value_size; k++ )
+					values[ o*value_size+k ] += w * in[ i*value_size+k ];
+			}
 		}
 	}
 	
 	if (with_blur_)
 	{
 		for( int j=reverse?d_:0; j<=d_ && j>=0; reverse?j--:j++ ){
+			#pragma omp parallel for schedule(static)
 			for( int i=0; i<M_; i++ ){
 				float * old_val = values + (i+1)*value_size;
 				float * new_val = new_values + (i+1)*value_size;
 
-				int n1 = blur_neighbors_[j*M_+i].n1+1;
-				int n2 = blur_neighbors_[j*M_+i].n2+1;
+				int n1 = blur_neighbors_[i*(d_+1)+j].n1+1;
+				int n2 = blur_neighbors_[i*(d_+1)+j].n2+1;
 				float * n1_val = values + n1*value_size;
 				float * n2_val = values + n2*value_size;
 				for( int k=0; k<value_size; k++ )
@@ -515,11 +727,21 @@ void Permutohedral::seqCompute ( float* out, const float* in, int value_size, bo
 			std::swap( values, new_values );
 		}
 	}
+	if (values != lattice_values.data())
+		lattice_values.swap( buffer );
+}
+void Permutohedral::seqCompute ( float* out, const float* in, int value_size, bool reverse, int start, int end ) const
+{
+	if (end < 0 || end > N_) end = N_;
+	std::vector<float> lattice_values;
+	seqSplatBlur( lattice_values, in, value_size, reverse, start );
+	const float * values = lattice_values.data();
 	// Alpha is a magic scaling constant (write Andrew if you really wanna understand this)
 	const float alpha = 1.0f / (1+powf(2, -d_));
 	
 	// Slicing
-	for( int i=0; i<N_; i++ ){
+	#pragma omp parallel for schedule(static)
+	for( int i=0; i<end; i++ ){
 		for( int k=0; k<value_size; k++ )
 			out[i*value_size+k] = 0;
 		for( int j=0; j<=d_; j++ ){
@@ -529,98 +751,129 @@ void Permutohedral::seqCompute ( float* out, const float* in, int value_size, bo
 				out[ i*value_size+k ] += w * values[ o*value_size+k ] * alpha;
 		}
 	}
-	
-	
-	delete[] values;
-	delete[] new_values;
 }
-#ifdef SSE_PERMUTOHEDRAL
-void Permutohedral::sseCompute ( float* out, const float* in, int value_size, bool reverse, int start ) const
+#ifdef VECTOR_PERMUTOHEDRAL
+void Permutohedral::vecCompute ( float* out, const float* in, int value_size, int width, bool reverse, int start, int end ) const
 {
-	const int sse_value_size = (value_size-1)*sizeof(float) / sizeof(__m128) + 1;
+	if (end < 0 || end > N_) end = N_;
+	// The widest kernels which do not mostly operate on padding
+	const KernelTable & kernels = kernelTable( width >= 16 && value_size > 8 ? 16 : width >= 8 && value_size > 4 ? 8 : 4 );
+	// Each row holds vw vectors of kernels.width floats
+	const int vw = (value_size-1) / kernels.width + 1;
+	const int row_size = vw*kernels.width;
 	// Shift all values by 1 such that -1 -> 0 (used for blurring)
-	__m128 * sse_val    = (__m128*) _mm_malloc( sse_value_size*sizeof(__m128), 16 );
-	__m128 * values     = (__m128*) _mm_malloc( (M_+2)*sse_value_size*sizeof(__m128), 16 );
-	__m128 * new_values = (__m128*) _mm_malloc( (M_+2)*sse_value_size*sizeof(__m128), 16 );
-	
-	__m128 Zero = _mm_set1_ps( 0 );
-	
-	for( int i=0; i<(M_+2)*sse_value_size; i++ )
-		values[i] = new_values[i] = Zero;
-	for( int i=0; i<sse_value_size; i++ )
-		sse_val[i] = Zero;
-	
+	float * padded_in  = (float*) _mm_malloc( (size_t)(N_-start)*row_size*sizeof(float), 64 );
+	float * values     = (float*) _mm_malloc( (size_t)(M_+2)*row_size*sizeof(float), 64 );
+	float * new_values = (float*) _mm_malloc( (size_t)(M_+2)*row_size*sizeof(float), 64 );
+	std::fill( values, values+(size_t)(M_+2)*row_size, 0.0f );
+	std::fill( new_values, new_values+(size_t)(M_+2)*row_size, 0.0f );
+
+	// Padded copy of the splatted values
+	#pragma omp parallel for schedule(static)
+	for( int i=start; i<N_; i++ ){
+		float * row = padded_in + (size_t)(i-start)*row_size;
+		std::fill( row+value_size, row+row_size, 0.0f );
+		memcpy( row, in+i*value_size, value_size*sizeof(float) );
+	}
+
 	// Splatting
-	for( int i=start;  i<N_; i++ ){
-		memcpy( sse_val, in+i*value_size, value_size*sizeof(float) );
-		for( int j=0; j<=d_; j++ ){
-			int o = offset_[i*(d_+1)+j]+1;
-			__m128 w = _mm_set1_ps( barycentric_[i*(d_+1)+j] );
-			for( int k=0; k<sse_value_size; k++ )
-				values[ o*sse_value_size+k ] += w * sse_val[k];
-		}
+	if (gatherSplat()){
+		#pragma omp parallel for schedule(static)
+		for( int c=0; c<(M_+KERNEL_CHUNK-1)/KERNEL_CHUNK; c++ )
+			kernels.splat( *this, values, padded_in, vw, start, c*KERNEL_CHUNK, std::min( M_, (c+1)*KERNEL_CHUNK ) );
 	}
+	else
+		kernels.scatter( *this, values, padded_in, vw, start, start, N_ );
+
 	// Blurring
 	if (with_blur_)
 	{
-		__m128 half = _mm_set1_ps(0.5);
 		for( int j=reverse?d_:0; j<=d_ && j>=0; reverse?j--:j++ ){
-			for( int i=0; i<M_; i++ ){
-				__m128 * old_val = values + (i+1)*sse_value_size;
-				__m128 * new_val = new_values + (i+1)*sse_value_size;
-
-				int n1 = blur_neighbors_[j*M_+i].n1+1;
-				int n2 = blur_neighbors_[j*M_+i].n2+1;
-				__m128 * n1_val = values + n1*sse_value_size;
-				__m128 * n2_val = values + n2*sse_value_size;
-				for( int k=0; k<sse_value_size; k++ )
-					new_val[k] = old_val[k]+half*(n1_val[k] + n2_val[k]);
-			}
+			#pragma omp parallel for schedule(static)
+			for( int c=0; c<(M_+KERNEL_CHUNK-1)/KERNEL_CHUNK; c++ )
+				kernels.blur( *this, new_values, values, vw, j, c*KERNEL_CHUNK, std::min( M_, (c+1)*KERNEL_CHUNK ) );
 			std::swap( values, new_values );
 		}
 	}
-	// Alpha is a magic scaling constant (write Andrew if you really wanna understand this)
-	const float alpha = 1.0f / (1+powf(2, -d_));
-	
+
 	// Slicing
-	for( int i=0; i<N_; i++ ){
-		for( int k=0; k<sse_value_size; k++ )
-			sse_val[ k ] = Zero;
-		for( int j=0; j<=d_; j++ ){
-			int o = offset_[i*(d_+1)+j]+1;
-			__m128 w = _mm_set1_ps( barycentric_[i*(d_+1)+j] * alpha );
-			for( int k=0; k<sse_value_size; k++ )
-				sse_val[ k ] += w * values[ o*sse_value_size+k ];
-		}
-		memcpy( out+i*value_size, sse_val, value_size*sizeof(float) );
-	}
-	
-	_mm_free( sse_val );
+	#pragma omp parallel for schedule(static)
+	for( int c=0; c<(end+KERNEL_CHUNK-1)/KERNEL_CHUNK; c++ )
+		kernels.slice( *this, out, values, value_size, vw, c*KERNEL_CHUNK, std::min( end, (c+1)*KERNEL_CHUNK ) );
+
+	_mm_free( padded_in );
 	_mm_free( values );
 	_mm_free( new_values );
 }
 #else
-void Permutohedral::sseCompute ( float* out, const float* in, int value_size, bool reverse, int start ) const
+void Permutohedral::vecCompute ( float* out, const float* in, int value_size, int, bool reverse, int start, int end ) const
 {
-	seqCompute( out, in, value_size, reverse, start );
+	seqCompute( out, in, value_size, reverse, start, end );
 }
 #endif
-void Permutohedral::compute ( MatrixXf & out, const MatrixXf & in, bool reverse, int start ) const
+void Permutohedral::compute ( MatrixXf & out, const MatrixXf & in, bool reverse, int start, int end ) const
 {
 	if( out.cols() != in.cols() || out.rows() != in.rows() )
 		out = 0*in;
-	if( in.rows() <= 2 )
-		seqCompute( out.data(), in.data(), in.rows(), reverse );
+	const int width = vectorWidth();
+	if( in.rows() <= 2 || width == 1 )
+		seqCompute( out.data(), in.data(), in.rows(), reverse, start, end );
 	else
-		sseCompute( out.data(), in.data(), in.rows(), reverse );
+		vecCompute( out.data(), in.data(), in.rows(), width, reverse, start, end );
 }
-MatrixXf Permutohedral::compute ( const MatrixXf & in, bool reverse, int start ) const
+MatrixXf Permutohedral::compute ( const MatrixXf & in, bool reverse, int start, int end ) const
 {
 	MatrixXf r;
-	compute( r, in, reverse, start );
+	compute( r, in, reverse, start, end );
 	return r;
 }
 
+void Permutohedral::preload ( const MatrixXf & in, bool reverse )
+{
+	if (in.cols() != N_)
+		throw std::invalid_argument( "The values do not match the lattice elements." );
+	seqSplatBlur( preloaded_, in.data(), in.rows(), reverse, 0 );
+	preloaded_size_ = in.rows();
+}
+MatrixXf Permutohedral::query ( const MatrixXf & features ) const
+{
+	if (preloaded_.empty())
+		throw std::runtime_error( "No values are preloaded in the lattice." );
+	if (features.rows() != d_)
+		throw std::invalid_argument( "The query features do not match the lattice dimension." );
+	const int n = features.cols();
+	const int value_size = preloaded_size_;
+
+	// Embed the queries with the scaling of the lattice, without creating lattice points
+	Permutohedral q;
+	q.d_ = d_;
+	q.N_ = n;
+	q.with_blur_ = with_blur_;
+	q.offset_.resize( (d_+1)*n );
+	q.rank_.resize( (d_+1)*n );
+	q.barycentric_.resize( (d_+1)*n );
+	std::vector<short> keys;
+	q.embedKeys( features, 0, keys );
+	#pragma omp parallel for schedule(static)
+	for( int e=0; e<n*(d_+1); e++ )
+		q.offset_[e] = table_->find( &keys[(size_t)e*d_] );
+
+	// Alpha is a magic scaling constant (write Andrew if you really wanna understand this)
+	const float alpha = 1.0f / (1+powf(2, -d_));
+
+	// Slicing, vertices missing from the lattice read the zero row
+	MatrixXf out = MatrixXf::Zero( value_size, n );
+	#pragma omp parallel for schedule(static)
+	for( int i=0; i<n; i++ ){
+		for( int j=0; j<=d_; j++ ){
+			const int o = q.offset_[i*(d_+1)+j]+1;
+			const float w = q.barycentric_[i*(d_+1)+j] * alpha;
+			for( int k=0; k<value_size; k++ )
+				out( k, i ) += w * preloaded_[ o*value_size+k ];
+		}
+	}
+	return out;
+}
 int Permutohedral::getLatticeSize() const
 {
 	return M_;
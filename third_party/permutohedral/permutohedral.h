@@ -31,6 +31,7 @@
 #include <cassert>
 #include <cstdio>
 #include <cmath>
+#include <memory>
 #include <Eigen/Core>
 using namespace Eigen;
 
@@ -39,6 +40,8 @@ using namespace Eigen;
 /************************************************/
 
 
+class HashTable;
+
 class Permutohedral
 {
 protected:
@@ -49,16 +52,52 @@ protected:
 	};
 	std::vector<int> offset_, rank_;
 	std::vector<float> barycentric_;
-	std::vector<Neighbors> blur_neighbors_;
+	std::vector<Neighbors> blur_neighbors_; // (d+1) neighbors of each lattice point
 	// Number of elements, size of sparse discretized space, dimension of features
 	int N_, M_, d_;
 	bool with_blur_;
-	void sseCompute ( float* out, const float* in, int value_size, bool reverse=false, int start=0 ) const;
-	void seqCompute ( float* out, const float* in, int value_size, bool reverse=false, int start=0 ) const;
+	std::unique_ptr<HashTable> table_;
+	// Incremental mode: the lattice points [0, num_fixed_vertices_) come from the fixed features, the others
+	// and the neighbor entries linking them to fixed points (patched_) from the moving ones
+	bool incremental_;
+	int num_moving_, num_fixed_vertices_;
+	std::vector<int> patched_;
+	// Inverse of offset_, the elements splatted to each lattice point. In incremental mode it only holds
+	// the moving elements, the fixed ones are in the fixed index of the fixed lattice points, built once.
+	std::vector<int> splat_offsets_, splat_elements_, fixed_splat_offsets_, fixed_splat_elements_;
+	// Splatted and blurred values kept for queries, preloaded_size_ values per lattice point
+	std::vector<float> preloaded_;
+	int preloaded_size_;
+	void embed ( const MatrixXf & feature, int begin, HashTable & hash_table );
+	void embedKeys ( const MatrixXf & feature, int begin, std::vector<short> & keys );
+	void seqEmbed ( const MatrixXf & feature, int begin, short * keys );
+	void computeNeighbors ( HashTable & hash_table, int begin );
+	void computeSplatIndex ( int begin, int end, int num_vertices, std::vector<int> & offsets, std::vector<int> & elements ) const;
+	// Values of the elements [start, N) are splatted, the elements [0, end) are sliced (end < 0 means N).
+	void vecCompute ( float* out, const float* in, int value_size, int width, bool reverse=false, int start=0, int end=-1 ) const;
+	void seqCompute ( float* out, const float* in, int value_size, bool reverse=false, int start=0, int end=-1 ) const;
+	void seqSplatBlur ( std::vector<float> & lattice_values, const float* in, int value_size, bool reverse, int start ) const;
+	friend struct LatticeKernels;
 public:
 	Permutohedral();
+	~Permutohedral();
 	void init ( const MatrixXf & features, bool with_blur = true );
+	// Incremental mode for features split into moving elements [0, num_moving) and fixed ones.
+	// The fixed part of the lattice is built once, updateMoving only embeds the moving features
+	// and computes the neighbors of the lattice points they create.
+	void initFixed ( const MatrixXf & fixed, int num_moving, bool with_blur = true );
+	void updateMoving ( const MatrixXf & moving );
+	// Preloaded filtering: the values of the elements are splatted and blurred once, then sliced at any
+	// number of query features. Lattice points that no element reaches contribute zero to the queries.
+	void preload ( const MatrixXf & in, bool reverse=false );
+	MatrixXf query ( const MatrixXf & features ) const;
 	int getLatticeSize() const;
-	MatrixXf compute ( const MatrixXf & v, bool reverse=false, int start=0 ) const;
-	void compute ( MatrixXf & out, const MatrixXf & in, bool reverse=false, int start=0 ) const;
+	// Width of the vectorized kernels selected from the CPU: 16 (AVX-512), 8 (AVX2), 4 (SSE) or
+	// 1 (scalar reference). setMaxVectorWidth caps it for all lattices, 1 forces the scalar code.
+	// The cap can be changed while other threads filter: each embedding or filtering reads the width
+	// once when it starts and keeps it to the end.
+	static int vectorWidth();
+	static void setMaxVectorWidth( int width );
+	MatrixXf compute ( const MatrixXf & v, bool reverse=false, int start=0, int end=-1 ) const;
+	void compute ( MatrixXf & out, const MatrixXf & in, bool reverse=false, int start=0, int end=-1 ) const;
 };